@@ -0,0 +1,44 @@
+# Training workload for profile-guided optimization: runs the stamping paths
+# of a release build, Load, edits and Commit, against copies of rcedit itself.
+#
+#   cmake -DRCEDIT=<path-to-rcedit.exe> -DWORK_DIR=<dir> -P pgo-train.cmake
+
+if(NOT RCEDIT OR NOT WORK_DIR)
+  message(FATAL_ERROR "RCEDIT and WORK_DIR are required")
+endif()
+
+set(ITERATIONS 20)
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+file(WRITE "${WORK_DIR}/data.bin" "rcedit profile-guided optimization training data")
+
+function(run_rcedit)
+  execute_process(COMMAND "${RCEDIT}" ${ARGN} RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "rcedit ${ARGN} failed: ${result}")
+  endif()
+endfunction()
+
+foreach(i RANGE 1 ${ITERATIONS})
+  set(target "${WORK_DIR}/target-${i}.exe")
+  configure_file("${RCEDIT}" "${target}" COPYONLY)
+
+  # Queries, answered from a single load.
+  run_rcedit("${target}" --get-version-string FileDescription --get-file-version
+             --get-product-version --get-icon-groups --output-format json)
+
+  # The edits of a release stamp, committed in place.
+  run_rcedit("${target}" --set-version-string CompanyName "GitHub, Inc."
+             --set-version-string FileDescription "rcedit ${i}"
+             --set-file-version "1.${i}.0.0" --set-product-version "1.${i}.0"
+             --set-resource-string 1 "string ${i}" --stats)
+
+  # Larger payloads that move the resource section, then a no-op re-run.
+  run_rcedit("${target}" --rsrc-layout relocate --set-resource RCDATA TRAINING "${WORK_DIR}/data.bin"
+             --all-languages --set-version-string ProductName "rcedit")
+  run_rcedit("${target}" --all-languages --set-version-string ProductName "rcedit")
+
+  run_rcedit("${target}" --export-res "${WORK_DIR}/target-${i}.res")
+  run_rcedit("${target}" --import-res "${WORK_DIR}/target-${i}.res")
+endforeach()
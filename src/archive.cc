@@ -0,0 +1,574 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "archive.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <wctype.h>
+#include <algorithm>
+
+#include "inflate.h"
+#include "parallel.h"
+#include "record.h"
+#include "scoped_file.h"
+
+namespace rescle {
+
+namespace {
+
+const DWORD kZipLocalSignature = 0x04034b50;
+const DWORD kZipCentralSignature = 0x02014b50;
+const DWORD kZipEndSignature = 0x06054b50;
+const DWORD kZipDescriptorSignature = 0x08074b50;
+const WORD kZipEncrypted = 0x0001;
+const WORD kZipDescriptor = 0x0008;
+const WORD kZipUtf8 = 0x0800;
+const WORD kZipStored = 0;
+const WORD kZipDeflated = 8;
+// Deflate cannot expand a byte of input to more than 1032 bytes of output.
+const size_t kDeflateMaxRatio = 1032;
+const UINT kCodePageIbm437 = 437;
+const size_t kTarBlockSize = 512;
+
+struct ZipLocalHeaderLayout {
+  typedef Field<DWORD, 0> Signature;
+  typedef Field<WORD, 6> Flags;
+  typedef Field<WORD, 8> Method;
+  typedef Field<DWORD, 14> Crc32;
+  typedef Field<DWORD, 18> CompressedSize;
+  typedef Field<DWORD, 22> UncompressedSize;
+  typedef Field<WORD, 26> NameLength;
+  typedef Field<WORD, 28> ExtraLength;
+  static constexpr size_t kSize = 30;
+};
+
+struct ZipCentralHeaderLayout {
+  typedef Field<DWORD, 0> Signature;
+  typedef Field<WORD, 8> Flags;
+  typedef Field<WORD, 10> Method;
+  typedef Field<DWORD, 16> Crc32;
+  typedef Field<DWORD, 20> CompressedSize;
+  typedef Field<DWORD, 24> UncompressedSize;
+  typedef Field<WORD, 28> NameLength;
+  typedef Field<WORD, 30> ExtraLength;
+  typedef Field<WORD, 32> CommentLength;
+  typedef Field<DWORD, 42> LocalHeaderOffset;
+  static constexpr size_t kSize = 46;
+};
+
+struct ZipEndLayout {
+  typedef Field<DWORD, 0> Signature;
+  typedef Field<WORD, 4> Disk;
+  typedef Field<WORD, 6> CentralDisk;
+  typedef Field<WORD, 10> Entries;
+  typedef Field<DWORD, 12> CentralSize;
+  typedef Field<DWORD, 16> CentralOffset;
+  static constexpr size_t kSize = 22;
+};
+
+struct ZipEntry {
+  size_t central;        // offset of the central directory record
+  size_t centralLength;
+  size_t local;          // offset of the local header
+  size_t localLength;    // header, data and data descriptor
+  size_t dataOffset;
+  WORD flags;
+  WORD method;
+  DWORD crc;
+  DWORD compressedSize;
+  DWORD uncompressedSize;
+  DWORD newLocal = 0;
+  std::wstring name;
+  bool matched = false;
+  std::vector<BYTE> content;
+};
+
+struct TarEntry {
+  size_t header;         // offset of the header block
+  size_t length;         // header, data and padding
+  size_t size = 0;       // data, checked against the file
+  std::wstring name;
+  bool regular = false;
+  bool paxSize = false;  // the size is overridden by a pax header
+  bool matched = false;
+  std::vector<BYTE> content;
+};
+
+// Writes the new archive sequentially, batching the small header writes.
+class ArchiveWriter {
+ public:
+  explicit ArchiveWriter(HANDLE file) : file_(file), offset_(0) {}
+
+  bool Write(const BYTE* data, size_t size) {
+    offset_ += size;
+    if (buffer_.size() + size > kBufferSize && !Flush())
+      return false;
+    if (size >= kBufferSize)
+      return WriteAll(file_, data, size);
+    buffer_.insert(buffer_.end(), data, data + size);
+    return true;
+  }
+
+  bool Write(const std::vector<BYTE>& data) { return Write(data.data(), data.size()); }
+
+  bool Flush() {
+    bool succeeded = WriteAll(file_, buffer_.data(), buffer_.size());
+    buffer_.clear();
+    return succeeded;
+  }
+
+  ULONGLONG offset() const { return offset_; }
+
+ private:
+  static constexpr size_t kBufferSize = 1 << 20;
+
+  HANDLE file_;
+  ULONGLONG offset_;
+  std::vector<BYTE> buffer_;
+};
+
+std::wstring DecodeName(const BYTE* data, size_t size, UINT codePage) {
+  if (size == 0 || size > INT_MAX)
+    return std::wstring();
+
+  const char* bytes = reinterpret_cast<const char*>(data);
+  int length = MultiByteToWideChar(codePage, 0, bytes, static_cast<int>(size), NULL, 0);
+  std::wstring name(length, L'\0');
+  if (length > 0)
+    MultiByteToWideChar(codePage, 0, bytes, static_cast<int>(size), &name[0], length);
+  return name;
+}
+
+// Entry paths are matched with forward slashes.
+std::wstring NormalizePath(const std::wstring& path) {
+  std::wstring normalized(path);
+  std::replace(normalized.begin(), normalized.end(), L'\\', L'/');
+  return normalized;
+}
+
+bool IsMatch(const std::wstring& pattern, const std::wstring& name) {
+  std::wstring path = NormalizePath(name);
+  return !path.empty() && path.back() != L'/' && MatchArchivePath(pattern.c_str(), path.c_str());
+}
+
+bool FindZipEnd(const BYTE* data, size_t size, size_t* end) {
+  if (size < ZipEndLayout::kSize)
+    return false;
+
+  // The record is followed by a comment of up to 64 KiB.
+  size_t last = size - ZipEndLayout::kSize;
+  size_t first = last > 0xffff ? last - 0xffff : 0;
+  for (size_t offset = last + 1; offset-- > first;) {
+    if (LoadLittleEndian<DWORD>(data + offset) == kZipEndSignature) {
+      *end = offset;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ReadZipEntries(ByteSpan file, size_t endOffset, std::vector<ZipEntry>* entries) {
+  RecordView<ZipEndLayout> end(file.Subspan(endOffset));
+  WORD count = end.Get<ZipEndLayout::Entries>();
+  DWORD centralOffset = end.Get<ZipEndLayout::CentralOffset>();
+  if (count == 0xffff || centralOffset == 0xffffffff ||
+      end.Get<ZipEndLayout::CentralSize>() == 0xffffffff ||
+      end.Get<ZipEndLayout::Disk>() != 0 || end.Get<ZipEndLayout::CentralDisk>() != 0) {
+    fprintf(stderr, "Zip64 and multi-volume archives are not supported\n");
+    return false;
+  }
+
+  size_t position = centralOffset;
+  for (WORD i = 0; i < count; ++i) {
+    RecordView<ZipCentralHeaderLayout> central(file.Subspan(position));
+    if (!central.valid() || central.Get<ZipCentralHeaderLayout::Signature>() != kZipCentralSignature)
+      return false;
+
+    ZipEntry entry;
+    WORD nameLength = central.Get<ZipCentralHeaderLayout::NameLength>();
+    entry.central = position;
+    entry.centralLength = ZipCentralHeaderLayout::kSize + nameLength +
+                          central.Get<ZipCentralHeaderLayout::ExtraLength>() +
+                          central.Get<ZipCentralHeaderLayout::CommentLength>();
+    if (!file.Contains(position, entry.centralLength))
+      return false;
+
+    entry.flags = central.Get<ZipCentralHeaderLayout::Flags>();
+    entry.method = central.Get<ZipCentralHeaderLayout::Method>();
+    entry.crc = central.Get<ZipCentralHeaderLayout::Crc32>();
+    entry.compressedSize = central.Get<ZipCentralHeaderLayout::CompressedSize>();
+    entry.uncompressedSize = central.Get<ZipCentralHeaderLayout::UncompressedSize>();
+    entry.name = DecodeName(file.data() + position + ZipCentralHeaderLayout::kSize, nameLength,
+                            entry.flags & kZipUtf8 ? CP_UTF8 : kCodePageIbm437);
+
+    entry.local = central.Get<ZipCentralHeaderLayout::LocalHeaderOffset>();
+    // Zip64 entries keep their real sizes and offset in an extra field.
+    if (entry.compressedSize == 0xffffffff || entry.uncompressedSize == 0xffffffff ||
+        entry.local == 0xffffffff) {
+      fprintf(stderr, "Zip64 and multi-volume archives are not supported\n");
+      return false;
+    }
+
+    RecordView<ZipLocalHeaderLayout> local(file.Subspan(entry.local));
+    if (!local.valid() || local.Get<ZipLocalHeaderLayout::Signature>() != kZipLocalSignature)
+      return false;
+
+    // The central directory has the sizes even when the local header
+    // defers them to a data descriptor.
+    entry.dataOffset = entry.local + ZipLocalHeaderLayout::kSize +
+                       local.Get<ZipLocalHeaderLayout::NameLength>() +
+                       local.Get<ZipLocalHeaderLayout::ExtraLength>();
+    if (!file.Contains(entry.dataOffset, entry.compressedSize))
+      return false;
+
+    size_t dataEnd = entry.dataOffset + entry.compressedSize;
+    size_t descriptor = 0;
+    if (local.Get<ZipLocalHeaderLayout::Flags>() & kZipDescriptor) {
+      bool signed_ = file.Contains(dataEnd, sizeof(DWORD)) &&
+                     LoadLittleEndian<DWORD>(file.data() + dataEnd) == kZipDescriptorSignature;
+      descriptor = signed_ ? 16 : 12;
+      if (!file.Contains(dataEnd, descriptor))
+        return false;
+    }
+    entry.localLength = dataEnd + descriptor - entry.local;
+
+    position += entry.centralLength;
+    entries->push_back(std::move(entry));
+  }
+  return true;
+}
+
+bool ExtractZipEntry(const BYTE* data, ZipEntry* entry) {
+  if (entry->flags & kZipEncrypted) {
+    fprintf(stderr, "Cannot edit encrypted entry \"%ls\"\n", entry->name.c_str());
+    return false;
+  }
+
+  const BYTE* compressed = data + entry->dataOffset;
+  if (entry->method == kZipStored) {
+    entry->content.assign(compressed, compressed + entry->compressedSize);
+  } else if (entry->method == kZipDeflated) {
+    // The size is only claimed by the directory, the reserve stays within
+    // what the compressed data can actually inflate to.
+    entry->content.reserve(static_cast<size_t>(std::min<ULONGLONG>(
+        entry->uncompressedSize, static_cast<ULONGLONG>(entry->compressedSize) * kDeflateMaxRatio)));
+    if (!Inflate(compressed, entry->compressedSize, entry->uncompressedSize, &entry->content))
+      return false;
+  } else {
+    fprintf(stderr, "Cannot edit entry \"%ls\" compressed with method %u\n", entry->name.c_str(), entry->method);
+    return false;
+  }
+
+  return entry->content.size() == entry->uncompressedSize &&
+         Crc32(entry->content.data(), entry->content.size()) == entry->crc;
+}
+
+bool EditZip(ByteSpan file, const std::wstring& pattern, const ArchiveEntryEditor& edit,
+             ArchiveWriter* writer, size_t* edited) {
+  size_t endOffset = 0;
+  std::vector<ZipEntry> entries;
+  if (!FindZipEnd(file.data(), file.size(), &endOffset) || !ReadZipEntries(file, endOffset, &entries))
+    return false;
+
+  std::vector<std::function<bool()>> jobs;
+  for (auto& entry : entries) {
+    if (!IsMatch(pattern, entry.name))
+      continue;
+
+    entry.matched = true;
+    ZipEntry* target = &entry;
+    const BYTE* data = file.data();
+    jobs.push_back([data, target, &edit]() {
+      if (!ExtractZipEntry(data, target) || !edit(target->name, &target->content))
+        return false;
+      if (target->content.size() > 0xffffffff)
+        return false;
+      target->crc = Crc32(target->content.data(), target->content.size());
+      return true;
+    });
+  }
+  *edited = jobs.size();
+  if (!RunParallel(jobs))
+    return false;
+
+  // Local records in file order, after any leading stub, then the central
+  // directory in its own order. Edited entries are stored with their sizes
+  // in the local header.
+  std::vector<ZipEntry*> order;
+  for (auto& entry : entries)
+    order.push_back(&entry);
+  std::sort(order.begin(), order.end(), [](const ZipEntry* a, const ZipEntry* b) { return a->local < b->local; });
+
+  size_t prefix = order.empty() ? endOffset : order.front()->local;
+  if (!writer->Write(file.data(), prefix))
+    return false;
+
+  for (ZipEntry* entry : order) {
+    if (writer->offset() > 0xffffffff)
+      return false;
+    entry->newLocal = static_cast<DWORD>(writer->offset());
+    if (!entry->matched) {
+      if (!writer->Write(file.data() + entry->local, entry->localLength))
+        return false;
+      continue;
+    }
+
+    std::vector<BYTE> header(file.data() + entry->local, file.data() + entry->dataOffset);
+    RecordWriter<ZipLocalHeaderLayout> local(header.data());
+    WORD flags = RecordView<ZipLocalHeaderLayout>(ByteSpan(header.data(), header.size()))
+                     .Get<ZipLocalHeaderLayout::Flags>();
+    local.Set<ZipLocalHeaderLayout::Flags>(flags & ~kZipDescriptor);
+    local.Set<ZipLocalHeaderLayout::Method>(kZipStored);
+    local.Set<ZipLocalHeaderLayout::Crc32>(entry->crc);
+    local.Set<ZipLocalHeaderLayout::CompressedSize>(static_cast<DWORD>(entry->content.size()));
+    local.Set<ZipLocalHeaderLayout::UncompressedSize>(static_cast<DWORD>(entry->content.size()));
+    if (!writer->Write(header) || !writer->Write(entry->content))
+      return false;
+  }
+
+  ULONGLONG centralOffset = writer->offset();
+  for (const auto& entry : entries) {
+    std::vector<BYTE> record(file.data() + entry.central, file.data() + entry.central + entry.centralLength);
+    RecordWriter<ZipCentralHeaderLayout> central(record.data());
+    central.Set<ZipCentralHeaderLayout::LocalHeaderOffset>(entry.newLocal);
+    if (entry.matched) {
+      central.Set<ZipCentralHeaderLayout::Flags>(entry.flags & ~kZipDescriptor);
+      central.Set<ZipCentralHeaderLayout::Method>(kZipStored);
+      central.Set<ZipCentralHeaderLayout::Crc32>(entry.crc);
+      central.Set<ZipCentralHeaderLayout::CompressedSize>(static_cast<DWORD>(entry.content.size()));
+      central.Set<ZipCentralHeaderLayout::UncompressedSize>(static_cast<DWORD>(entry.content.size()));
+    }
+    if (!writer->Write(record))
+      return false;
+  }
+  if (writer->offset() > 0xffffffff)
+    return false;
+
+  // The end record keeps the archive comment.
+  std::vector<BYTE> end(file.data() + endOffset, file.data() + file.size());
+  RecordWriter<ZipEndLayout> endWriter(end.data());
+  endWriter.Set<ZipEndLayout::CentralSize>(static_cast<DWORD>(writer->offset() - centralOffset));
+  endWriter.Set<ZipEndLayout::CentralOffset>(static_cast<DWORD>(centralOffset));
+  return writer->Write(end);
+}
+
+// Parses an octal tar number, or the base-256 form used for large values.
+ULONGLONG ParseTarNumber(const BYTE* field, size_t length) {
+  ULONGLONG value = 0;
+  if (field[0] & 0x80) {
+    for (size_t i = 1; i < length; ++i)
+      value = value << 8 | field[i];
+    return value;
+  }
+
+  size_t i = 0;
+  while (i < length && field[i] == ' ')
+    ++i;
+  for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+    value = value * 8 + (field[i] - '0');
+  return value;
+}
+
+DWORD TarChecksum(const BYTE* header) {
+  // The checksum field itself counts as spaces.
+  DWORD sum = 0;
+  for (size_t i = 0; i < kTarBlockSize; ++i)
+    sum += i >= 148 && i < 156 ? ' ' : header[i];
+  return sum;
+}
+
+bool IsTarHeader(const BYTE* header) {
+  return TarChecksum(header) == ParseTarNumber(header + 148, 8);
+}
+
+bool SetTarSize(BYTE* header, ULONGLONG size) {
+  if (size > 077777777777ULL)
+    return false;
+
+  char field[16];
+  snprintf(field, sizeof(field), "%011llo", static_cast<unsigned long long>(size));
+  memcpy(header + 124, field, 12);
+  snprintf(field, sizeof(field), "%06o", static_cast<unsigned int>(TarChecksum(header)));
+  memcpy(header + 148, field, 7);
+  header[155] = ' ';
+  return true;
+}
+
+// Reads the path and whether a size is given from pax extended records,
+// each of the form "<length> <key>=<value>\n".
+void ReadPaxRecords(const BYTE* data, size_t size, std::wstring* path, bool* hasSize) {
+  size_t position = 0;
+  while (position < size) {
+    size_t length = 0;
+    size_t i = position;
+    for (; i < size && data[i] >= '0' && data[i] <= '9'; ++i)
+      length = length * 10 + (data[i] - '0');
+    if (i == position || length == 0 || length > size - position)
+      return;
+
+    std::string record(reinterpret_cast<const char*>(data) + i + 1, position + length - i - 2);
+    if (record.compare(0, 5, "path=") == 0)
+      *path = DecodeName(reinterpret_cast<const BYTE*>(record.data()) + 5, record.size() - 5, CP_UTF8);
+    else if (record.compare(0, 5, "size=") == 0)
+      *hasSize = true;
+    position += length;
+  }
+}
+
+bool EditTar(ByteSpan file, const std::wstring& pattern, const ArchiveEntryEditor& edit,
+             ArchiveWriter* writer, size_t* edited) {
+  std::vector<TarEntry> entries;
+  std::wstring longName;
+  bool paxSize = false;
+  size_t offset = 0;
+  while (file.Contains(offset, kTarBlockSize)) {
+    const BYTE* header = file.data() + offset;
+    if (std::all_of(header, header + kTarBlockSize, [](BYTE b) { return b == 0; }))
+      break;  // end of archive
+    if (!IsTarHeader(header)) {
+      fprintf(stderr, "Malformed tar header at offset %zu\n", offset);
+      return false;
+    }
+
+    // Checked before padding, a base-256 size near 2^64 would wrap.
+    ULONGLONG size = ParseTarNumber(header + 124, 12);
+    if (size > file.size() - offset - kTarBlockSize) {
+      fprintf(stderr, "Malformed tar entry size at offset %zu\n", offset);
+      return false;
+    }
+    ULONGLONG padded = (size + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+    if (!file.Contains(offset + kTarBlockSize, static_cast<size_t>(padded)))
+      return false;
+
+    TarEntry entry;
+    entry.header = offset;
+    entry.size = static_cast<size_t>(size);
+    entry.length = kTarBlockSize + static_cast<size_t>(padded);
+    const BYTE* content = header + kTarBlockSize;
+    BYTE type = header[156];
+    if (type == 'L') {
+      // GNU long name of the next entry.
+      longName = DecodeName(content, strnlen(reinterpret_cast<const char*>(content), static_cast<size_t>(size)), CP_UTF8);
+    } else if (type == 'x') {
+      ReadPaxRecords(content, static_cast<size_t>(size), &longName, &paxSize);
+    } else {
+      if (!longName.empty()) {
+        entry.name = longName;
+      } else {
+        const char* name = reinterpret_cast<const char*>(header);
+        const char* prefix = reinterpret_cast<const char*>(header + 345);
+        std::wstring path = DecodeName(header, strnlen(name, 100), CP_UTF8);
+        if (memcmp(header + 257, "ustar", 5) == 0 && prefix[0] != 0)
+          path = DecodeName(header + 345, strnlen(prefix, 155), CP_UTF8) + L"/" + path;
+        entry.name = path;
+      }
+      entry.regular = type == '0' || type == 0;
+      entry.paxSize = paxSize;
+      longName.clear();
+      paxSize = false;
+    }
+    entries.push_back(std::move(entry));
+    offset += entries.back().length;
+  }
+  size_t trailer = offset;
+
+  std::vector<std::function<bool()>> jobs;
+  for (auto& entry : entries) {
+    if (!entry.regular || !IsMatch(pattern, entry.name))
+      continue;
+    if (entry.paxSize) {
+      fprintf(stderr, "Cannot edit entry \"%ls\" sized by a pax header\n", entry.name.c_str());
+      return false;
+    }
+
+    entry.matched = true;
+    TarEntry* target = &entry;
+    const BYTE* data = file.data();
+    jobs.push_back([data, target, &edit]() {
+      const BYTE* content = data + target->header + kTarBlockSize;
+      target->content.assign(content, content + target->size);
+      return edit(target->name, &target->content);
+    });
+  }
+  *edited = jobs.size();
+  if (!RunParallel(jobs))
+    return false;
+
+  static const BYTE kZeros[kTarBlockSize] = { 0 };
+  for (const auto& entry : entries) {
+    if (!entry.matched) {
+      if (!writer->Write(file.data() + entry.header, entry.length))
+        return false;
+      continue;
+    }
+
+    BYTE header[kTarBlockSize];
+    memcpy(header, file.data() + entry.header, kTarBlockSize);
+    size_t padding = (kTarBlockSize - entry.content.size() % kTarBlockSize) % kTarBlockSize;
+    if (!SetTarSize(header, entry.content.size()) || !writer->Write(header, kTarBlockSize) ||
+        !writer->Write(entry.content) || !writer->Write(kZeros, padding))
+      return false;
+  }
+
+  // The end of archive blocks and anything after them.
+  return writer->Write(file.data() + trailer, file.size() - trailer);
+}
+
+}  // namespace
+
+bool MatchArchivePath(const WCHAR* pattern, const WCHAR* path) {
+  for (; *pattern != 0; ++pattern, ++path) {
+    if (*pattern == L'*') {
+      bool crossDirectories = pattern[1] == L'*';
+      if (crossDirectories) {
+        ++pattern;
+        if (pattern[1] == L'/' && MatchArchivePath(pattern + 2, path))
+          return true;
+      }
+      for (;; ++path) {
+        if (MatchArchivePath(pattern + 1, path))
+          return true;
+        if (*path == 0 || (!crossDirectories && *path == L'/'))
+          return false;
+      }
+    }
+
+    if (*path == 0)
+      return false;
+    if (*pattern == L'?' ? *path == L'/' : towlower(*pattern) != towlower(*path))
+      return false;
+  }
+  return *path == 0;
+}
+
+bool EditArchive(const WCHAR* input, const WCHAR* output, const WCHAR* pattern,
+                 const ArchiveEntryEditor& edit, size_t* edited) {
+  *edited = 0;
+  ScopedFile file(input);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  ScopedFileMapping mapping(file);
+  if (mapping.data() == NULL)
+    return false;
+
+  ScopedFile out(output, true, CREATE_ALWAYS);
+  if (out == INVALID_HANDLE_VALUE)
+    return false;
+
+  // A zip may start with a self-extractor stub, so anything that is not a
+  // tar is looked up by its end record.
+  ByteSpan bytes(mapping.data(), mapping.size());
+  ArchiveWriter writer(out);
+  std::wstring glob = NormalizePath(pattern);
+  bool isTar = bytes.size() >= kTarBlockSize && LoadLittleEndian<DWORD>(bytes.data()) != kZipLocalSignature &&
+               IsTarHeader(bytes.data());
+  bool succeeded = isTar ? EditTar(bytes, glob, edit, &writer, edited)
+                         : EditZip(bytes, glob, edit, &writer, edited);
+  return succeeded && writer.Flush();
+}
+
+}  // namespace rescle
@@ -0,0 +1,32 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+namespace rescle {
+
+// Replaces the uncompressed content of a matching archive entry in place.
+typedef std::function<bool(const std::wstring& name, std::vector<BYTE>* data)> ArchiveEntryEditor;
+
+// Matches an entry path against a glob, case-insensitively. '*' and '?'
+// stop at '/', "**" crosses it and "**/" also matches no directory.
+bool MatchArchivePath(const WCHAR* pattern, const WCHAR* path);
+
+// Writes the zip (or nupkg) or tar archive |input| to |output|, passing the
+// entries that match |pattern| through |edit| in parallel. The other
+// entries are copied byte for byte, edited zip entries are stored without
+// compression. Zip64 archives and encrypted matches are not supported.
+bool EditArchive(const WCHAR* input, const WCHAR* output, const WCHAR* pattern,
+                 const ArchiveEntryEditor& edit, size_t* edited);
+
+}  // namespace rescle
+
+#endif  // ARCHIVE_H
@@ -0,0 +1,376 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "edit_plan.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "journal.h"
+#include "output_cache.h"
+#include "record.h"
+#include "scoped_file.h"
+
+namespace rescle {
+
+namespace {
+
+const ULONGLONG kPlanMagic = 0x3150544944454352ULL;  // "RCEDITP1"
+const size_t kHashLength = 64;
+
+// Followed by the input hash as hex digits.
+struct PlanHeaderLayout {
+  typedef Field<ULONGLONG, 0> Magic;
+  typedef Field<ULONGLONG, 8> InputSize;
+  typedef Field<ULONGLONG, 16> NewSize;
+  typedef Field<ULONGLONG, 24> OverlayFrom;
+  typedef Field<ULONGLONG, 32> OverlayTo;
+  typedef Field<ULONGLONG, 40> OverlaySize;
+  typedef Field<ULONGLONG, 48> ChecksumOffset;
+  typedef Field<DWORD, 56> ChecksumBase;
+  typedef Field<DWORD, 60> PatchCount;
+  typedef Field<DWORD, 64> SlotCount;
+  static constexpr size_t kSize = 68;
+};
+
+// Followed by the bytes.
+struct PlanPatchLayout {
+  typedef Field<ULONGLONG, 0> Offset;
+  typedef Field<ULONGLONG, 8> Size;
+  static constexpr size_t kSize = 16;
+};
+
+// Followed by the UTF-16 key and the 64-bit offsets.
+struct PlanSlotLayout {
+  typedef Field<DWORD, 0> Capacity;
+  typedef Field<DWORD, 4> KeyLength;
+  typedef Field<DWORD, 8> OffsetCount;
+  static constexpr size_t kSize = 12;
+};
+
+size_t SlotSize(const PlanSlot& slot) {
+  return (static_cast<size_t>(slot.capacity) + 1) * sizeof(WORD);
+}
+
+// The bytes of the patch covering [offset, offset + length), NULL when no
+// single patch does.
+BYTE* PatchRange(std::vector<FilePatch>* patches, ULONGLONG offset, size_t length) {
+  for (auto& patch : *patches) {
+    if (offset >= patch.offset && offset - patch.offset <= patch.bytes.size() &&
+        length <= patch.bytes.size() - (offset - patch.offset))
+      return patch.bytes.data() + (offset - patch.offset);
+  }
+  return nullptr;
+}
+
+// Finds the values of the version strings named |slot->key| with room for
+// |slot->capacity| characters. A String node starts with its length, the
+// length of its value in characters and the text type, then the key.
+void FindSlot(const std::vector<FilePatch>& patches, PlanSlot* slot) {
+  size_t keySize = (slot->key.length() + 1) * sizeof(WORD);
+  size_t valueOffset = (VersionHeaderLayout::kSize + keySize + 3) & ~static_cast<size_t>(3);
+  std::vector<BYTE> node(VersionHeaderLayout::kSize + keySize);
+  RecordWriter<VersionHeaderLayout> header(node.data());
+  header.Set<VersionHeaderLayout::Length>(static_cast<WORD>(valueOffset + SlotSize(*slot)));
+  header.Set<VersionHeaderLayout::ValueLength>(static_cast<WORD>(slot->capacity + 1));
+  header.Set<VersionHeaderLayout::Type>(1);
+  for (size_t i = 0; i < slot->key.length(); ++i)
+    StoreLittleEndian<WORD>(node.data() + VersionHeaderLayout::kSize + i * sizeof(WORD), slot->key[i]);
+
+  // Version nodes are DWORD aligned in the file.
+  for (const auto& patch : patches) {
+    for (size_t position = static_cast<size_t>((4 - patch.offset % 4) % 4);
+         position + valueOffset + SlotSize(*slot) <= patch.bytes.size(); position += 4) {
+      if (memcmp(patch.bytes.data() + position, node.data(), node.size()) == 0)
+        slot->offsets.push_back(patch.offset + position + valueOffset);
+    }
+  }
+}
+
+// Adds the filled slots to the checksum of the rest of the image.
+void UpdateChecksum(EditPlan* plan) {
+  if (plan->checksumOffset == 0)
+    return;
+
+  ULONGLONG sum = plan->checksumBase;
+  for (const auto& slot : plan->slots) {
+    for (ULONGLONG offset : slot.offsets) {
+      const BYTE* value = PatchRange(&plan->patches, offset, SlotSize(slot));
+      for (size_t i = 0; i < SlotSize(slot); i += sizeof(WORD)) {
+        sum += LoadLittleEndian<WORD>(value + i);
+        sum = (sum & 0xffff) + (sum >> 16);
+      }
+    }
+  }
+
+  BYTE* checksum = PatchRange(&plan->patches, plan->checksumOffset, sizeof(DWORD));
+  if (checksum != nullptr)
+    StoreLittleEndian<DWORD>(checksum, static_cast<DWORD>(sum + plan->newSize));
+}
+
+}  // namespace
+
+bool BuildPlan(const PEImage& image, const BYTE* data, size_t size, const std::vector<FilePatch>& patches,
+               const FileMove& overlay, ULONGLONG newSize, const std::map<std::wstring, DWORD>& slots,
+               EditPlan* plan) {
+  Sha256 hash;
+  hash.Update(data, size);
+  plan->inputHash = hash.Finish();
+  if (plan->inputHash.length() != kHashLength)
+    return false;
+
+  plan->inputSize = size;
+  plan->newSize = newSize;
+  plan->overlay = overlay;
+  plan->patches = patches;
+  plan->slots.clear();
+  for (const auto& i : slots) {
+    PlanSlot slot;
+    slot.key = i.first;
+    slot.capacity = i.second;
+    FindSlot(plan->patches, &slot);
+    if (slot.offsets.empty()) {
+      fprintf(stderr, "The version string \"%ls\" is not in the plan\n", slot.key.c_str());
+      return false;
+    }
+    plan->slots.push_back(std::move(slot));
+  }
+
+  // The checksum without the CheckSum field and the slots, which replays
+  // add back as they are filled.
+  size_t checksumOffset;
+  plan->checksumOffset = 0;
+  plan->checksumBase = 0;
+  if (image.GetChecksumOffset(&checksumOffset)) {
+    std::vector<FilePatch> open = patches;
+    BYTE* checksum = PatchRange(&open, checksumOffset, sizeof(DWORD));
+    if (checksum == nullptr)
+      return false;
+    memset(checksum, 0, sizeof(DWORD));
+    for (const auto& slot : plan->slots) {
+      for (ULONGLONG offset : slot.offsets)
+        memset(PatchRange(&open, offset, SlotSize(slot)), 0, SlotSize(slot));
+    }
+    plan->checksumOffset = checksumOffset;
+    plan->checksumBase = image.ComputeChecksum(open, overlay, newSize) - static_cast<DWORD>(newSize);
+  }
+  return true;
+}
+
+bool WritePlan(const WCHAR* path, const EditPlan& plan) {
+  BYTE header[PlanHeaderLayout::kSize + kHashLength];
+  RecordWriter<PlanHeaderLayout> headerWriter(header);
+  headerWriter.Set<PlanHeaderLayout::Magic>(kPlanMagic);
+  headerWriter.Set<PlanHeaderLayout::InputSize>(plan.inputSize);
+  headerWriter.Set<PlanHeaderLayout::NewSize>(plan.newSize);
+  headerWriter.Set<PlanHeaderLayout::OverlayFrom>(plan.overlay.from);
+  headerWriter.Set<PlanHeaderLayout::OverlayTo>(plan.overlay.to);
+  headerWriter.Set<PlanHeaderLayout::OverlaySize>(plan.overlay.size);
+  headerWriter.Set<PlanHeaderLayout::ChecksumOffset>(plan.checksumOffset);
+  headerWriter.Set<PlanHeaderLayout::ChecksumBase>(plan.checksumBase);
+  headerWriter.Set<PlanHeaderLayout::PatchCount>(static_cast<DWORD>(plan.patches.size()));
+  headerWriter.Set<PlanHeaderLayout::SlotCount>(static_cast<DWORD>(plan.slots.size()));
+  if (plan.inputHash.length() != kHashLength)
+    return false;
+  for (size_t i = 0; i < kHashLength; ++i)
+    header[PlanHeaderLayout::kSize + i] = static_cast<BYTE>(plan.inputHash[i]);
+
+  ScopedFile file(path, true, CREATE_ALWAYS);
+  if (file == INVALID_HANDLE_VALUE || !WriteAll(file, header, sizeof(header)))
+    return false;
+
+  for (const auto& patch : plan.patches) {
+    BYTE record[PlanPatchLayout::kSize];
+    RecordWriter<PlanPatchLayout> recordWriter(record);
+    recordWriter.Set<PlanPatchLayout::Offset>(patch.offset);
+    recordWriter.Set<PlanPatchLayout::Size>(patch.bytes.size());
+    if (!WriteAll(file, record, sizeof(record)) ||
+        !WriteAll(file, patch.bytes.data(), patch.bytes.size()))
+      return false;
+  }
+
+  for (const auto& slot : plan.slots) {
+    std::vector<BYTE> record(PlanSlotLayout::kSize + slot.key.length() * sizeof(WORD) +
+                             slot.offsets.size() * sizeof(ULONGLONG));
+    RecordWriter<PlanSlotLayout> recordWriter(record.data());
+    recordWriter.Set<PlanSlotLayout::Capacity>(slot.capacity);
+    recordWriter.Set<PlanSlotLayout::KeyLength>(static_cast<DWORD>(slot.key.length()));
+    recordWriter.Set<PlanSlotLayout::OffsetCount>(static_cast<DWORD>(slot.offsets.size()));
+    BYTE* p = record.data() + PlanSlotLayout::kSize;
+    for (wchar_t c : slot.key) {
+      StoreLittleEndian<WORD>(p, static_cast<WORD>(c));
+      p += sizeof(WORD);
+    }
+    for (ULONGLONG offset : slot.offsets) {
+      StoreLittleEndian<ULONGLONG>(p, offset);
+      p += sizeof(ULONGLONG);
+    }
+    if (!WriteAll(file, record.data(), record.size()))
+      return false;
+  }
+  return true;
+}
+
+bool ReadPlan(const WCHAR* path, EditPlan* plan) {
+  ScopedFile file(path);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  ScopedFileMapping mapping(file);
+  ByteSpan bytes(mapping.data(), mapping.size());
+  RecordView<PlanHeaderLayout> header(bytes);
+  if (!header.valid() || header.Get<PlanHeaderLayout::Magic>() != kPlanMagic ||
+      !bytes.Contains(PlanHeaderLayout::kSize, kHashLength))
+    return false;
+
+  plan->inputSize = header.Get<PlanHeaderLayout::InputSize>();
+  plan->newSize = header.Get<PlanHeaderLayout::NewSize>();
+  plan->overlay.from = header.Get<PlanHeaderLayout::OverlayFrom>();
+  plan->overlay.to = header.Get<PlanHeaderLayout::OverlayTo>();
+  plan->overlay.size = header.Get<PlanHeaderLayout::OverlaySize>();
+  plan->checksumOffset = header.Get<PlanHeaderLayout::ChecksumOffset>();
+  plan->checksumBase = header.Get<PlanHeaderLayout::ChecksumBase>();
+  plan->inputHash.assign(bytes.data() + PlanHeaderLayout::kSize,
+                         bytes.data() + PlanHeaderLayout::kSize + kHashLength);
+  plan->patches.clear();
+  plan->slots.clear();
+
+  size_t position = PlanHeaderLayout::kSize + kHashLength;
+  DWORD patchCount = header.Get<PlanHeaderLayout::PatchCount>();
+  for (DWORD i = 0; i < patchCount; ++i) {
+    RecordView<PlanPatchLayout> record(bytes.Subspan(position));
+    if (!record.valid())
+      return false;
+
+    ULONGLONG size = record.Get<PlanPatchLayout::Size>();
+    position += PlanPatchLayout::kSize;
+    if (size > bytes.size() || !bytes.Contains(position, static_cast<size_t>(size)))
+      return false;
+
+    FilePatch patch;
+    patch.offset = record.Get<PlanPatchLayout::Offset>();
+    patch.bytes.assign(bytes.data() + position, bytes.data() + position + size);
+    position += static_cast<size_t>(size);
+    plan->patches.push_back(std::move(patch));
+  }
+
+  DWORD slotCount = header.Get<PlanHeaderLayout::SlotCount>();
+  for (DWORD i = 0; i < slotCount; ++i) {
+    RecordView<PlanSlotLayout> record(bytes.Subspan(position));
+    if (!record.valid())
+      return false;
+
+    PlanSlot slot;
+    slot.capacity = record.Get<PlanSlotLayout::Capacity>();
+    DWORD keyLength = record.Get<PlanSlotLayout::KeyLength>();
+    DWORD offsetCount = record.Get<PlanSlotLayout::OffsetCount>();
+    position += PlanSlotLayout::kSize;
+    if (slot.capacity > kMaxPlanSlotCapacity || !bytes.ReadString(position, keyLength, &slot.key))
+      return false;
+    position += keyLength * sizeof(WORD);
+    if (!bytes.Contains(position, static_cast<size_t>(offsetCount) * sizeof(ULONGLONG)))
+      return false;
+    for (DWORD j = 0; j < offsetCount; ++j) {
+      ULONGLONG offset = LoadLittleEndian<ULONGLONG>(bytes.data() + position);
+      if (PatchRange(&plan->patches, offset, SlotSize(slot)) == nullptr)
+        return false;
+      slot.offsets.push_back(offset);
+      position += sizeof(ULONGLONG);
+    }
+    plan->slots.push_back(std::move(slot));
+  }
+
+  if (plan->checksumOffset != 0 && PatchRange(&plan->patches, plan->checksumOffset, sizeof(DWORD)) == nullptr)
+    return false;
+  return position == bytes.size();
+}
+
+bool FillPlanSlot(EditPlan* plan, const std::wstring& key, const std::wstring& value) {
+  for (const auto& slot : plan->slots) {
+    if (slot.key != key)
+      continue;
+    if (value.length() > slot.capacity) {
+      fprintf(stderr, "The value of \"%ls\" is longer than the %lu characters of its slot\n",
+              key.c_str(), static_cast<unsigned long>(slot.capacity));
+      return false;
+    }
+
+    for (ULONGLONG offset : slot.offsets) {
+      BYTE* p = PatchRange(&plan->patches, offset, SlotSize(slot));
+      memset(p, 0, SlotSize(slot));
+      for (size_t i = 0; i < value.length(); ++i)
+        StoreLittleEndian<WORD>(p + i * sizeof(WORD), static_cast<WORD>(value[i]));
+    }
+    UpdateChecksum(plan);
+    return true;
+  }
+
+  fprintf(stderr, "The plan has no slot for \"%ls\"\n", key.c_str());
+  return false;
+}
+
+bool ApplyPlan(const WCHAR* filename, const EditPlan& plan, const WCHAR* journalPath, IoBackend backend) {
+  // The size rules out most other files before the whole file is hashed.
+  bool matches = false;
+  {
+    ScopedFile file(filename);
+    LARGE_INTEGER size;
+    matches = file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &size) &&
+              static_cast<ULONGLONG>(size.QuadPart) == plan.inputSize;
+  }
+  if (matches) {
+    Sha256 hash;
+    matches = hash.UpdateFile(filename) && hash.Finish() == plan.inputHash;
+  }
+  if (!matches) {
+    fprintf(stderr, "The file is not the one the plan was recorded from\n");
+    return false;
+  }
+
+  // The journal is complete before the first byte of the file changes.
+  if (journalPath != NULL) {
+    ScopedFile file(filename);
+    ScopedFileMapping mapping(file);
+    if (mapping.data() == NULL)
+      return false;
+
+    RevertJournal journal;
+    BuildJournal(mapping.data(), mapping.size(), plan.patches, plan.overlay, plan.newSize, &journal);
+    if (!WriteJournal(journalPath, journal))
+      return false;
+  }
+
+  return WritePatches(filename, plan.patches, plan.overlay, plan.newSize, backend);
+}
+
+bool WritePatches(const WCHAR* filename, const std::vector<FilePatch>& patches, const FileMove& overlay,
+                  ULONGLONG newSize, IoBackend backend) {
+  IoEngine engine(backend);
+  ScopedFile file(filename, true, OPEN_EXISTING, engine.FileFlags());
+  if (file == INVALID_HANDLE_VALUE || !engine.Attach(file))
+    return false;
+
+  // Make room for the overlay behind the grown section before the section
+  // is written over its old place. The move is its own pass because the
+  // grown section's patch covers the overlay's old bytes, so it can only
+  // be queued once they have all been read.
+  LARGE_INTEGER end;
+  end.QuadPart = static_cast<LONGLONG>(newSize);
+  if (overlay.to != overlay.from && overlay.size > 0) {
+    if (!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file) ||
+        !engine.MoveRange(file, overlay.from, overlay.to, overlay.size))
+      return false;
+  }
+
+  // The patches never overlap, so they go out as one batch.
+  std::vector<IoRequest> requests;
+  for (const auto& patch : patches)
+    IoEngine::AddRequests(&requests, file, patch.offset, patch.bytes.data(), patch.bytes.size(), true);
+  if (!engine.Run(requests))
+    return false;
+
+  return SetFilePointerEx(file, end, NULL, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+}  // namespace rescle
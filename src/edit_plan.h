@@ -0,0 +1,68 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef EDIT_PLAN_H
+#define EDIT_PLAN_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include "io_engine.h"
+#include "pe_image.h"
+
+namespace rescle {
+
+// The widest slot a version resource can hold. Its lengths are WORDs, so
+// the String node and everything around it has to fit in 64 KB.
+const DWORD kMaxPlanSlotCapacity = 0x7f00;
+
+// A version string whose value sits at fixed offsets of the planned image,
+// padded with zeros to |capacity| characters, so replays can change it.
+struct PlanSlot {
+  std::wstring key;
+  DWORD capacity = 0;
+  std::vector<ULONGLONG> offsets;  // one per string table holding the key
+};
+
+// The writes a commit makes to one exact input file, replayed on identical
+// inputs without parsing the image again.
+struct EditPlan {
+  ULONGLONG inputSize = 0;
+  std::wstring inputHash;        // SHA-256, hex encoded
+  ULONGLONG newSize = 0;
+  FileMove overlay;
+  std::vector<FilePatch> patches;
+  std::vector<PlanSlot> slots;
+  ULONGLONG checksumOffset = 0;  // zero when the image has no checksum
+  DWORD checksumBase = 0;        // folded sum of the image without the slots
+};
+
+// Records a layout plan for the image |data| with the values of the version
+// strings in |slots|, keyed to their capacity, left open.
+bool BuildPlan(const PEImage& image, const BYTE* data, size_t size, const std::vector<FilePatch>& patches,
+               const FileMove& overlay, ULONGLONG newSize, const std::map<std::wstring, DWORD>& slots,
+               EditPlan* plan);
+
+bool WritePlan(const WCHAR* path, const EditPlan& plan);
+bool ReadPlan(const WCHAR* path, EditPlan* plan);
+
+// Puts |value| into every place of the slot |key| and updates the checksum.
+bool FillPlanSlot(EditPlan* plan, const std::wstring& key, const std::wstring& value);
+
+// Replays |plan| on |filename|, which must be the file it was recorded from
+// byte for byte. With |journalPath|, what the replay overwrites is saved
+// there first, as --journal does for a commit.
+bool ApplyPlan(const WCHAR* filename, const EditPlan& plan, const WCHAR* journalPath,
+               IoBackend backend);
+
+// Moves the overlay, writes the patches and sets the new end of the file.
+bool WritePatches(const WCHAR* filename, const std::vector<FilePatch>& patches, const FileMove& overlay,
+                  ULONGLONG newSize, IoBackend backend);
+
+}  // namespace rescle
+
+#endif  // EDIT_PLAN_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "file_watcher.h"
+
+namespace rescle {
+
+namespace {
+
+const DWORD kNotifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                            FILE_NOTIFY_CHANGE_LAST_WRITE;
+const size_t kNotifyBufferSize = 64 * 1024;
+
+// The directory part of |path|, including the trailing separator.
+std::wstring DirectoryOf(const std::wstring& path) {
+  size_t separator = path.find_last_of(L"\\/");
+  return separator == std::wstring::npos ? std::wstring() : path.substr(0, separator + 1);
+}
+
+}  // namespace
+
+struct FileWatcher::Directory {
+  ~Directory() {
+    // The buffer must outlive a pending read.
+    if (pending) {
+      DWORD bytes = 0;
+      CancelIoEx(handle, &overlapped);
+      GetOverlappedResult(handle, &overlapped, &bytes, TRUE);
+    }
+    if (handle != INVALID_HANDLE_VALUE)
+      CloseHandle(handle);
+    if (overlapped.hEvent != NULL)
+      CloseHandle(overlapped.hEvent);
+  }
+
+  std::wstring path;
+  HANDLE handle = INVALID_HANDLE_VALUE;
+  OVERLAPPED overlapped = {};
+  bool pending = false;
+  std::vector<DWORD> buffer;  // notification records are DWORD aligned
+};
+
+FileWatcher::FileWatcher() {
+}
+
+FileWatcher::~FileWatcher() {
+}
+
+bool FileWatcher::Add(const std::wstring& path) {
+  std::wstring directoryPath = DirectoryOf(path);
+  if (directoryPath.empty())
+    return false;
+
+  files_.push_back(path);
+  for (const auto& directory : directories_) {
+    if (_wcsicmp(directory->path.c_str(), directoryPath.c_str()) == 0)
+      return true;
+  }
+  if (directories_.size() == MAXIMUM_WAIT_OBJECTS)
+    return false;
+
+  std::unique_ptr<Directory> directory(new Directory);
+  directory->path = directoryPath;
+  directory->buffer.resize(kNotifyBufferSize / sizeof(DWORD));
+  directory->handle = CreateFileW(directoryPath.c_str(), FILE_LIST_DIRECTORY,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                  OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  if (directory->handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  directory->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+  if (directory->overlapped.hEvent == NULL || !Arm(directory.get()))
+    return false;
+
+  directories_.push_back(std::move(directory));
+  return true;
+}
+
+bool FileWatcher::Wait(DWORD quietMilliseconds, std::vector<std::wstring>* changed) {
+  changed->clear();
+  if (directories_.empty())
+    return false;
+
+  std::vector<HANDLE> events;
+  for (const auto& directory : directories_)
+    events.push_back(directory->overlapped.hEvent);
+
+  // Builds write in several steps, so wait for them to settle.
+  std::set<std::wstring> paths;
+  while (true) {
+    DWORD result = WaitForMultipleObjects(static_cast<DWORD>(events.size()), events.data(), FALSE,
+                                          paths.empty() ? INFINITE : quietMilliseconds);
+    if (result == WAIT_TIMEOUT)
+      break;
+    if (result < WAIT_OBJECT_0 || result >= WAIT_OBJECT_0 + events.size())
+      return false;
+
+    Directory* directory = directories_[result - WAIT_OBJECT_0].get();
+    DWORD bytes = 0;
+    directory->pending = false;
+    if (!GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, FALSE))
+      return false;
+
+    Collect(*directory, bytes, &paths);
+    if (!Arm(directory))
+      return false;
+  }
+
+  changed->assign(paths.begin(), paths.end());
+  return true;
+}
+
+bool FileWatcher::Arm(Directory* directory) {
+  DWORD size = static_cast<DWORD>(directory->buffer.size() * sizeof(DWORD));
+  directory->pending = ReadDirectoryChangesW(directory->handle, directory->buffer.data(), size, FALSE,
+                                             kNotifyFilter, NULL, &directory->overlapped, NULL) != FALSE;
+  return directory->pending;
+}
+
+void FileWatcher::Collect(const Directory& directory, DWORD bytes, std::set<std::wstring>* changed) const {
+  // An overflowed buffer comes back empty, so any file in the directory
+  // may have changed.
+  if (bytes == 0) {
+    for (const auto& file : files_) {
+      if (_wcsicmp(DirectoryOf(file).c_str(), directory.path.c_str()) == 0)
+        changed->insert(file);
+    }
+    return;
+  }
+
+  const BYTE* record = reinterpret_cast<const BYTE*>(directory.buffer.data());
+  const BYTE* end = record + bytes;
+  while (record + FIELD_OFFSET(FILE_NOTIFY_INFORMATION, FileName) <= end) {
+    const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(record);
+    std::wstring path = directory.path + std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+    for (const auto& file : files_) {
+      if (_wcsicmp(file.c_str(), path.c_str()) == 0)
+        changed->insert(file);
+    }
+
+    if (info->NextEntryOffset == 0)
+      break;
+    record += info->NextEntryOffset;
+  }
+}
+
+}  // namespace rescle
@@ -0,0 +1,46 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+namespace rescle {
+
+// Waits for changes to a set of files by watching the directories that hold
+// them, so files that are deleted and recreated by a build are still seen.
+class FileWatcher {
+ public:
+  FileWatcher();
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // |path| must be absolute.
+  bool Add(const std::wstring& path);
+
+  // Blocks until a watched file changes and no further change arrives for
+  // |quietMilliseconds|, then returns the changed paths as given to Add.
+  bool Wait(DWORD quietMilliseconds, std::vector<std::wstring>* changed);
+
+ private:
+  struct Directory;
+
+  bool Arm(Directory* directory);
+  void Collect(const Directory& directory, DWORD bytes, std::set<std::wstring>* changed) const;
+
+  std::vector<std::unique_ptr<Directory>> directories_;
+  std::vector<std::wstring> files_;
+};
+
+}  // namespace rescle
+
+#endif  // FILE_WATCHER_H
@@ -0,0 +1,295 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "inflate.h"
+
+namespace rescle {
+
+namespace {
+
+const int kMaxBits = 15;
+const int kMaxLengthCodes = 286;
+const int kMaxDistanceCodes = 30;
+const int kFixedLengthCodes = 288;
+
+// A canonical Huffman code, as the number of codes of each length and the
+// symbols ordered by code.
+struct Huffman {
+  short count[kMaxBits + 1];
+  short symbol[kFixedLengthCodes];
+};
+
+// Builds |h| from the code length of each symbol. Returns 0 for a complete
+// code, a positive number for an incomplete one and a negative number for
+// an over-subscribed one.
+int BuildHuffman(Huffman* h, const short* lengths, int n) {
+  for (int length = 0; length <= kMaxBits; ++length)
+    h->count[length] = 0;
+  for (int symbol = 0; symbol < n; ++symbol)
+    h->count[lengths[symbol]]++;
+  if (h->count[0] == n)
+    return 0;
+
+  int left = 1;
+  for (int length = 1; length <= kMaxBits; ++length) {
+    left <<= 1;
+    left -= h->count[length];
+    if (left < 0)
+      return left;
+  }
+
+  short offsets[kMaxBits + 1];
+  offsets[1] = 0;
+  for (int length = 1; length < kMaxBits; ++length)
+    offsets[length + 1] = offsets[length] + h->count[length];
+  for (int symbol = 0; symbol < n; ++symbol) {
+    if (lengths[symbol] != 0)
+      h->symbol[offsets[lengths[symbol]]++] = static_cast<short>(symbol);
+  }
+  return left;
+}
+
+// Follows the structure of Mark Adler's puff, trading speed for brevity.
+class Inflater {
+ public:
+  Inflater(const BYTE* data, size_t size, size_t limit, std::vector<BYTE>* out)
+      : data_(data), size_(size), position_(0), bitBuffer_(0), bitCount_(0), failed_(false),
+        limit_(limit), out_(out) {}
+
+  bool Run() {
+    int last;
+    do {
+      last = Bits(1);
+      bool ok;
+      switch (Bits(2)) {
+        case 0: ok = Stored(); break;
+        case 1: ok = Fixed(); break;
+        case 2: ok = Dynamic(); break;
+        default: ok = false; break;
+      }
+      if (!ok || failed_)
+        return false;
+    } while (!last);
+    return true;
+  }
+
+ private:
+  int Bits(int need) {
+    unsigned long value = bitBuffer_;
+    while (bitCount_ < need) {
+      if (position_ == size_) {
+        failed_ = true;
+        return 0;
+      }
+      value |= static_cast<unsigned long>(data_[position_++]) << bitCount_;
+      bitCount_ += 8;
+    }
+    bitBuffer_ = value >> need;
+    bitCount_ -= need;
+    return static_cast<int>(value & ((1UL << need) - 1));
+  }
+
+  bool Stored() {
+    bitBuffer_ = 0;
+    bitCount_ = 0;
+    if (size_ - position_ < 4)
+      return false;
+    unsigned length = data_[position_] | data_[position_ + 1] << 8;
+    unsigned complement = data_[position_ + 2] | data_[position_ + 3] << 8;
+    position_ += 4;
+    if (length != (~complement & 0xffff) || size_ - position_ < length ||
+        length > limit_ - out_->size())
+      return false;
+    out_->insert(out_->end(), data_ + position_, data_ + position_ + length);
+    position_ += length;
+    return true;
+  }
+
+  int Decode(const Huffman& h) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length <= kMaxBits; ++length) {
+      code |= Bits(1);
+      int count = h.count[length];
+      if (code - count < first)
+        return h.symbol[index + (code - first)];
+      index += count;
+      first += count;
+      first <<= 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+
+  bool Codes(const Huffman& lengthCode, const Huffman& distanceCode) {
+    static const short kLengthBase[29] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const short kLengthExtra[29] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const short kDistanceBase[30] = {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+      8193, 12289, 16385, 24577 };
+    static const short kDistanceExtra[30] = {
+      0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    while (!failed_) {
+      int symbol = Decode(lengthCode);
+      if (symbol < 0)
+        return false;
+      if (symbol == 256)
+        return true;
+      if (symbol < 256) {
+        if (out_->size() == limit_)
+          return false;
+        out_->push_back(static_cast<BYTE>(symbol));
+        continue;
+      }
+
+      symbol -= 257;
+      if (symbol >= 29)
+        return false;
+      size_t length = kLengthBase[symbol] + Bits(kLengthExtra[symbol]);
+
+      symbol = Decode(distanceCode);
+      if (symbol < 0 || symbol >= 30)
+        return false;
+      size_t distance = kDistanceBase[symbol] + Bits(kDistanceExtra[symbol]);
+      if (distance > out_->size() || length > limit_ - out_->size())
+        return false;
+
+      // The copy may overlap the bytes it produces.
+      size_t from = out_->size() - distance;
+      for (size_t i = 0; i < length; ++i) {
+        BYTE b = (*out_)[from + i];
+        out_->push_back(b);
+      }
+    }
+    return false;
+  }
+
+  bool Fixed() {
+    short lengths[kFixedLengthCodes];
+    Huffman lengthCode, distanceCode;
+    int symbol = 0;
+    for (; symbol < 144; ++symbol)
+      lengths[symbol] = 8;
+    for (; symbol < 256; ++symbol)
+      lengths[symbol] = 9;
+    for (; symbol < 280; ++symbol)
+      lengths[symbol] = 7;
+    for (; symbol < kFixedLengthCodes; ++symbol)
+      lengths[symbol] = 8;
+    BuildHuffman(&lengthCode, lengths, kFixedLengthCodes);
+
+    for (symbol = 0; symbol < kMaxDistanceCodes; ++symbol)
+      lengths[symbol] = 5;
+    BuildHuffman(&distanceCode, lengths, kMaxDistanceCodes);
+    return Codes(lengthCode, distanceCode);
+  }
+
+  bool Dynamic() {
+    static const short kOrder[19] = {
+      16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    short lengths[kMaxLengthCodes + kMaxDistanceCodes];
+    Huffman lengthCode, distanceCode;
+    int lengthCount = Bits(5) + 257;
+    int distanceCount = Bits(5) + 1;
+    int codeCount = Bits(4) + 4;
+    if (lengthCount > kMaxLengthCodes || distanceCount > kMaxDistanceCodes)
+      return false;
+
+    int index = 0;
+    for (; index < codeCount; ++index)
+      lengths[kOrder[index]] = static_cast<short>(Bits(3));
+    for (; index < 19; ++index)
+      lengths[kOrder[index]] = 0;
+    if (BuildHuffman(&lengthCode, lengths, 19) != 0)
+      return false;
+
+    index = 0;
+    while (index < lengthCount + distanceCount) {
+      int symbol = Decode(lengthCode);
+      if (symbol < 0 || failed_)
+        return false;
+      if (symbol < 16) {
+        lengths[index++] = static_cast<short>(symbol);
+        continue;
+      }
+
+      short length = 0;
+      int repeat;
+      if (symbol == 16) {
+        if (index == 0)
+          return false;
+        length = lengths[index - 1];
+        repeat = 3 + Bits(2);
+      } else if (symbol == 17) {
+        repeat = 3 + Bits(3);
+      } else {
+        repeat = 11 + Bits(7);
+      }
+      if (index + repeat > lengthCount + distanceCount)
+        return false;
+      while (repeat--)
+        lengths[index++] = length;
+    }
+
+    // A block must be able to end, and an incomplete code is only allowed
+    // when it has a single symbol.
+    if (lengths[256] == 0)
+      return false;
+    int left = BuildHuffman(&lengthCode, lengths, lengthCount);
+    if (left < 0 || (left > 0 && lengthCount != lengthCode.count[0] + lengthCode.count[1]))
+      return false;
+    left = BuildHuffman(&distanceCode, lengths + lengthCount, distanceCount);
+    if (left < 0 || (left > 0 && distanceCount != distanceCode.count[0] + distanceCode.count[1]))
+      return false;
+
+    return Codes(lengthCode, distanceCode);
+  }
+
+  const BYTE* data_;
+  size_t size_;
+  size_t position_;
+  unsigned long bitBuffer_;
+  int bitCount_;
+  bool failed_;
+  size_t limit_;
+  std::vector<BYTE>* out_;
+};
+
+}  // namespace
+
+bool Inflate(const BYTE* data, size_t size, size_t limit, std::vector<BYTE>* out) {
+  if (out->size() > limit)
+    return false;
+  return Inflater(data, size, limit, out).Run();
+}
+
+DWORD Crc32(const BYTE* data, size_t size, DWORD crc) {
+  static const struct Table {
+    Table() {
+      for (DWORD i = 0; i < 256; ++i) {
+        DWORD c = i;
+        for (int k = 0; k < 8; ++k)
+          c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        entries[i] = c;
+      }
+    }
+    DWORD entries[256];
+  } table;
+
+  crc ^= 0xffffffff;
+  for (size_t i = 0; i < size; ++i)
+    crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffffffff;
+}
+
+}  // namespace rescle
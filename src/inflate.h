@@ -0,0 +1,25 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <vector>
+
+#include <windows.h>
+
+namespace rescle {
+
+// Decodes a raw deflate stream (RFC 1951), as stored in zip entries, and
+// appends the result to |out|. Fails as soon as |out| would grow past
+// |limit| bytes, so a small stream cannot exhaust memory.
+bool Inflate(const BYTE* data, size_t size, size_t limit, std::vector<BYTE>* out);
+
+// The CRC-32 used by zip. Pass the result for one range as |crc| to
+// continue it over the next.
+DWORD Crc32(const BYTE* data, size_t size, DWORD crc = 0);
+
+}  // namespace rescle
+
+#endif  // INFLATE_H
@@ -0,0 +1,184 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "io_engine.h"
+
+#include <algorithm>
+
+#include "scoped_file.h"
+
+namespace rescle {
+
+namespace {
+
+const DWORD kMoveChunkSize = 8 << 20;
+const DWORD kMaxRequestSize = 1 << 30;
+
+// A request in flight. The OVERLAPPED comes first so a completion packet
+// leads back to its slot.
+struct IoSlot {
+  OVERLAPPED overlapped;
+  const IoRequest* request = NULL;  // NULL while idle
+};
+
+bool Submit(IoSlot* slot, const IoRequest& request) {
+  slot->overlapped = OVERLAPPED();
+  slot->overlapped.Offset = static_cast<DWORD>(request.offset);
+  slot->overlapped.OffsetHigh = static_cast<DWORD>(request.offset >> 32);
+  slot->request = &request;
+
+  // Calls that complete right away still queue a packet on the port.
+  BOOL done = request.write
+                  ? WriteFile(request.file, request.buffer, request.size, NULL, &slot->overlapped)
+                  : ReadFile(request.file, request.buffer, request.size, NULL, &slot->overlapped);
+  return done || GetLastError() == ERROR_IO_PENDING;
+}
+
+}  // namespace
+
+IoEngine::IoEngine(IoBackend backend, size_t queueDepth)
+    : backend_(backend), queueDepth_(std::max<size_t>(queueDepth, 1)), port_(NULL) {
+  if (backend_ == IoBackend::kOverlapped)
+    port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+}
+
+IoEngine::~IoEngine() {
+  if (port_ != NULL)
+    CloseHandle(port_);
+}
+
+DWORD IoEngine::FileFlags() const {
+  return backend_ == IoBackend::kOverlapped ? FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED
+                                            : FILE_ATTRIBUTE_NORMAL;
+}
+
+bool IoEngine::Attach(HANDLE file) {
+  if (backend_ != IoBackend::kOverlapped)
+    return true;
+  return port_ != NULL && CreateIoCompletionPort(file, port_, 0, 0) == port_;
+}
+
+void IoEngine::AddRequests(std::vector<IoRequest>* requests, HANDLE file, ULONGLONG offset,
+                           const BYTE* buffer, size_t size, bool write) {
+  // Writes only read from the buffer.
+  BYTE* data = const_cast<BYTE*>(buffer);
+  for (size_t done = 0; done < size;) {
+    DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - done, kMaxRequestSize));
+    requests->push_back({file, offset + done, data + done, chunk, write});
+    done += chunk;
+  }
+}
+
+bool IoEngine::Run(const std::vector<IoRequest>& requests) {
+  if (backend_ == IoBackend::kOverlapped)
+    return RunOverlapped(requests);
+
+  for (const auto& request : requests) {
+    bool done = request.write ? WriteFileAt(request.file, request.offset, request.buffer, request.size)
+                              : ReadFileAt(request.file, request.offset, request.buffer, request.size);
+    if (!done)
+      return false;
+  }
+  return true;
+}
+
+bool IoEngine::RunOverlapped(const std::vector<IoRequest>& requests) {
+  if (port_ == NULL)
+    return false;
+
+  std::vector<IoSlot> slots(std::min(queueDepth_, requests.size()));
+  std::vector<IoSlot*> idle;
+  for (auto& slot : slots)
+    idle.push_back(&slot);
+
+  // After a failure nothing new is submitted, but the requests in flight
+  // are still waited for since they use the caller's buffers.
+  bool succeeded = true;
+  size_t next = 0;
+  size_t inFlight = 0;
+  while (inFlight > 0 || (succeeded && next < requests.size())) {
+    while (succeeded && next < requests.size() && !idle.empty()) {
+      IoSlot* slot = idle.back();
+      if (!Submit(slot, requests[next])) {
+        slot->request = NULL;
+        succeeded = false;
+        break;
+      }
+      idle.pop_back();
+      ++next;
+      ++inFlight;
+    }
+    if (inFlight == 0)
+      break;
+
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    LPOVERLAPPED overlapped = NULL;
+    BOOL done = GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, INFINITE);
+    if (overlapped == NULL) {
+      // The port itself failed. The requests in flight still use the slots
+      // and the caller's buffers, so they are cancelled and waited for on
+      // their handles, and the port, which may still get their packets, is
+      // not used again.
+      for (auto& busy : slots) {
+        if (busy.request == NULL)
+          continue;
+        CancelIoEx(busy.request->file, &busy.overlapped);
+        GetOverlappedResult(busy.request->file, &busy.overlapped, &bytes, TRUE);
+      }
+      CloseHandle(port_);
+      port_ = NULL;
+      return false;
+    }
+
+    IoSlot* slot = reinterpret_cast<IoSlot*>(overlapped);
+    if (!done || bytes != slot->request->size)
+      succeeded = false;
+    slot->request = NULL;
+    idle.push_back(slot);
+    --inFlight;
+  }
+  return succeeded;
+}
+
+bool IoEngine::MoveRange(HANDLE file, ULONGLONG from, ULONGLONG to, ULONGLONG size) {
+  if (size == 0 || from == to)
+    return true;
+
+  // Chunks go in the order that never overwrites a byte before it is read.
+  // The chunk being written never overlaps the next one being read, so the
+  // two run as one batch.
+  auto chunkAt = [&](ULONGLONG done, DWORD* chunk) {
+    *chunk = static_cast<DWORD>(std::min<ULONGLONG>(size - done, kMoveChunkSize));
+    return to > from ? size - done - *chunk : done;
+  };
+
+  size_t bufferSize = static_cast<size_t>(std::min<ULONGLONG>(size, kMoveChunkSize));
+  std::vector<BYTE> buffers[2] = {std::vector<BYTE>(bufferSize), std::vector<BYTE>(bufferSize)};
+  DWORD chunk = 0;
+  ULONGLONG offset = chunkAt(0, &chunk);
+  if (!Run({{file, from + offset, buffers[0].data(), chunk, false}}))
+    return false;
+
+  int current = 0;
+  for (ULONGLONG done = chunk; ; done += chunk) {
+    std::vector<IoRequest> batch = {{file, to + offset, buffers[current].data(), chunk, true}};
+    DWORD nextChunk = 0;
+    ULONGLONG nextOffset = 0;
+    if (done < size) {
+      nextOffset = chunkAt(done, &nextChunk);
+      batch.push_back({file, from + nextOffset, buffers[1 - current].data(), nextChunk, false});
+    }
+    if (!Run(batch))
+      return false;
+    if (done >= size)
+      return true;
+
+    current = 1 - current;
+    offset = nextOffset;
+    chunk = nextChunk;
+  }
+}
+
+}  // namespace rescle
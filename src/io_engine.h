@@ -0,0 +1,65 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <vector>
+
+#include <windows.h>
+
+namespace rescle {
+
+enum class IoBackend {
+  kSynchronous,  // one blocking call after the other
+  kOverlapped,   // a batch is in flight at once on an I/O completion port
+};
+
+// A positioned read into, or write from, |buffer|.
+struct IoRequest {
+  HANDLE file;
+  ULONGLONG offset;
+  BYTE* buffer;
+  DWORD size;
+  bool write;
+};
+
+// Runs batches of positioned reads and writes. Files must be opened with
+// FileFlags() and attached before their requests are run.
+class IoEngine {
+ public:
+  explicit IoEngine(IoBackend backend, size_t queueDepth = 32);
+  ~IoEngine();
+
+  IoEngine(const IoEngine&) = delete;
+  IoEngine& operator=(const IoEngine&) = delete;
+
+  // The flags to open files with, for ScopedFile.
+  DWORD FileFlags() const;
+  bool Attach(HANDLE file);
+
+  // Appends the requests for |size| bytes at |offset|, split into pieces a
+  // single call can take.
+  static void AddRequests(std::vector<IoRequest>* requests, HANDLE file, ULONGLONG offset,
+                          const BYTE* buffer, size_t size, bool write);
+
+  // Runs |requests| and returns once all of them completed. Requests of
+  // one batch may run in any order, so they must not overlap.
+  bool Run(const std::vector<IoRequest>& requests);
+
+  // Moves |size| bytes within |file|, reading the next chunk while the
+  // previous one is written.
+  bool MoveRange(HANDLE file, ULONGLONG from, ULONGLONG to, ULONGLONG size);
+
+ private:
+  bool RunOverlapped(const std::vector<IoRequest>& requests);
+
+  IoBackend backend_;
+  size_t queueDepth_;
+  HANDLE port_;
+};
+
+}  // namespace rescle
+
+#endif  // IO_ENGINE_H
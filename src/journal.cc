@@ -0,0 +1,192 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "journal.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "inflate.h"
+#include "record.h"
+#include "scoped_file.h"
+
+namespace rescle {
+
+namespace {
+
+const ULONGLONG kJournalMagic = 0x314a544944454352ULL;  // "RCEDITJ1"
+
+struct JournalHeaderLayout {
+  typedef Field<ULONGLONG, 0> Magic;
+  typedef Field<ULONGLONG, 8> OriginalSize;
+  typedef Field<ULONGLONG, 16> CommittedSize;
+  typedef Field<ULONGLONG, 24> OverlayFrom;
+  typedef Field<ULONGLONG, 32> OverlayTo;
+  typedef Field<ULONGLONG, 40> OverlaySize;
+  typedef Field<DWORD, 48> CommittedCrc;
+  typedef Field<DWORD, 52> RangeCount;
+  static constexpr size_t kSize = 56;
+};
+
+// Followed by the original bytes.
+struct JournalRangeLayout {
+  typedef Field<ULONGLONG, 0> Offset;
+  typedef Field<ULONGLONG, 8> Length;
+  typedef Field<ULONGLONG, 16> OriginalSize;
+  static constexpr size_t kSize = 24;
+};
+
+}  // namespace
+
+void BuildJournal(const BYTE* data, size_t size, const std::vector<FilePatch>& patches,
+                  const FileMove& overlay, ULONGLONG newSize, RevertJournal* journal) {
+  journal->originalSize = size;
+  journal->committedSize = newSize;
+  journal->overlay = overlay;
+  journal->ranges.clear();
+
+  DWORD crc = 0;
+  for (const auto& patch : patches) {
+    JournalRange range;
+    range.offset = patch.offset;
+    range.length = patch.bytes.size();
+    if (patch.offset < size) {
+      ULONGLONG end = std::min<ULONGLONG>(patch.offset + patch.bytes.size(), size);
+      range.original.assign(data + patch.offset, data + end);
+    }
+    crc = Crc32(patch.bytes.data(), patch.bytes.size(), crc);
+    journal->ranges.push_back(std::move(range));
+  }
+
+  // A shrunk file loses its tail.
+  if (newSize < size) {
+    JournalRange tail;
+    tail.offset = newSize;
+    tail.original.assign(data + newSize, data + size);
+    journal->ranges.push_back(std::move(tail));
+  }
+  journal->committedCrc = crc;
+}
+
+bool WriteJournal(const WCHAR* path, const RevertJournal& journal) {
+  BYTE header[JournalHeaderLayout::kSize];
+  RecordWriter<JournalHeaderLayout> headerWriter(header);
+  headerWriter.Set<JournalHeaderLayout::Magic>(kJournalMagic);
+  headerWriter.Set<JournalHeaderLayout::OriginalSize>(journal.originalSize);
+  headerWriter.Set<JournalHeaderLayout::CommittedSize>(journal.committedSize);
+  headerWriter.Set<JournalHeaderLayout::OverlayFrom>(journal.overlay.from);
+  headerWriter.Set<JournalHeaderLayout::OverlayTo>(journal.overlay.to);
+  headerWriter.Set<JournalHeaderLayout::OverlaySize>(journal.overlay.size);
+  headerWriter.Set<JournalHeaderLayout::CommittedCrc>(journal.committedCrc);
+  headerWriter.Set<JournalHeaderLayout::RangeCount>(static_cast<DWORD>(journal.ranges.size()));
+
+  ScopedFile file(path, true, CREATE_ALWAYS);
+  if (file == INVALID_HANDLE_VALUE || !WriteAll(file, header, sizeof(header)))
+    return false;
+
+  for (const auto& range : journal.ranges) {
+    BYTE record[JournalRangeLayout::kSize];
+    RecordWriter<JournalRangeLayout> recordWriter(record);
+    recordWriter.Set<JournalRangeLayout::Offset>(range.offset);
+    recordWriter.Set<JournalRangeLayout::Length>(range.length);
+    recordWriter.Set<JournalRangeLayout::OriginalSize>(range.original.size());
+    if (!WriteAll(file, record, sizeof(record)) ||
+        !WriteAll(file, range.original.data(), range.original.size()))
+      return false;
+  }
+  return true;
+}
+
+bool ReadJournal(const WCHAR* path, RevertJournal* journal) {
+  ScopedFile file(path);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  ScopedFileMapping mapping(file);
+  ByteSpan bytes(mapping.data(), mapping.size());
+  RecordView<JournalHeaderLayout> header(bytes);
+  if (!header.valid() || header.Get<JournalHeaderLayout::Magic>() != kJournalMagic)
+    return false;
+
+  journal->originalSize = header.Get<JournalHeaderLayout::OriginalSize>();
+  journal->committedSize = header.Get<JournalHeaderLayout::CommittedSize>();
+  journal->overlay.from = header.Get<JournalHeaderLayout::OverlayFrom>();
+  journal->overlay.to = header.Get<JournalHeaderLayout::OverlayTo>();
+  journal->overlay.size = header.Get<JournalHeaderLayout::OverlaySize>();
+  journal->committedCrc = header.Get<JournalHeaderLayout::CommittedCrc>();
+  journal->ranges.clear();
+
+  size_t position = JournalHeaderLayout::kSize;
+  DWORD count = header.Get<JournalHeaderLayout::RangeCount>();
+  for (DWORD i = 0; i < count; ++i) {
+    RecordView<JournalRangeLayout> record(bytes.Subspan(position));
+    if (!record.valid())
+      return false;
+
+    ULONGLONG originalSize = record.Get<JournalRangeLayout::OriginalSize>();
+    position += JournalRangeLayout::kSize;
+    if (originalSize > bytes.size() || !bytes.Contains(position, static_cast<size_t>(originalSize)))
+      return false;
+
+    JournalRange range;
+    range.offset = record.Get<JournalRangeLayout::Offset>();
+    range.length = record.Get<JournalRangeLayout::Length>();
+    range.original.assign(bytes.data() + position, bytes.data() + position + originalSize);
+    position += static_cast<size_t>(originalSize);
+    journal->ranges.push_back(std::move(range));
+  }
+  return position == bytes.size();
+}
+
+bool RevertFile(const WCHAR* filename, const RevertJournal& journal, IoBackend backend) {
+  IoEngine engine(backend);
+  ScopedFile file(filename, true, OPEN_EXISTING, engine.FileFlags());
+  if (file == INVALID_HANDLE_VALUE || !engine.Attach(file))
+    return false;
+
+  // Check the ranges the commit wrote before touching anything.
+  LARGE_INTEGER size;
+  bool matches = GetFileSizeEx(file, &size) &&
+                 static_cast<ULONGLONG>(size.QuadPart) == journal.committedSize;
+  ULONGLONG total = 0;
+  for (const auto& range : journal.ranges)
+    total += range.length;
+  if (matches && total > SIZE_MAX)
+    matches = false;
+
+  DWORD crc = 0;
+  if (matches) {
+    std::vector<BYTE> buffer(static_cast<size_t>(total));
+    std::vector<IoRequest> reads;
+    size_t position = 0;
+    for (const auto& range : journal.ranges) {
+      IoEngine::AddRequests(&reads, file, range.offset, buffer.data() + position,
+                            static_cast<size_t>(range.length), false);
+      position += static_cast<size_t>(range.length);
+    }
+    matches = engine.Run(reads);
+    crc = Crc32(buffer.data(), buffer.size());
+  }
+  if (!matches || crc != journal.committedCrc) {
+    fprintf(stderr, "The file was changed since the journal was written\n");
+    return false;
+  }
+
+  const FileMove& overlay = journal.overlay;
+  if (overlay.to != overlay.from && overlay.size > 0 &&
+      !engine.MoveRange(file, overlay.to, overlay.from, overlay.size))
+    return false;
+
+  std::vector<IoRequest> writes;
+  for (const auto& range : journal.ranges)
+    IoEngine::AddRequests(&writes, file, range.offset, range.original.data(), range.original.size(), true);
+  if (!engine.Run(writes))
+    return false;
+
+  LARGE_INTEGER end;
+  end.QuadPart = static_cast<LONGLONG>(journal.originalSize);
+  return SetFilePointerEx(file, end, NULL, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+}  // namespace rescle
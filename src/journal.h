@@ -0,0 +1,49 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <vector>
+
+#include <windows.h>
+
+#include "io_engine.h"
+#include "pe_image.h"
+
+namespace rescle {
+
+// A range a commit wrote, with the bytes that were there before it up to
+// the original end of the file.
+struct JournalRange {
+  ULONGLONG offset = 0;
+  ULONGLONG length = 0;
+  std::vector<BYTE> original;
+};
+
+// What a commit changed, enough to restore the file bit for bit with writes
+// the size of the resource section.
+struct RevertJournal {
+  ULONGLONG originalSize = 0;
+  ULONGLONG committedSize = 0;
+  FileMove overlay;           // moved by the commit, moved back on revert
+  std::vector<JournalRange> ranges;
+  DWORD committedCrc = 0;     // of the ranges as the commit left them
+};
+
+// Records what applying a layout plan to the image |data| overwrites.
+void BuildJournal(const BYTE* data, size_t size, const std::vector<FilePatch>& patches,
+                  const FileMove& overlay, ULONGLONG newSize, RevertJournal* journal);
+
+bool WriteJournal(const WCHAR* path, const RevertJournal& journal);
+bool ReadJournal(const WCHAR* path, RevertJournal* journal);
+
+// Restores |filename| to the image the journal was taken from. Nothing is
+// written when the file is not the one the commit left.
+bool RevertFile(const WCHAR* filename, const RevertJournal& journal,
+                IoBackend backend = IoBackend::kSynchronous);
+
+}  // namespace rescle
+
+#endif  // JOURNAL_H
@@ -3,17 +3,116 @@
 // LICENSE file.
 
 #include <string.h>
+#include <wctype.h>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
 #include <vector>
 
 #include <windows.h>
 #include <winver.h>
 
+#include "archive.h"
+#include "edit_plan.h"
+#include "file_watcher.h"
+#include "journal.h"
+#include "output_cache.h"
+#include "parallel.h"
 #include "rescle.h"
+#include "scoped_file.h"
+#include "string_list.h"
 
 namespace {
 
-std::vector<uint8_t> get_file_version_info() {
-  DWORD zero = 0;
+enum class OutputFormat {
+  kDefault,
+  kTsv,
+  kJson,
+};
+
+struct OptionSpec {
+  const wchar_t* name;
+  const wchar_t* alias;
+  int args;
+  int path_arg;  // 1-based index of the argument naming an input file
+  bool query;
+  bool setting = false;  // shapes how the other options run, edits nothing
+};
+
+// Arity of every option, used to find the target file and the edits
+// before anything is loaded.
+const OptionSpec kOptions[] = {
+  { L"--set-version-string", L"-svs", 2, 0, false },
+  { L"--get-version-string", L"-gvs", 1, 0, true },
+  { L"--set-file-version", L"-sfv", 1, 0, false },
+  { L"--get-file-version", L"-gfv", 0, 0, true },
+  { L"--set-product-version", L"-spv", 1, 0, false },
+  { L"--get-product-version", L"-gpv", 0, 0, true },
+  { L"--set-icon", L"-si", 1, 1, false },
+  { L"--get-icon-groups", L"-gig", 0, 0, true },
+  { L"--set-requested-execution-level", L"-srel", 1, 0, false },
+  { L"--get-requested-execution-level", L"-grel", 0, 0, true },
+  { L"--application-manifest", L"-am", 1, 1, false },
+  { L"--set-resource-string", L"--srs", 2, 0, false },
+  { L"--set-resource-strings", NULL, 1, 1, false },
+  { L"--get-resource-string", L"-grs", 1, 0, true },
+  { L"--set-rcdata", NULL, 2, 2, false },
+  { L"--set-resource", NULL, 3, 3, false },
+  { L"--import-res", NULL, 1, 1, false },
+  // Writes a file besides the target, so the run is never served from the
+  // cache.
+  { L"--export-res", NULL, 1, 0, true },
+  { L"--extract", NULL, 2, 0, true },
+  { L"--extract-all", NULL, 1, 0, true },
+  { L"--lang", NULL, 1, 0, false, true },
+  { L"--all-languages", NULL, 0, 0, false, true },
+  { L"--rsrc-layout", NULL, 1, 0, false, true },
+  { L"--output-format", NULL, 1, 0, false, true },
+  { L"--stats", NULL, 0, 0, false, true },
+  { L"--archive-entries", NULL, 1, 0, false, true },
+  { L"--cache-dir", NULL, 1, 0, false, true },
+  { L"--cache-max-size", NULL, 1, 0, false, true },
+  { L"--cache-stats", NULL, 0, 0, false, true },
+  { L"--watch", NULL, 0, 0, false, true },
+  { L"--journal", NULL, 1, 0, false, true },
+  { L"--revert", NULL, 1, 1, false, true },
+  { L"--io", NULL, 1, 0, false, true },
+  { L"--deterministic", NULL, 0, 0, false, true },
+  { L"--resource-timestamp", NULL, 1, 0, false, true },
+  { L"--record-plan", NULL, 1, 0, false, true },
+  { L"--plan-slot", NULL, 2, 0, false, true },
+  { L"--apply-plan", NULL, 1, 1, false, true },
+  { L"--variants", NULL, 1, 1, false, true },
+};
+
+struct CacheOptions {
+  const wchar_t* dir = NULL;
+  ULONGLONG max_size = 0;
+  bool stats = false;
+};
+
+struct QueryResult {
+  std::wstring query;
+  LANGID lang;
+  std::wstring key;
+  std::wstring value;
+  bool found;
+  const char* error;
+};
+
+// What the options asked for besides edits to the updater.
+struct RunState {
+  std::vector<QueryResult> queries;
+  OutputFormat format = OutputFormat::kDefault;
+  bool print_stats = false;
+  const wchar_t* export_res = NULL;
+  std::vector<std::pair<const wchar_t*, const wchar_t*>> extracts;  // spec and path
+  const wchar_t* extract_all = NULL;
+  bool loaded = false;
+};
+
+std::vector<wchar_t> get_module_filename() {
   std::vector<wchar_t> filename(MAX_PATH);
   SetLastError(ERROR_SUCCESS);
 
@@ -25,6 +124,16 @@ std::vector<uint8_t> get_file_version_info() {
   } while (GetLastError() == ERROR_INSUFFICIENT_BUFFER);
 
   if (GetLastError() != ERROR_SUCCESS) {
+    return std::vector<wchar_t>();
+  }
+
+  return filename;
+}
+
+std::vector<uint8_t> get_file_version_info() {
+  DWORD zero = 0;
+  std::vector<wchar_t> filename = get_module_filename();
+  if (filename.empty()) {
     return std::vector<uint8_t>();
   }
 
@@ -44,24 +153,70 @@ std::vector<uint8_t> get_file_version_info() {
 void print_help(VS_FIXEDFILEINFO* file_info) {
   fprintf(stdout,
 "Rcedit v%d.%d.%d: Edit resources of exe.\n\n"
-"Usage: rcedit <filename> [options...]\n\n"
+"Usage: rcedit <filename> [options...]\n"
+"A filename of - reads the file from stdin and writes the result to stdout.\n\n"
 "Options:\n"
 "  -h, --help                                 Show this message\n"
 "  --set-version-string <key> <value>         Set version string\n"
 "  --get-version-string <key>                 Print version string\n"
 "  --set-file-version <version>               Set FileVersion\n"
+"  --get-file-version                         Print fixed FileVersion\n"
 "  --set-product-version <version>            Set ProductVersion\n"
+"  --get-product-version                      Print fixed ProductVersion\n"
 "  --set-icon <path-to-icon>                  Set file icon\n"
+"  --get-icon-groups                          Print icon groups and their sizes\n"
 "  --set-requested-execution-level <level>    Pass nothing to see usage\n"
+"  --get-requested-execution-level            Print requested execution level\n"
 "  --application-manifest <path-to-file>      Set manifest file\n"
 "  --set-resource-string <key> <value>        Set resource string\n"
+"  --set-resource-strings <path-to-file>      Set resource strings from JSON or CSV\n"
 "  --get-resource-string <key>                Get resource string\n"
-"  --set-rcdata <key> <path-to-file>          Replace RCDATA by integer id\n",
+"  --set-rcdata <key> <path-to-file>          Replace RCDATA by integer id or name\n"
+"  --set-resource <type> <key> <path-to-file> Add or replace a resource of any type\n"
+"  --import-res <path-to-res>                 Merge every resource of a .res file\n"
+"  --export-res <path-to-res>                 Write the resources as a .res file\n"
+"  --extract <type>/<key>[/<lang>] <path>     Write one resource, group icons as .ico\n"
+"  --extract-all <dir>                        Write every resource to a directory\n"
+"  --lang <id>                                Apply following options to one LANGID\n"
+"  --all-languages                            Apply following options to all LANGIDs\n"
+"  --rsrc-layout <in-place|relocate|system>   Where to place the updated .rsrc\n"
+"  --output-format <tsv|json>                 Format of the --get-* results\n"
+"  --stats                                    Print what the commit changed\n"
+"  --archive-entries <glob>                   Edit matching entries of a zip or tar\n"
+"  --watch                                    Restamp whenever the file or inputs change\n"
+"  --journal <path>                           Save what the commit overwrites\n"
+"  --revert <path-to-journal>                 Restore the file saved by --journal\n"
+"  --io <sync|overlapped>                     How the file is written\n"
+"  --deterministic                            Same input and edits give same bytes\n"
+"  --resource-timestamp <seconds>             TimeDateStamp of resource directories\n"
+"  --record-plan <path>                       Save the writes for --apply-plan\n"
+"  --plan-slot <key> <chars>                  Version string a replay can fill in\n"
+"  --apply-plan <path>                        Replay a plan on an identical file\n"
+"  --variants <path>                          Write one edited copy per CSV row\n"
+"  --cache-dir <path>                         Reuse outputs of identical runs\n"
+"  --cache-max-size <megabytes>               Evict old cache entries above size\n"
+"  --cache-stats                              Print cache statistics\n\n"
+"Any number of --get-* options can be combined, they are answered from a\n"
+"single load and no changes are written to the file.\n",
 (file_info->dwProductVersionMS >> 16) & 0xff,
 (file_info->dwProductVersionMS >>  0) & 0xff,
 (file_info->dwProductVersionLS >> 16) & 0xff);
 }
 
+// Reads all of stdin, in binary.
+bool read_stdin(std::vector<BYTE>* data) {
+  HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+  BYTE buffer[1 << 16];
+  while (true) {
+    DWORD read = 0;
+    if (!ReadFile(input, buffer, sizeof(buffer), &read, NULL))
+      return GetLastError() == ERROR_BROKEN_PIPE;
+    if (read == 0)
+      return true;
+    data->insert(data->end(), buffer, buffer + read);
+  }
+}
+
 bool print_error(const char* message) {
   fprintf(stderr, "Fatal error: %s\n", message);
   return 1;
@@ -80,27 +235,256 @@ bool parse_version_string(const wchar_t* str, unsigned short *v1, unsigned short
          (swscanf_s(str, L"%hu", v1) == 1);
 }
 
-}  // namespace
+std::wstring format_version(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
+  return std::to_wstring(v1) + L"." + std::to_wstring(v2) + L"." +
+         std::to_wstring(v3) + L"." + std::to_wstring(v4);
+}
 
-int wmain(int argc, const wchar_t* argv[]) {
-  bool loaded = false;
-  rescle::ResourceUpdater updater;
+std::wstring escape_json(const std::wstring& str) {
+  std::wstring escaped;
+  escaped.reserve(str.size());
+  for (wchar_t c : str) {
+    switch (c) {
+      case L'"':  escaped += L"\\\""; break;
+      case L'\\': escaped += L"\\\\"; break;
+      case L'\n': escaped += L"\\n"; break;
+      case L'\r': escaped += L"\\r"; break;
+      case L'\t': escaped += L"\\t"; break;
+      default:
+        if (c < 0x20) {
+          wchar_t buf[8];
+          swprintf(buf, 8, L"\\u%04x", static_cast<unsigned int>(c));
+          escaped += buf;
+        } else {
+          escaped += c;
+        }
+    }
+  }
+  return escaped;
+}
 
-  if (argc == 1 ||
-      (argc == 2 && wcscmp(argv[1], L"-h") == 0) ||
-      (argc == 2 && wcscmp(argv[1], L"--help") == 0)) {
-    UINT ignored = 0;
-    VS_FIXEDFILEINFO* file_info = nullptr;
-    std::vector<uint8_t> file_version_info = get_file_version_info();
+// Backslash escapes keep a TSV field on its own row and column.
+std::wstring escape_tsv(const std::wstring& str) {
+  std::wstring escaped;
+  escaped.reserve(str.size());
+  for (wchar_t c : str) {
+    switch (c) {
+      case L'\\': escaped += L"\\\\"; break;
+      case L'\n': escaped += L"\\n"; break;
+      case L'\r': escaped += L"\\r"; break;
+      case L'\t': escaped += L"\\t"; break;
+      default: escaped += c; break;
+    }
+  }
+  return escaped;
+}
 
-    if (file_version_info.size() == 0 || !VerQueryValueW(file_version_info.data(), L"\\", (LPVOID*) &file_info, &ignored)) {
-      return print_error("Could not determine version of rcedit");
+int print_queries(const std::vector<QueryResult>& results, OutputFormat format) {
+  int status = 0;
+  for (const auto& result : results) {
+    if (!result.found) {
+      print_error(result.error);
+      status = 1;
     }
+  }
 
-    print_help(file_info);
-    return 0;
+  // A single lookup keeps printing the bare value.
+  if (format == OutputFormat::kDefault && results.size() == 1) {
+    if (results[0].found)
+      fwprintf(stdout, L"%s", results[0].value.c_str());
+    return status;
+  }
+
+  if (format == OutputFormat::kJson) {
+    fwprintf(stdout, L"[");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& result = results[i];
+      fwprintf(stdout, L"%s\n  {\"query\": \"%s\"", i == 0 ? L"" : L",",
+               result.query.c_str());
+      if (result.lang != 0)
+        fwprintf(stdout, L", \"lang\": %u", static_cast<unsigned int>(result.lang));
+      if (!result.key.empty())
+        fwprintf(stdout, L", \"key\": \"%s\"", escape_json(result.key).c_str());
+      if (result.found)
+        fwprintf(stdout, L", \"value\": \"%s\"}", escape_json(result.value).c_str());
+      else
+        fwprintf(stdout, L", \"value\": null}");
+    }
+    fwprintf(stdout, L"\n]\n");
+    return status;
+  }
+
+  // Tab-separated: query, language (empty for the default one), key, value.
+  // A miss keeps its row, with \N as the value as JSON has null.
+  for (const auto& result : results) {
+    std::wstring lang = result.lang != 0 ? std::to_wstring(result.lang) : L"";
+    fwprintf(stdout, L"%s\t%s\t%s\t%s\n", result.query.c_str(), lang.c_str(),
+             escape_tsv(result.key).c_str(),
+             result.found ? escape_tsv(result.value).c_str() : L"\\N");
   }
+  return status;
+}
+
+// Parses the value of --io.
+bool parse_io_backend(const wchar_t* arg, rescle::IoBackend* backend) {
+  if (wcscmp(arg, L"sync") == 0)
+    *backend = rescle::IoBackend::kSynchronous;
+  else if (wcscmp(arg, L"overlapped") == 0)
+    *backend = rescle::IoBackend::kOverlapped;
+  else
+    return false;
+  return true;
+}
+
+// Decimal numbers are integer ids, anything else is a name. Names are
+// upper-cased the way rc stores them.
+rescle::ResourceId parse_resource_id(const wchar_t* arg) {
+  size_t length = wcslen(arg);
+  if (length > 0 && length <= 5 && wcsspn(arg, L"0123456789") == length && _wtoi(arg) <= 0xffff)
+    return rescle::ResourceId(static_cast<WORD>(_wtoi(arg)));
+
+  rescle::ResourceId id;
+  for (const wchar_t* c = arg; *c; ++c)
+    id.name += static_cast<wchar_t>(towupper(*c));
+  return id;
+}
+
+// Extracts the resource named by |spec|, <type>/<key> with an optional
+// /<lang>.
+bool extract_resource(rescle::ResourceUpdater& updater, const wchar_t* spec, const wchar_t* path) {
+  std::vector<std::wstring> parts;
+  std::wstring part;
+  for (const wchar_t* c = spec; ; ++c) {
+    if (*c == L'/' || *c == 0) {
+      parts.push_back(part);
+      part.clear();
+      if (*c == 0)
+        break;
+    } else {
+      part += *c;
+    }
+  }
+  if (parts.size() < 2 || parts.size() > 3 || parts[0].empty() || parts[1].empty())
+    return false;
+
+  rescle::ResourceId type = parse_resource_id(parts[0].c_str());
+  rescle::ResourceId key = parse_resource_id(parts[1].c_str());
+  if (parts.size() == 2)
+    return updater.ExtractResource(type, key, path);
+
+  unsigned int lang_id = 0;
+  if (swscanf_s(parts[2].c_str(), L"%u", &lang_id) != 1 || lang_id > 0xffff)
+    return false;
+  return updater.ExtractResource(type, key, static_cast<WORD>(lang_id), path);
+}
+
+const OptionSpec* find_option(const wchar_t* arg) {
+  for (const auto& option : kOptions) {
+    if (wcscmp(arg, option.name) == 0 ||
+        (option.alias != NULL && wcscmp(arg, option.alias) == 0))
+      return &option;
+  }
+  return NULL;
+}
+
+// Finds the target file, the cache settings and whether the run only
+// reads. Malformed arguments are left for the main loop to report.
+bool scan_arguments(int argc, const wchar_t* argv[], const wchar_t** filename,
+                    const wchar_t** archive_entries, CacheOptions* cache, bool* read_only) {
+  *filename = NULL;
+  *read_only = false;
+  for (int i = 1; i < argc; ++i) {
+    const OptionSpec* option = find_option(argv[i]);
+    if (option == NULL) {
+      if (*filename != NULL)
+        return false;
+      *filename = argv[i];
+      continue;
+    }
+    if (argc - i - 1 < option->args)
+      return false;
+
+    if (option->query)
+      *read_only = true;
+    if (wcscmp(option->name, L"--archive-entries") == 0) {
+      *archive_entries = argv[i + 1];
+    } else if (wcscmp(option->name, L"--cache-dir") == 0) {
+      cache->dir = argv[i + 1];
+    } else if (wcscmp(option->name, L"--cache-max-size") == 0) {
+      unsigned long long megabytes = 0;
+      if (swscanf_s(argv[i + 1], L"%llu", &megabytes) != 1)
+        return false;
+      cache->max_size = megabytes << 20;
+    } else if (wcscmp(option->name, L"--cache-stats") == 0) {
+      cache->stats = true;
+    }
+    i += option->args;
+  }
+  return *filename != NULL;
+}
+
+// Hashes the input file, the rcedit binary and the canonical list of
+// edits, with the content of every input file in place of its path.
+std::wstring compute_cache_key(int argc, const wchar_t* argv[], const wchar_t* filename) {
+  rescle::Sha256 key;
+  std::vector<wchar_t> self = get_module_filename();
+  if (self.empty() || !key.UpdateFile(self.data()) || !key.UpdateFile(filename))
+    return std::wstring();
 
+  for (int i = 1; i < argc; ++i) {
+    const OptionSpec* option = find_option(argv[i]);
+    if (option == NULL)
+      continue;
+
+    // Cache settings do not change the output.
+    if (wcsncmp(option->name, L"--cache-", 8) != 0) {
+      key.UpdateString(option->name);
+      for (int arg = 1; arg <= option->args; ++arg) {
+        if (arg == option->path_arg) {
+          rescle::Sha256 content;
+          content.UpdateFile(argv[i + arg]);
+          key.UpdateString(content.Finish());
+        } else {
+          key.UpdateString(argv[i + arg]);
+        }
+      }
+    }
+    i += option->args;
+  }
+  return key.Finish();
+}
+
+void print_cache_stats(const rescle::OutputCache& cache, bool hit) {
+  rescle::OutputCacheStats stats = cache.GetStats();
+  fprintf(stderr, "Cache %s: %llu hits, %llu misses, %llu entries, %llu bytes\n",
+          hit ? "hit" : "miss", stats.hits, stats.misses, stats.entries, stats.bytes);
+}
+
+void store_output(rescle::OutputCache* cache, const std::wstring& key, const wchar_t* target,
+                  bool print_stats) {
+  if (!cache->Store(key, target))
+    print_warning("Unable to store the output in the cache");
+  if (print_stats)
+    print_cache_stats(*cache, false);
+}
+
+// |prefix| names the archive entry, if any.
+void print_commit_stats(const rescle::CommitStats& stats, const std::wstring& prefix) {
+  if (stats.written)
+    fwprintf(stderr, L"%lsWrote %zu resources, %zu changed\n", prefix.c_str(), stats.resources, stats.changed);
+  else
+    fwprintf(stderr, L"%lsNo-op: %zu resources unchanged, file not written\n", prefix.c_str(), stats.resources);
+}
+
+// Languages are only reported once --lang or --all-languages is in effect.
+LANGID reported_language(const rescle::ResourceUpdater& updater, LANGID lang) {
+  return updater.IsDefaultLanguageSelected() ? 0 : lang;
+}
+
+// Applies the options in order. The target file argument is handed to
+// |load|, which reports its own errors.
+int apply_options(int argc, const wchar_t* argv[], rescle::ResourceUpdater& updater,
+                  RunState* state, const std::function<bool(const wchar_t*)>& load) {
   for (int i = 1; i < argc; ++i) {
     if (wcscmp(argv[i], L"--set-version-string") == 0 ||
         wcscmp(argv[i], L"-svs") == 0) {
@@ -117,12 +501,32 @@ int wmain(int argc, const wchar_t* argv[]) {
       if (argc - i < 2)
         return print_error("--get-version-string requires 'Key'");
       const wchar_t* key = argv[++i];
-      const wchar_t* result = updater.GetVersionString(key);
-      if (!result)
-        return print_error("Unable to get version string");
+      for (LANGID lang : updater.GetVersionLanguages()) {
+        const wchar_t* result = updater.GetVersionString(lang, key);
+        state->queries.push_back({ L"get-version-string", reported_language(updater, lang),
+                            key, result ? result : L"", result != NULL,
+                            "Unable to get version string" });
+      }
 
-      fwprintf(stdout, L"%s", result);
-      return 0;  // no changes made
+    } else if (wcscmp(argv[i], L"--get-file-version") == 0 ||
+               wcscmp(argv[i], L"-gfv") == 0) {
+      for (LANGID lang : updater.GetVersionLanguages()) {
+        unsigned short v1, v2, v3, v4;
+        bool found = updater.GetFileVersion(lang, &v1, &v2, &v3, &v4);
+        state->queries.push_back({ L"get-file-version", reported_language(updater, lang), L"",
+                            found ? format_version(v1, v2, v3, v4) : L"",
+                            found, "Unable to get file version" });
+      }
+
+    } else if (wcscmp(argv[i], L"--get-product-version") == 0 ||
+               wcscmp(argv[i], L"-gpv") == 0) {
+      for (LANGID lang : updater.GetVersionLanguages()) {
+        unsigned short v1, v2, v3, v4;
+        bool found = updater.GetProductVersion(lang, &v1, &v2, &v3, &v4);
+        state->queries.push_back({ L"get-product-version", reported_language(updater, lang), L"",
+                            found ? format_version(v1, v2, v3, v4) : L"",
+                            found, "Unable to get product version" });
+      }
 
     } else if (wcscmp(argv[i], L"--set-file-version") == 0 ||
                wcscmp(argv[i], L"-sfv") == 0) {
@@ -162,6 +566,25 @@ int wmain(int argc, const wchar_t* argv[]) {
       if (!updater.SetIcon(argv[++i]))
         return print_error("Unable to set icon");
 
+    } else if (wcscmp(argv[i], L"--get-icon-groups") == 0 ||
+               wcscmp(argv[i], L"-gig") == 0) {
+      std::vector<rescle::IconGroupSummary> groups = updater.GetIconGroups();
+      if (groups.empty())
+        state->queries.push_back({ L"get-icon-groups", 0, L"", L"", false, "Unable to find icon groups" });
+
+      for (const auto& group : groups) {
+        state->queries.push_back({ L"get-icon-groups", reported_language(updater, group.langId),
+                            std::to_wstring(group.bundleId),
+                            std::to_wstring(group.count), true, NULL });
+      }
+
+    } else if (wcscmp(argv[i], L"--get-requested-execution-level") == 0 ||
+               wcscmp(argv[i], L"-grel") == 0) {
+      const wchar_t* result = updater.GetExecutionLevel();
+      state->queries.push_back({ L"get-requested-execution-level", 0, L"",
+                          result ? result : L"", result != NULL,
+                          "Unable to get execution level" });
+
     } else if (wcscmp(argv[i], L"--set-requested-execution-level") == 0 ||
       wcscmp(argv[i], L"-srel") == 0) {
       if (argc - i < 2)
@@ -198,18 +621,51 @@ int wmain(int argc, const wchar_t* argv[]) {
       if (!updater.ChangeString(key_id, value))
         return print_error("Unable to change string");
 
+    } else if (wcscmp(argv[i], L"--set-resource-strings") == 0) {
+      if (argc - i < 2)
+        return print_error("--set-resource-strings requires path to a JSON or CSV file");
+
+      if (!updater.ChangeStrings(argv[++i]))
+        return print_error("Unable to change strings");
+
     } else if (wcscmp(argv[i], L"--set-rcdata") == 0) {
       if (argc - i < 3)
         return print_error("--set-rcdata requires int 'Key' and path to resource 'Value'");
 
-      const wchar_t* key = argv[++i];
-      unsigned int key_id = 0;
-      if (swscanf_s(key, L"%d", &key_id) != 1)
-        return print_error("Unable to parse id");
-
+      rescle::ResourceId key = parse_resource_id(argv[++i]);
       const wchar_t* pathToResource = argv[++i];
-      if (!updater.ChangeRcData(key_id, pathToResource))
+      if (!updater.ChangeRcData(key, pathToResource))
         return print_error("Unable to change RCDATA");
+    } else if (wcscmp(argv[i], L"--set-resource") == 0) {
+      if (argc - i < 4)
+        return print_error("--set-resource requires 'Type', 'Key' and path to resource 'Value'");
+
+      rescle::ResourceId type = parse_resource_id(argv[++i]);
+      rescle::ResourceId key = parse_resource_id(argv[++i]);
+      if (!updater.SetResource(type, key, argv[++i]))
+        return print_error("Unable to set resource");
+    } else if (wcscmp(argv[i], L"--import-res") == 0) {
+      if (argc - i < 2)
+        return print_error("--import-res requires path to the .res file");
+
+      if (!updater.ImportRes(argv[++i]))
+        return print_error("Unable to import the .res file");
+    } else if (wcscmp(argv[i], L"--export-res") == 0) {
+      if (argc - i < 2)
+        return print_error("--export-res requires path to the .res file");
+
+      state->export_res = argv[++i];  // written once all edits are applied
+    } else if (wcscmp(argv[i], L"--extract") == 0) {
+      if (argc - i < 3)
+        return print_error("--extract requires 'Type/Key[/Lang]' and path to the output file");
+
+      state->extracts.emplace_back(argv[i + 1], argv[i + 2]);  // written once all edits are applied
+      i += 2;
+    } else if (wcscmp(argv[i], L"--extract-all") == 0) {
+      if (argc - i < 2)
+        return print_error("--extract-all requires path to the output directory");
+
+      state->extract_all = argv[++i];
     } else if (wcscmp(argv[i], L"--get-resource-string") == 0 ||
       wcscmp(argv[i], L"-grs") == 0) {
       if (argc - i < 2)
@@ -220,33 +676,703 @@ int wmain(int argc, const wchar_t* argv[]) {
       if (swscanf_s(key, L"%d", &key_id) != 1)
         return print_error("Unable to parse id");
 
-      const wchar_t* result = updater.GetString(key_id);
-      if (!result)
-        return print_error("Unable to get resource string");
+      for (LANGID lang : updater.GetStringTableLanguages()) {
+        const wchar_t* result = updater.GetString(lang, key_id);
+        state->queries.push_back({ L"get-resource-string", reported_language(updater, lang),
+                            key, result ? result : L"", result != NULL,
+                            "Unable to get resource string" });
+      }
+
+    } else if (wcscmp(argv[i], L"--lang") == 0) {
+      if (argc - i < 2)
+        return print_error("--lang requires a language id");
+
+      unsigned int lang_id = 0;
+      if (swscanf_s(argv[++i], L"%u", &lang_id) != 1 || lang_id > 0xffff)
+        return print_error("Unable to parse language id");
+
+      updater.SelectLanguage(static_cast<LANGID>(lang_id));
+
+    } else if (wcscmp(argv[i], L"--all-languages") == 0) {
+      updater.SelectAllLanguages();
+
+    } else if (wcscmp(argv[i], L"--rsrc-layout") == 0) {
+      if (argc - i < 2)
+        return print_error("--rsrc-layout requires in-place, relocate or system");
+
+      const wchar_t* value = argv[++i];
+      if (wcscmp(value, L"in-place") == 0)
+        updater.SetLayoutStrategy(rescle::ResourceUpdater::LayoutStrategy::kInPlace);
+      else if (wcscmp(value, L"relocate") == 0)
+        updater.SetLayoutStrategy(rescle::ResourceUpdater::LayoutStrategy::kRelocate);
+      else if (wcscmp(value, L"system") == 0)
+        updater.SetLayoutStrategy(rescle::ResourceUpdater::LayoutStrategy::kSystem);
+      else
+        return print_error("--rsrc-layout requires in-place, relocate or system");
+
+    } else if (wcscmp(argv[i], L"--cache-dir") == 0 ||
+               wcscmp(argv[i], L"--cache-max-size") == 0) {
+      if (argc - i < 2)
+        return print_error("--cache-dir and --cache-max-size require a value");
+      ++i;  // handled before loading
+
+    } else if (wcscmp(argv[i], L"--cache-stats") == 0 ||
+               wcscmp(argv[i], L"--watch") == 0) {
+      // handled before loading
+
+    } else if (wcscmp(argv[i], L"--output-format") == 0) {
+      if (argc - i < 2)
+        return print_error("--output-format requires tsv or json");
+
+      const wchar_t* value = argv[++i];
+      if (wcscmp(value, L"tsv") == 0)
+        state->format = OutputFormat::kTsv;
+      else if (wcscmp(value, L"json") == 0)
+        state->format = OutputFormat::kJson;
+      else
+        return print_error("--output-format requires tsv or json");
+
+    } else if (wcscmp(argv[i], L"--stats") == 0) {
+      state->print_stats = true;
+
+    } else if (wcscmp(argv[i], L"--journal") == 0) {
+      if (argc - i < 2)
+        return print_error("--journal requires path to the journal file");
+
+      updater.SetJournal(argv[++i]);
+
+    } else if (wcscmp(argv[i], L"--deterministic") == 0) {
+      updater.SetDeterministic();
+
+    } else if (wcscmp(argv[i], L"--resource-timestamp") == 0) {
+      if (argc - i < 2)
+        return print_error("--resource-timestamp requires seconds since 1970");
+
+      unsigned int timestamp = 0;
+      if (swscanf_s(argv[++i], L"%u", &timestamp) != 1)
+        return print_error("Unable to parse resource timestamp");
+
+      updater.SetResourceTimestamp(timestamp);
+
+    } else if (wcscmp(argv[i], L"--record-plan") == 0) {
+      if (argc - i < 2)
+        return print_error("--record-plan requires path to the plan file");
+
+      updater.RecordPlan(argv[++i]);
+
+    } else if (wcscmp(argv[i], L"--plan-slot") == 0) {
+      if (argc - i < 3)
+        return print_error("--plan-slot requires a version string name and a width");
+
+      const wchar_t* key = argv[++i];
+      unsigned int capacity = 0;
+      if (swscanf_s(argv[++i], L"%u", &capacity) != 1 || capacity == 0 ||
+          capacity > rescle::kMaxPlanSlotCapacity)
+        return print_error("Unable to parse the slot width");
+
+      updater.AddPlanSlot(key, capacity);
+
+    } else if (wcscmp(argv[i], L"--io") == 0) {
+      rescle::IoBackend backend;
+      if (argc - i < 2 || !parse_io_backend(argv[++i], &backend))
+        return print_error("--io requires sync or overlapped");
+
+      updater.SetIoBackend(backend);
+
+    } else if (wcscmp(argv[i], L"--archive-entries") == 0) {
+      if (argc - i < 2)
+        return print_error("--archive-entries requires a glob");
+      ++i;  // handled before loading
 
-      fwprintf(stdout, L"%s", result);
-      return 0;  // no changes made
+    } else if (wcscmp(argv[i], L"--variants") == 0) {
+      if (argc - i < 2)
+        return print_error("--variants requires path to the variants file");
+      ++i;  // handled before loading
 
     } else {
-      if (loaded) {
+      if (state->loaded) {
         fprintf(stderr, "Unrecognized argument: \"%ls\"\n", argv[i]);
         return 1;
       }
 
-      loaded = true;
-      if (!updater.Load(argv[i])) {
-        fprintf(stderr, "Unable to load file: \"%ls\"\n", argv[i]);
+      state->loaded = true;
+      if (!load(argv[i]))
         return 1;
+    }
+  }
+  return 0;
+}
+
+// Loads the target, applies the options and writes the result.
+int run_edits(int argc, const wchar_t* argv[]) {
+  rescle::ResourceUpdater updater;
+  RunState state;
+  bool pipe = false;
+  int status = apply_options(argc, argv, updater, &state, [&](const wchar_t* filename) {
+    if (wcscmp(filename, L"-") == 0) {
+      std::vector<BYTE> image;
+      pipe = true;
+      if (!read_stdin(&image) || !updater.LoadFromMemory(std::move(image))) {
+        print_error("Unable to load the file from stdin");
+        return false;
       }
+    } else if (!updater.Load(filename)) {
+      fprintf(stderr, "Unable to load file: \"%ls\"\n", filename);
+      return false;
+    }
+    return true;
+  });
+  if (status != 0)
+    return status;
+
+  if (!state.loaded)
+    return print_error("You should specify a exe/dll file");
 
+  if (state.export_res != NULL && !updater.ExportRes(state.export_res))
+    return print_error("Unable to export the .res file");
+
+  for (const auto& extract : state.extracts) {
+    if (!extract_resource(updater, extract.first, extract.second)) {
+      fprintf(stderr, "Unable to extract resource: \"%ls\"\n", extract.first);
+      return 1;
     }
   }
 
-  if (!loaded)
-    return print_error("You should specify a exe/dll file");
+  if (state.extract_all != NULL && !updater.ExtractAllResources(state.extract_all))
+    return print_error("Unable to extract the resources");
+
+  if (!state.queries.empty())
+    return print_queries(state.queries, state.format);  // no changes made
 
-  if (!updater.Commit())
+  if (pipe) {
+    if (!updater.CommitToStream(GetStdHandle(STD_OUTPUT_HANDLE)))
+      return print_error("Unable to write the result to stdout");
+  } else if (!updater.Commit()) {
     return print_error("Unable to commit changes");
+  }
+
+  if (state.print_stats)
+    print_commit_stats(updater.GetCommitStats(), L"");
+
+  return 0;
+}
+
+// The position of option |name| in argv with all of its arguments, or 0.
+int option_index(int argc, const wchar_t* argv[], const wchar_t* name) {
+  for (int i = 1; i < argc; ++i) {
+    const OptionSpec* option = find_option(argv[i]);
+    if (option == NULL)
+      continue;
+    if (argc - i - 1 < option->args)
+      return 0;
+    if (wcscmp(option->name, name) == 0)
+      return i;
+    i += option->args;
+  }
+  return 0;
+}
+
+// The first of |names| given in |argv|, NULL when none is.
+const wchar_t* find_any_option(int argc, const wchar_t* argv[],
+                               std::initializer_list<const wchar_t*> names) {
+  for (const wchar_t* name : names) {
+    if (option_index(argc, argv, name) != 0)
+      return name;
+  }
+  return NULL;
+}
+
+// The --io backend of runs that do not load the file.
+bool io_backend_option(int argc, const wchar_t* argv[], rescle::IoBackend* backend) {
+  *backend = rescle::IoBackend::kSynchronous;
+  int io = option_index(argc, argv, L"--io");
+  return io == 0 || parse_io_backend(argv[io + 1], backend);
+}
+
+std::wstring full_path(const wchar_t* path) {
+  wchar_t buffer[MAX_PATH] = {0};
+  return _wfullpath(buffer, path, MAX_PATH) ? buffer : path;
+}
+
+// The write time and size of |path|, to tell our own writes from a rebuild.
+ULONGLONG file_stamp(const std::wstring& path, ULONGLONG* size) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+    *size = 0;
+    return 0;
+  }
+  *size = (static_cast<ULONGLONG>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+  return (static_cast<ULONGLONG>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+         data.ftLastWriteTime.dwLowDateTime;
+}
+
+bool read_file(const wchar_t* path, std::vector<BYTE>* data) {
+  rescle::ScopedFile file(path);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  rescle::ScopedFileMapping mapping(file);
+  if (mapping.data() == NULL)
+    return false;
+  data->assign(mapping.data(), mapping.data() + mapping.size());
+  return true;
+}
+
+bool write_file(const wchar_t* path, const std::vector<BYTE>& data) {
+  rescle::ScopedFile file(path, true, CREATE_ALWAYS);
+  return file != INVALID_HANDLE_VALUE && rescle::WriteAll(file, data.data(), data.size());
+}
+
+const DWORD kWatchQuietMilliseconds = 200;
+// How often a rebuilt target is read again while the build still holds it.
+const int kWatchReadAttempts = 25;
+
+// One file an edit option reads, watched for changes.
+struct WatchedInput {
+  std::wstring path;
+  int option;  // position of the option in argv
+};
+
+// Adds the resource types the edit option at argv[i] writes to |types|.
+// False when it may write any type, as --import-res does.
+bool add_edited_types(const wchar_t* argv[], int i, std::set<rescle::ResourceId>* types) {
+  const wchar_t* name = find_option(argv[i])->name;
+  if (wcscmp(name, L"--set-version-string") == 0 || wcscmp(name, L"--set-file-version") == 0 ||
+      wcscmp(name, L"--set-product-version") == 0) {
+    types->insert(RT_VERSION);
+  } else if (wcscmp(name, L"--set-icon") == 0) {
+    types->insert(RT_GROUP_ICON);
+    types->insert(RT_ICON);
+  } else if (wcscmp(name, L"--set-requested-execution-level") == 0 ||
+             wcscmp(name, L"--application-manifest") == 0) {
+    types->insert(RT_MANIFEST);
+  } else if (wcscmp(name, L"--set-resource-string") == 0 ||
+             wcscmp(name, L"--set-resource-strings") == 0) {
+    types->insert(RT_STRING);
+  } else if (wcscmp(name, L"--set-rcdata") == 0) {
+    types->insert(RT_RCDATA);
+  } else if (wcscmp(name, L"--set-resource") == 0) {
+    types->insert(parse_resource_id(argv[i + 1]));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// argv without the edits that write none of |types|, or all of it when
+// |types| is NULL. Settings stay, so the edits kept see the same language
+// selection as in a full run.
+std::vector<const wchar_t*> replayed_options(int argc, const wchar_t* argv[],
+                                             const std::set<rescle::ResourceId>* types) {
+  std::vector<const wchar_t*> args = { argv[0] };
+  for (int i = 1; i < argc; ++i) {
+    const OptionSpec* option = find_option(argv[i]);
+    int count = option != NULL ? option->args : 0;  // the target has none
+    std::set<rescle::ResourceId> written;
+    bool replayed = option == NULL || option->setting || types == NULL ||
+                    !add_edited_types(argv, i, &written);
+    for (const auto& type : written)
+      replayed |= types->count(type) != 0;
+    if (replayed)
+      args.insert(args.end(), argv + i, argv + i + count + 1);
+    i += count;
+  }
+  return args;
+}
+
+// Reads the target, retrying while the build that rewrote it holds it open.
+bool read_pristine(const wchar_t* target, std::shared_ptr<const std::vector<BYTE>>* pristine) {
+  std::vector<BYTE> data;
+  for (int attempt = 1; !read_file(target, &data); ++attempt) {
+    if (attempt == kWatchReadAttempts)
+      return false;
+    Sleep(kWatchQuietMilliseconds);
+  }
+  *pristine = std::make_shared<const std::vector<BYTE>>(std::move(data));
+  return true;
+}
+
+// Writes the target as edited from |pristine|. Without |types|, or without
+// a warm |updater|, the pristine copy is loaded again and every edit
+// applied; otherwise only the resources of |types| are read again and
+// their edits applied again, in order, on top of the others.
+bool restamp(int argc, const wchar_t* argv[], const wchar_t* target,
+             const std::shared_ptr<const std::vector<BYTE>>& pristine,
+             const std::set<rescle::ResourceId>* types,
+             std::unique_ptr<rescle::ResourceUpdater>* updater) {
+  if (types == NULL || !*updater) {
+    types = NULL;
+    updater->reset(new rescle::ResourceUpdater);
+    if (!(*updater)->LoadFromMemory(pristine)) {
+      updater->reset();
+      fprintf(stderr, "Unable to load file: \"%ls\"\n", target);
+      return false;
+    }
+  } else if (!(*updater)->ReloadTypes(*types)) {
+    updater->reset();
+    print_error("Unable to reload the resources");
+    return false;
+  }
+
+  (*updater)->SelectDefaultLanguage();
+  std::vector<const wchar_t*> args = replayed_options(argc, argv, types);
+  RunState state;
+  std::vector<BYTE> output;
+  if (apply_options(static_cast<int>(args.size()), args.data(), **updater, &state,
+                    [](const wchar_t*) { return true; }) != 0 ||
+      !(*updater)->CommitToBuffer(&output)) {
+    updater->reset();  // partly edited, the next restamp starts over
+    print_error("Unable to commit changes");
+    return false;
+  }
+  if (!write_file(target, output)) {
+    print_error("Unable to write the target file");
+    return false;
+  }
+
+  if (state.print_stats)
+    print_commit_stats((*updater)->GetCommitStats(), L"");
+  return true;
+}
+
+// Stamps the target, then restamps it whenever it or one of the input
+// files changes. The target as it was before the first pass stays in
+// memory, loaded into an updater that is kept between passes. A changed
+// input only reloads the resource types its option writes and applies
+// their edits again, so an edit overridden by a later one stays
+// overridden; --import-res, which may write any type, reloads everything.
+// A rebuilt target becomes the new pristine copy and is loaded afresh.
+int watch_inputs(int argc, const wchar_t* argv[], const wchar_t* target) {
+  rescle::FileWatcher watcher;
+  std::wstring target_path = full_path(target);
+  if (!watcher.Add(target_path))
+    return print_error("Unable to watch the target file");
+
+  std::vector<WatchedInput> inputs;
+  bool imports = false;
+  for (int i = 1; i < argc; ++i) {
+    const OptionSpec* option = find_option(argv[i]);
+    if (option == NULL)
+      continue;
+    if (option->path_arg > 0) {
+      inputs.push_back({ full_path(argv[i + option->path_arg]), i });
+      if (!watcher.Add(inputs.back().path)) {
+        fprintf(stderr, "Unable to watch file: \"%ls\"\n", inputs.back().path.c_str());
+        return 1;
+      }
+    }
+    imports |= wcscmp(option->name, L"--import-res") == 0;
+    i += option->args;
+  }
+
+  std::shared_ptr<const std::vector<BYTE>> pristine;
+  std::unique_ptr<rescle::ResourceUpdater> updater;
+  if (!read_pristine(target, &pristine))
+    return print_error("Unable to load file");
+  if (!restamp(argc, argv, target, pristine, NULL, &updater))
+    return 1;
+
+  ULONGLONG stamped_size = 0;
+  ULONGLONG stamped_time = file_stamp(target_path, &stamped_size);
+  fprintf(stderr, "Watching %zu files, press Ctrl+C to stop\n", inputs.size() + 1);
+
+  std::vector<std::wstring> changed;
+  while (watcher.Wait(kWatchQuietMilliseconds, &changed)) {
+    // The stamp only moves with a successful restamp, so a rebuilt target
+    // that could not be read yet is picked up by any later change.
+    ULONGLONG size = 0;
+    bool rebuilt = file_stamp(target_path, &size) != stamped_time || size != stamped_size;
+    bool reload_all = rebuilt || imports;
+    std::set<rescle::ResourceId> types;
+    for (const auto& path : changed) {
+      for (const auto& input : inputs) {
+        if (input.path == path)
+          reload_all |= !add_edited_types(argv, input.option, &types);
+      }
+    }
+    if (!reload_all && types.empty())
+      continue;  // only our own write
+
+    ULONGLONG start = GetTickCount64();
+    if (rebuilt && !read_pristine(target, &pristine)) {
+      print_error("Unable to read the rebuilt target file");
+      continue;
+    }
+    if (restamp(argc, argv, target, pristine, reload_all ? NULL : &types, &updater)) {
+      stamped_time = file_stamp(target_path, &stamped_size);
+      fprintf(stderr, "Restamped in %llu ms\n", GetTickCount64() - start);
+    }
+  }
+  return print_error("Unable to watch the input files");
+}
+
+// Runs the options on every archive entry matching |pattern|, each with
+// its own updater, and replaces the archive once all of them succeeded.
+int edit_archive(int argc, const wchar_t* argv[], const wchar_t* target, const wchar_t* pattern) {
+  // Entries are edited in memory, one updater each, so settings about how
+  // a file is written, or that name one output for all of them, do not
+  // apply.
+  const wchar_t* rejected = find_any_option(argc, argv, {
+      L"--journal", L"--io", L"--rsrc-layout", L"--record-plan", L"--plan-slot", L"--apply-plan" });
+  if (rejected != NULL) {
+    fprintf(stderr, "%ls cannot be combined with --archive-entries\n", rejected);
+    return 1;
+  }
+
+  std::wstring temp = std::wstring(target) + L".rcedit.tmp";
+  size_t edited = 0;
+  bool succeeded = rescle::EditArchive(target, temp.c_str(), pattern,
+      [argc, argv](const std::wstring& name, std::vector<BYTE>* image) {
+    rescle::ResourceUpdater updater;
+    RunState state;
+    int status = apply_options(argc, argv, updater, &state, [&](const wchar_t*) {
+      return updater.LoadFromMemory(std::move(*image));
+    });
+    if (status != 0 || !updater.CommitToBuffer(image)) {
+      fwprintf(stderr, L"Unable to edit archive entry \"%ls\"\n", name.c_str());
+      return false;
+    }
+    if (state.print_stats)
+      print_commit_stats(updater.GetCommitStats(), name + L": ");
+    return true;
+  }, &edited);
+
+  if (!succeeded) {
+    DeleteFileW(temp.c_str());
+    return print_error("Unable to edit the archive");
+  }
+  if (!MoveFileExW(temp.c_str(), target, MOVEFILE_REPLACE_EXISTING)) {
+    DeleteFileW(temp.c_str());
+    return print_error("Unable to replace the archive");
+  }
+  if (edited == 0)
+    print_warning("No archive entry matches --archive-entries");
+  return 0;
+}
+
+// Replays a recorded plan, filling its slots from --set-version-string.
+int apply_plan(int argc, const wchar_t* argv[], const wchar_t* target, const wchar_t* path) {
+  rescle::IoBackend backend;
+  if (!io_backend_option(argc, argv, &backend))
+    return print_error("--io requires sync or overlapped");
+
+  rescle::EditPlan plan;
+  if (!rescle::ReadPlan(path, &plan))
+    return print_error("Unable to read the plan");
+
+  // The plan fixes every byte the replay writes, so the settings that shape
+  // a commit have nothing left to change.
+  const wchar_t* journal = NULL;
+  for (int i = 1; i < argc; ++i) {
+    const OptionSpec* option = find_option(argv[i]);
+    if (option == NULL)
+      continue;
+    if (wcscmp(option->name, L"--set-version-string") == 0) {
+      if (!rescle::FillPlanSlot(&plan, argv[i + 1], argv[i + 2]))
+        return 1;
+    } else if (wcscmp(option->name, L"--journal") == 0) {
+      journal = argv[i + 1];
+    } else if (!option->setting) {
+      fprintf(stderr, "%ls cannot be replayed, only --set-version-string fills plan slots\n", argv[i]);
+      return 1;
+    } else if (wcscmp(option->name, L"--apply-plan") != 0 && wcscmp(option->name, L"--io") != 0) {
+      fprintf(stderr, "%ls cannot be combined with --apply-plan\n", argv[i]);
+      return 1;
+    }
+    i += option->args;
+  }
+
+  if (!rescle::ApplyPlan(target, plan, journal, backend))
+    return print_error("Unable to apply the plan");
+  return 0;
+}
+
+// Writes one copy of |target| per row of the CSV file |path|. A row holds
+// the output path followed by options applied after those of the command
+// line. The target is read once and shared by all variants, which are
+// edited and written in parallel.
+int run_variants(int argc, const wchar_t* argv[], const wchar_t* target, const wchar_t* path) {
+  std::vector<std::vector<std::wstring>> rows;
+  if (!rescle::ParseCsvRows(rescle::ReadFileToString(path), &rows))
+    return print_error("Unable to read the variants");
+  if (rows.empty())
+    return print_error("The variants file has no rows");
+
+  // Variants are written in parallel from memory, so settings of a single
+  // commit to the target, and options of the run itself, cannot be given
+  // once for all of them or per row.
+  const std::initializer_list<const wchar_t*> kRunSettings = {
+      L"--record-plan", L"--plan-slot", L"--journal", L"--io", L"--cache-dir", L"--cache-max-size",
+      L"--cache-stats" };
+  const wchar_t* rejected = find_any_option(argc, argv, kRunSettings);
+  if (rejected != NULL) {
+    fprintf(stderr, "%ls cannot be combined with --variants\n", rejected);
+    return 1;
+  }
+
+  std::vector<std::vector<const wchar_t*>> row_args;
+  for (const auto& row : rows) {
+    std::vector<const wchar_t*> args = { argv[0] };
+    for (size_t i = 1; i < row.size(); ++i)
+      args.push_back(row[i].c_str());
+    rejected = find_any_option(static_cast<int>(args.size()), args.data(), kRunSettings);
+    if (rejected == NULL) {
+      rejected = find_any_option(static_cast<int>(args.size()), args.data(), {
+          L"--variants", L"--apply-plan", L"--revert", L"--archive-entries", L"--watch" });
+    }
+    if (rejected != NULL) {
+      fprintf(stderr, "%ls cannot be given in the row of variant \"%ls\"\n", rejected, row[0].c_str());
+      return 1;
+    }
+    row_args.push_back(std::move(args));
+  }
+
+  std::vector<BYTE> data;
+  if (!read_file(target, &data))
+    return print_error("Unable to load file");
+  auto image = std::make_shared<const std::vector<BYTE>>(std::move(data));
+
+  std::vector<std::function<bool()>> jobs;
+  for (size_t r = 0; r < rows.size(); ++r) {
+    const std::wstring& output = rows[r][0];
+    const std::vector<const wchar_t*>& extra = row_args[r];
+    jobs.push_back([argc, argv, &image, &output, &extra]() {
+      std::vector<const wchar_t*> args(argv, argv + argc);
+      args.insert(args.end(), extra.begin() + 1, extra.end());
+
+      rescle::ResourceUpdater updater;
+      RunState state;
+      int status = apply_options(static_cast<int>(args.size()), args.data(), updater, &state,
+                                 [&](const wchar_t*) { return updater.LoadFromMemory(image); });
+      bool written = false;
+      if (status == 0 && state.queries.empty() && !output.empty()) {
+        bool created = false;
+        {
+          rescle::ScopedFile file(output.c_str(), true, CREATE_ALWAYS);
+          created = file != INVALID_HANDLE_VALUE;
+          written = created && updater.CommitToStream(file);
+        }
+        if (created && !written)
+          DeleteFileW(output.c_str());
+      }
+      if (!written) {
+        fwprintf(stderr, L"Unable to write variant \"%ls\"\n", output.c_str());
+        return false;
+      }
+      if (state.print_stats)
+        print_commit_stats(updater.GetCommitStats(), output + L": ");
+      return true;
+    });
+  }
+  return rescle::RunParallel(jobs) ? 0 : 1;
+}
+
+}  // namespace
+
+int wmain(int argc, const wchar_t* argv[]) {
+  if (argc == 1 ||
+      (argc == 2 && wcscmp(argv[1], L"-h") == 0) ||
+      (argc == 2 && wcscmp(argv[1], L"--help") == 0)) {
+    UINT ignored = 0;
+    VS_FIXEDFILEINFO* file_info = nullptr;
+    std::vector<uint8_t> file_version_info = get_file_version_info();
+
+    if (file_version_info.size() == 0 || !VerQueryValueW(file_version_info.data(), L"\\", (LPVOID*) &file_info, &ignored)) {
+      return print_error("Could not determine version of rcedit");
+    }
+
+    print_help(file_info);
+    return 0;
+  }
+
+  // Serve identical runs from the output cache without loading the file.
+  const wchar_t* target = NULL;
+  const wchar_t* archive_entries = NULL;
+  CacheOptions cache_options;
+  bool read_only = false;
+  std::unique_ptr<rescle::OutputCache> cache;
+  std::wstring cache_key;
+  bool scanned = scan_arguments(argc, argv, &target, &archive_entries, &cache_options, &read_only);
+  bool watch = option_index(argc, argv, L"--watch") != 0;
+  if (watch && (!scanned || read_only || archive_entries != NULL || wcscmp(target, L"-") == 0))
+    return print_error("--watch requires a file and only edits");
+  // Each restamp would journal over the journal of the original file, and
+  // the result is written as a whole, so how a commit writes in place does
+  // not apply.
+  const wchar_t* rejected = watch ? find_any_option(argc, argv, {
+      L"--journal", L"--io", L"--rsrc-layout" }) : NULL;
+  if (rejected != NULL) {
+    fprintf(stderr, "%ls cannot be combined with --watch\n", rejected);
+    return 1;
+  }
+
+  int revert = option_index(argc, argv, L"--revert");
+  if (revert != 0) {
+    if (!scanned || wcscmp(target, L"-") == 0)
+      return print_error("--revert requires a file");
+
+    rescle::IoBackend backend;
+    if (!io_backend_option(argc, argv, &backend))
+      return print_error("--io requires sync or overlapped");
+
+    rescle::RevertJournal journal;
+    if (!rescle::ReadJournal(argv[revert + 1], &journal))
+      return print_error("Unable to read the journal");
+    if (!rescle::RevertFile(target, journal, backend))
+      return print_error("Unable to revert the file");
+    return 0;
+  }
+
+  int plan = option_index(argc, argv, L"--apply-plan");
+  if (plan != 0) {
+    if (!scanned || read_only || archive_entries != NULL || wcscmp(target, L"-") == 0)
+      return print_error("--apply-plan requires a file");
+    return apply_plan(argc, argv, target, argv[plan + 1]);
+  }
+
+  // Variants are written besides the target, which stays as it is.
+  int variants = option_index(argc, argv, L"--variants");
+  if (variants != 0) {
+    if (!scanned || read_only || watch || archive_entries != NULL || wcscmp(target, L"-") == 0)
+      return print_error("--variants requires a file and only edits");
+    return run_variants(argc, argv, target, argv[variants + 1]);
+  }
+
+  // A recorded plan or a journal is written besides the target, so it
+  // needs a real run.
+  bool record_plan = option_index(argc, argv, L"--record-plan") != 0;
+  bool journal = option_index(argc, argv, L"--journal") != 0;
+  if (scanned && cache_options.dir != NULL && !read_only && !watch && !record_plan && !journal &&
+      wcscmp(target, L"-") != 0) {
+    cache_key = compute_cache_key(argc, argv, target);
+    if (!cache_key.empty()) {
+      cache.reset(new rescle::OutputCache(cache_options.dir, cache_options.max_size));
+      if (cache->Fetch(cache_key, target)) {
+        if (cache_options.stats)
+          print_cache_stats(*cache, true);
+        return 0;
+      }
+    }
+  }
+
+  if (archive_entries != NULL) {
+    if (target == NULL || read_only || wcscmp(target, L"-") == 0)
+      return print_error("--archive-entries requires an archive file and only edits");
+
+    int status = edit_archive(argc, argv, target, archive_entries);
+    if (status == 0 && cache)
+      store_output(cache.get(), cache_key, target, cache_options.stats);
+    return status;
+  }
+
+  if (watch)
+    return watch_inputs(argc, argv, target);
+
+  int status = run_edits(argc, argv);
+  if (status != 0)
+    return status;
+
+  if (cache)
+    store_output(cache.get(), cache_key, target, cache_options.stats);
 
   return 0;
 }
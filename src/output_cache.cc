@@ -0,0 +1,231 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "output_cache.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+namespace rescle {
+
+namespace {
+
+const DWORD kReadChunkSize = 1 << 20;
+const wchar_t kEntryExtension[] = L".bin";
+const wchar_t kStatsFile[] = L"stats";
+
+struct CacheEntry {
+  ULONGLONG lastWrite;
+  ULONGLONG size;
+  std::wstring path;
+};
+
+ULONGLONG ToULongLong(const FILETIME& time) {
+  return static_cast<ULONGLONG>(time.dwHighDateTime) << 32 | time.dwLowDateTime;
+}
+
+std::vector<CacheEntry> ListEntries(const std::wstring& directory) {
+  std::vector<CacheEntry> entries;
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileW((directory + L"\\*" + kEntryExtension).c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return entries;
+
+  do {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      continue;
+    entries.push_back({ ToULongLong(data.ftLastWriteTime),
+                        static_cast<ULONGLONG>(data.nFileSizeHigh) << 32 | data.nFileSizeLow,
+                        directory + L"\\" + data.cFileName });
+  } while (FindNextFileW(find, &data));
+
+  FindClose(find);
+  return entries;
+}
+
+// Bumps the modification time so eviction treats the entry as recent.
+void Touch(const std::wstring& path) {
+  HANDLE file = CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  SetFileTime(file, NULL, NULL, &now);
+  CloseHandle(file);
+}
+
+}  // namespace
+
+Sha256::Sha256() : algorithm_(NULL), hash_(NULL), succeeded_(false) {
+  if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&algorithm_, BCRYPT_SHA256_ALGORITHM, NULL, 0)))
+    return;
+  succeeded_ = BCRYPT_SUCCESS(BCryptCreateHash(algorithm_, &hash_, NULL, 0, NULL, 0, 0));
+}
+
+Sha256::~Sha256() {
+  if (hash_ != NULL)
+    BCryptDestroyHash(hash_);
+  if (algorithm_ != NULL)
+    BCryptCloseAlgorithmProvider(algorithm_, 0);
+}
+
+bool Sha256::Update(const void* data, size_t size) {
+  const BYTE* p = static_cast<const BYTE*>(data);
+  while (succeeded_ && size > 0) {
+    ULONG chunk = static_cast<ULONG>(std::min<size_t>(size, kReadChunkSize));
+    succeeded_ = BCRYPT_SUCCESS(BCryptHashData(hash_, const_cast<BYTE*>(p), chunk, 0));
+    p += chunk;
+    size -= chunk;
+  }
+  return succeeded_;
+}
+
+bool Sha256::UpdateString(const std::wstring& value) {
+  // Include the terminator so consecutive strings stay unambiguous.
+  return Update(value.c_str(), (value.length() + 1) * sizeof(wchar_t));
+}
+
+bool Sha256::UpdateFile(const WCHAR* path) {
+  HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    succeeded_ = false;
+    return false;
+  }
+
+  std::vector<BYTE> buffer(kReadChunkSize);
+  DWORD read = 0;
+  while (succeeded_) {
+    if (!ReadFile(file, buffer.data(), kReadChunkSize, &read, NULL)) {
+      succeeded_ = false;
+      break;
+    }
+    if (read == 0)
+      break;
+    Update(buffer.data(), read);
+  }
+
+  CloseHandle(file);
+  return succeeded_;
+}
+
+std::wstring Sha256::Finish() {
+  BYTE digest[32];
+  if (!succeeded_ || !BCRYPT_SUCCESS(BCryptFinishHash(hash_, digest, sizeof(digest), 0)))
+    return std::wstring();
+
+  static const wchar_t kHex[] = L"0123456789abcdef";
+  std::wstring hex;
+  for (BYTE b : digest) {
+    hex += kHex[b >> 4];
+    hex += kHex[b & 0xf];
+  }
+  return hex;
+}
+
+OutputCache::OutputCache(const WCHAR* directory, ULONGLONG maxBytes)
+    : directory_(directory), maxBytes_(maxBytes) {
+  CreateDirectoryW(directory_.c_str(), NULL);
+}
+
+bool OutputCache::Fetch(const std::wstring& key, const WCHAR* target) {
+  std::wstring entry = EntryPath(key);
+  if (GetFileAttributesW(entry.c_str()) == INVALID_FILE_ATTRIBUTES) {
+    RecordLookup(false);
+    return false;
+  }
+
+  // Hits are always copied, a hardlink would let in-place commits, reverts
+  // and restamps of the output write into the entry. CopyFileW clones the
+  // blocks on file systems that support it.
+  bool materialized = CopyFileW(entry.c_str(), target, FALSE) != FALSE;
+
+  if (materialized)
+    Touch(entry);
+  RecordLookup(materialized);
+  return materialized;
+}
+
+bool OutputCache::Store(const std::wstring& key, const WCHAR* source) {
+  // Copy next to the entry and rename, so concurrent readers never see a
+  // partial file.
+  std::wstring entry = EntryPath(key);
+  std::wstring temporary = entry + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+  if (!CopyFileW(source, temporary.c_str(), FALSE))
+    return false;
+
+  if (!MoveFileExW(temporary.c_str(), entry.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    DeleteFileW(temporary.c_str());
+    return false;
+  }
+
+  Touch(entry);
+  Evict();
+  return true;
+}
+
+OutputCacheStats OutputCache::GetStats() const {
+  OutputCacheStats stats;
+  ReadCounters(&stats);
+  for (const auto& entry : ListEntries(directory_)) {
+    ++stats.entries;
+    stats.bytes += entry.size;
+  }
+  return stats;
+}
+
+std::wstring OutputCache::EntryPath(const std::wstring& key) const {
+  return directory_ + L"\\" + key + kEntryExtension;
+}
+
+void OutputCache::ReadCounters(OutputCacheStats* stats) const {
+  FILE* file = _wfopen((directory_ + L"\\" + kStatsFile).c_str(), L"r");
+  if (file != NULL) {
+    if (fscanf(file, "%llu %llu", &stats->hits, &stats->misses) != 2)
+      stats->hits = stats->misses = 0;
+    fclose(file);
+  }
+}
+
+void OutputCache::RecordLookup(bool hit) {
+  // Best effort, concurrent runs may lose an increment.
+  OutputCacheStats stats;
+  ReadCounters(&stats);
+  if (hit)
+    ++stats.hits;
+  else
+    ++stats.misses;
+
+  FILE* file = _wfopen((directory_ + L"\\" + kStatsFile).c_str(), L"w");
+  if (file != NULL) {
+    fprintf(file, "%llu %llu\n", stats.hits, stats.misses);
+    fclose(file);
+  }
+}
+
+void OutputCache::Evict() {
+  if (maxBytes_ == 0)
+    return;
+
+  std::vector<CacheEntry> entries = ListEntries(directory_);
+  ULONGLONG total = 0;
+  for (const auto& entry : entries)
+    total += entry.size;
+
+  // Drop the least recently used entries first.
+  std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+    return a.lastWrite < b.lastWrite;
+  });
+  for (const auto& entry : entries) {
+    if (total <= maxBytes_)
+      break;
+    if (DeleteFileW(entry.path.c_str()))
+      total -= entry.size;
+  }
+}
+
+}  // namespace rescle
@@ -0,0 +1,64 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef OUTPUT_CACHE_H
+#define OUTPUT_CACHE_H
+
+#include <string>
+
+#include <windows.h>
+#include <bcrypt.h>
+
+namespace rescle {
+
+// Incremental SHA-256, hex encoded by Finish().
+class Sha256 {
+ public:
+  Sha256();
+  ~Sha256();
+
+  bool Update(const void* data, size_t size);
+  bool UpdateString(const std::wstring& value);
+  bool UpdateFile(const WCHAR* path);
+  std::wstring Finish();
+
+ private:
+  BCRYPT_ALG_HANDLE algorithm_;
+  BCRYPT_HASH_HANDLE hash_;
+  bool succeeded_;
+};
+
+struct OutputCacheStats {
+  ULONGLONG hits = 0;
+  ULONGLONG misses = 0;
+  ULONGLONG entries = 0;
+  ULONGLONG bytes = 0;
+};
+
+// On-disk cache of rcedit outputs keyed by a hash of the input file and of
+// the options applied to it.
+class OutputCache {
+ public:
+  // |maxBytes| of 0 leaves the cache unbounded.
+  OutputCache(const WCHAR* directory, ULONGLONG maxBytes);
+
+  // Replaces |target| with the cached output for |key|, returns false on a
+  // miss.
+  bool Fetch(const std::wstring& key, const WCHAR* target);
+  bool Store(const std::wstring& key, const WCHAR* source);
+  OutputCacheStats GetStats() const;
+
+ private:
+  std::wstring EntryPath(const std::wstring& key) const;
+  void ReadCounters(OutputCacheStats* stats) const;
+  void RecordLookup(bool hit);
+  void Evict();
+
+  std::wstring directory_;
+  ULONGLONG maxBytes_;
+};
+
+}  // namespace rescle
+
+#endif  // OUTPUT_CACHE_H
@@ -0,0 +1,34 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace rescle {
+
+bool RunParallel(const std::vector<std::function<bool()>>& jobs) {
+  size_t workers = std::min<size_t>(std::thread::hardware_concurrency(), jobs.size());
+  std::atomic<size_t> next(0);
+  std::atomic<bool> succeeded(true);
+  auto work = [&]() {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      if (!jobs[i]())
+        succeeded = false;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; ++i)
+    threads.emplace_back(work);
+  work();
+  for (auto& thread : threads)
+    thread.join();
+
+  return succeeded;
+}
+
+}  // namespace rescle
@@ -0,0 +1,19 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+#include <vector>
+
+namespace rescle {
+
+// Runs the jobs on all available cores and returns false if any of them
+// failed. Each job must only write to state owned by that job.
+bool RunParallel(const std::vector<std::function<bool()>>& jobs);
+
+}  // namespace rescle
+
+#endif  // PARALLEL_H
@@ -0,0 +1,726 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "pe_image.h"
+
+#include <string.h>
+#include <wctype.h>
+#include <algorithm>
+
+#include "record.h"
+
+namespace rescle {
+
+namespace {
+
+const DWORD kResourceAlignment = 8;
+
+template<typename T>
+inline T Align(T value, DWORD alignment) {
+  if (alignment == 0)
+    return value;
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+template<typename T>
+bool ReadAt(const BYTE* data, size_t size, size_t offset, T* out) {
+  if (offset > size || size - offset < sizeof(T))
+    return false;
+  memcpy(out, data + offset, sizeof(T));
+  return true;
+}
+
+template<typename T>
+void WriteAt(BYTE* data, size_t offset, const T& value) {
+  memcpy(data + offset, &value, sizeof(T));
+}
+
+DWORD SectionVirtualSize(const IMAGE_SECTION_HEADER& section) {
+  return section.Misc.VirtualSize != 0 ? section.Misc.VirtualSize
+                                       : section.SizeOfRawData;
+}
+
+// Sums the image as little-endian 16-bit words, the way the PE checksum
+// does, across any number of consecutive chunks.
+class ChecksumAccumulator {
+ public:
+  void Add(const BYTE* p, size_t n) {
+    size_t i = 0;
+    if (odd_ && n > 0) {
+      AddWord(static_cast<DWORD>(low_) | static_cast<DWORD>(p[0]) << 8);
+      odd_ = false;
+      i = 1;
+    }
+    for (; i + 1 < n; i += 2)
+      AddWord(static_cast<DWORD>(p[i]) | static_cast<DWORD>(p[i + 1]) << 8);
+    if (i < n) {
+      low_ = p[i];
+      odd_ = true;
+    }
+  }
+
+  void AddZeros(ULONGLONG n) {
+    // Zero words do not change the sum, only the pairing of the bytes.
+    if (n == 0)
+      return;
+    if (odd_) {
+      AddWord(low_);
+      odd_ = false;
+      --n;
+    }
+    if (n % 2 == 1) {
+      low_ = 0;
+      odd_ = true;
+    }
+  }
+
+  DWORD Finish(ULONGLONG size) {
+    if (odd_)
+      AddWord(low_);
+    sum_ = (sum_ & 0xffff) + (sum_ >> 16);
+    return static_cast<DWORD>(sum_ + size);
+  }
+
+ private:
+  void AddWord(DWORD word) {
+    sum_ += word;
+    sum_ = (sum_ & 0xffff) + (sum_ >> 16);
+  }
+
+  ULONGLONG sum_ = 0;
+  BYTE low_ = 0;
+  bool odd_ = false;
+};
+
+// Lays out a resource section the way linkers do: the three directory
+// levels first, then the data entries, the name strings and the payloads.
+class ResourceSectionWriter {
+ public:
+  explicit ResourceSectionWriter(const ResourceTable& table);
+
+  size_t size() const { return size_; }
+  void Write(DWORD rva, const IMAGE_RESOURCE_DIRECTORY& prototype, BYTE* out) const;
+
+ private:
+  struct Language {
+    LANGID langId;
+    const ResourceData* data;
+    size_t dataEntryOffset;
+    size_t dataOffset;
+  };
+
+  struct Name {
+    ResourceId id;
+    size_t directoryOffset;
+    size_t stringOffset;
+    std::vector<Language> languages;
+  };
+
+  struct Type {
+    ResourceId id;
+    size_t directoryOffset;
+    size_t stringOffset;
+    std::vector<Name> names;
+  };
+
+  template<typename T>
+  static void WriteDirectory(const std::vector<T>& children, size_t offset,
+                             const IMAGE_RESOURCE_DIRECTORY& prototype, BYTE* out);
+  static void WriteString(const ResourceId& id, size_t offset, BYTE* out);
+
+  std::vector<Type> types_;
+  size_t size_;
+};
+
+ResourceSectionWriter::ResourceSectionWriter(const ResourceTable& table) {
+  // The table is already sorted by type, name and language.
+  for (const auto& i : table) {
+    if (types_.empty() || !(types_.back().id == i.first.type))
+      types_.push_back({ i.first.type });
+    auto& names = types_.back().names;
+    if (names.empty() || !(names.back().id == i.first.name))
+      names.push_back({ i.first.name });
+    names.back().languages.push_back({ i.first.langId, &i.second });
+  }
+
+  size_t offset = sizeof(IMAGE_RESOURCE_DIRECTORY) + types_.size() * sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY);
+  for (auto& type : types_) {
+    type.directoryOffset = offset;
+    offset += sizeof(IMAGE_RESOURCE_DIRECTORY) + type.names.size() * sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY);
+  }
+  for (auto& type : types_) {
+    for (auto& name : type.names) {
+      name.directoryOffset = offset;
+      offset += sizeof(IMAGE_RESOURCE_DIRECTORY) + name.languages.size() * sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY);
+    }
+  }
+  for (auto& type : types_) {
+    for (auto& name : type.names) {
+      for (auto& language : name.languages) {
+        language.dataEntryOffset = offset;
+        offset += sizeof(IMAGE_RESOURCE_DATA_ENTRY);
+      }
+    }
+  }
+  for (auto& type : types_) {
+    if (!type.id.IsId()) {
+      type.stringOffset = offset;
+      offset += sizeof(WORD) + type.id.name.length() * sizeof(WORD);
+    }
+  }
+  for (auto& type : types_) {
+    for (auto& name : type.names) {
+      if (!name.id.IsId()) {
+        name.stringOffset = offset;
+        offset += sizeof(WORD) + name.id.name.length() * sizeof(WORD);
+      }
+    }
+  }
+  offset = Align(offset, kResourceAlignment);
+  for (auto& type : types_) {
+    for (auto& name : type.names) {
+      for (auto& language : name.languages) {
+        language.dataOffset = offset;
+        offset = Align(offset + language.data->size, kResourceAlignment);
+      }
+    }
+  }
+  size_ = offset;
+}
+
+template<typename T>
+void ResourceSectionWriter::WriteDirectory(const std::vector<T>& children, size_t offset,
+                                           const IMAGE_RESOURCE_DIRECTORY& prototype, BYTE* out) {
+  IMAGE_RESOURCE_DIRECTORY directory = prototype;
+  for (const auto& child : children) {
+    if (child.id.IsId())
+      ++directory.NumberOfIdEntries;
+    else
+      ++directory.NumberOfNamedEntries;
+  }
+  WriteAt(out, offset, directory);
+  offset += sizeof(directory);
+
+  for (const auto& child : children) {
+    IMAGE_RESOURCE_DIRECTORY_ENTRY entry;
+    entry.Name = child.id.IsId() ? child.id.id
+                                 : static_cast<DWORD>(child.stringOffset) | IMAGE_RESOURCE_NAME_IS_STRING;
+    entry.OffsetToData = static_cast<DWORD>(child.directoryOffset) | IMAGE_RESOURCE_DATA_IS_DIRECTORY;
+    WriteAt(out, offset, entry);
+    offset += sizeof(entry);
+  }
+}
+
+void ResourceSectionWriter::WriteString(const ResourceId& id, size_t offset, BYTE* out) {
+  WriteAt(out, offset, static_cast<WORD>(id.name.length()));
+  offset += sizeof(WORD);
+  for (wchar_t c : id.name) {
+    WriteAt(out, offset, static_cast<WORD>(c));
+    offset += sizeof(WORD);
+  }
+}
+
+void ResourceSectionWriter::Write(DWORD rva, const IMAGE_RESOURCE_DIRECTORY& prototype, BYTE* out) const {
+  memset(out, 0, size_);
+
+  WriteDirectory(types_, 0, prototype, out);
+  for (const auto& type : types_) {
+    WriteDirectory(type.names, type.directoryOffset, prototype, out);
+    if (!type.id.IsId())
+      WriteString(type.id, type.stringOffset, out);
+
+    for (const auto& name : type.names) {
+      if (!name.id.IsId())
+        WriteString(name.id, name.stringOffset, out);
+
+      IMAGE_RESOURCE_DIRECTORY directory = prototype;
+      directory.NumberOfIdEntries = static_cast<WORD>(name.languages.size());
+      WriteAt(out, name.directoryOffset, directory);
+
+      size_t offset = name.directoryOffset + sizeof(directory);
+      for (const auto& language : name.languages) {
+        IMAGE_RESOURCE_DIRECTORY_ENTRY entry;
+        entry.Name = language.langId;
+        entry.OffsetToData = static_cast<DWORD>(language.dataEntryOffset);
+        WriteAt(out, offset, entry);
+        offset += sizeof(entry);
+
+        IMAGE_RESOURCE_DATA_ENTRY dataEntry = { 0 };
+        dataEntry.OffsetToData = rva + static_cast<DWORD>(language.dataOffset);
+        dataEntry.Size = static_cast<DWORD>(language.data->size);
+        dataEntry.CodePage = language.data->codePage;
+        WriteAt(out, language.dataEntryOffset, dataEntry);
+
+        if (language.data->size > 0)
+          memcpy(out + language.dataOffset, language.data->data, language.data->size);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+ResourceId::ResourceId(LPCWSTR value) {
+  if (IS_INTRESOURCE(value))
+    id = static_cast<WORD>(reinterpret_cast<ULONG_PTR>(value));
+  else
+    name = value;
+}
+
+bool operator<(const ResourceId& a, const ResourceId& b) {
+  if (a.IsId() != b.IsId())
+    return !a.IsId();
+  if (a.IsId())
+    return a.id < b.id;
+
+  size_t length = std::min(a.name.length(), b.name.length());
+  for (size_t i = 0; i < length; ++i) {
+    wint_t ca = towupper(a.name[i]);
+    wint_t cb = towupper(b.name[i]);
+    if (ca != cb)
+      return ca < cb;
+  }
+  if (a.name.length() != b.name.length())
+    return a.name.length() < b.name.length();
+  return a.name < b.name;
+}
+
+bool operator==(const ResourceId& a, const ResourceId& b) {
+  return a.id == b.id && a.name == b.name;
+}
+
+bool operator<(const ResourceKey& a, const ResourceKey& b) {
+  if (a.type < b.type)
+    return true;
+  if (b.type < a.type)
+    return false;
+  if (a.name < b.name)
+    return true;
+  if (b.name < a.name)
+    return false;
+  return a.langId < b.langId;
+}
+
+PEImage::PEImage()
+    : data_(nullptr),
+      size_(0),
+      optionalHeaderOffset_(0),
+      sectionTableOffset_(0),
+      is64_(false),
+      fileAlignment_(0),
+      sectionAlignment_(0),
+      sizeOfHeaders_(0),
+      checkSum_(0),
+      resourceDirectory_({ 0, 0 }),
+      securityDirectory_({ 0, 0 }),
+      resourceDirectoryOffset_(0) {
+}
+
+bool PEImage::Parse(const BYTE* data, size_t size) {
+  data_ = data;
+  size_ = size;
+
+  IMAGE_DOS_HEADER dosHeader;
+  if (!ReadAt(data_, size_, 0, &dosHeader) || dosHeader.e_magic != IMAGE_DOS_SIGNATURE)
+    return false;
+
+  size_t ntHeadersOffset = static_cast<DWORD>(dosHeader.e_lfanew);
+  DWORD signature;
+  IMAGE_FILE_HEADER fileHeader;
+  if (!ReadAt(data_, size_, ntHeadersOffset, &signature) || signature != IMAGE_NT_SIGNATURE ||
+      !ReadAt(data_, size_, ntHeadersOffset + sizeof(signature), &fileHeader))
+    return false;
+
+  optionalHeaderOffset_ = ntHeadersOffset + sizeof(signature) + sizeof(fileHeader);
+  sectionTableOffset_ = optionalHeaderOffset_ + fileHeader.SizeOfOptionalHeader;
+
+  WORD magic;
+  if (!ReadAt(data_, size_, optionalHeaderOffset_, &magic))
+    return false;
+
+  DWORD numberOfRvaAndSizes;
+  const IMAGE_DATA_DIRECTORY* dataDirectory;
+  IMAGE_OPTIONAL_HEADER32 optionalHeader32;
+  IMAGE_OPTIONAL_HEADER64 optionalHeader64;
+  if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+    if (fileHeader.SizeOfOptionalHeader < sizeof(optionalHeader32) ||
+        !ReadAt(data_, size_, optionalHeaderOffset_, &optionalHeader32))
+      return false;
+    is64_ = false;
+    fileAlignment_ = optionalHeader32.FileAlignment;
+    sectionAlignment_ = optionalHeader32.SectionAlignment;
+    sizeOfHeaders_ = optionalHeader32.SizeOfHeaders;
+    checkSum_ = optionalHeader32.CheckSum;
+    numberOfRvaAndSizes = optionalHeader32.NumberOfRvaAndSizes;
+    dataDirectory = optionalHeader32.DataDirectory;
+  } else if (magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+    if (fileHeader.SizeOfOptionalHeader < sizeof(optionalHeader64) ||
+        !ReadAt(data_, size_, optionalHeaderOffset_, &optionalHeader64))
+      return false;
+    is64_ = true;
+    fileAlignment_ = optionalHeader64.FileAlignment;
+    sectionAlignment_ = optionalHeader64.SectionAlignment;
+    sizeOfHeaders_ = optionalHeader64.SizeOfHeaders;
+    checkSum_ = optionalHeader64.CheckSum;
+    numberOfRvaAndSizes = optionalHeader64.NumberOfRvaAndSizes;
+    dataDirectory = optionalHeader64.DataDirectory;
+  } else {
+    return false;
+  }
+
+  if (numberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_SECURITY ||
+      sizeOfHeaders_ > size_ ||
+      sectionTableOffset_ + fileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER) > sizeOfHeaders_)
+    return false;
+
+  sections_.resize(fileHeader.NumberOfSections);
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    if (!ReadAt(data_, size_, sectionTableOffset_ + i * sizeof(IMAGE_SECTION_HEADER), &sections_[i]))
+      return false;
+  }
+
+  resourceDirectory_ = dataDirectory[IMAGE_DIRECTORY_ENTRY_RESOURCE];
+  securityDirectory_ = dataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
+  if (resourceDirectory_.VirtualAddress != 0 &&
+      !RvaToOffset(resourceDirectory_.VirtualAddress, sizeof(IMAGE_RESOURCE_DIRECTORY), &resourceDirectoryOffset_))
+    return false;
+
+  return true;
+}
+
+bool PEImage::ReadResources(ResourceTable* table) const {
+  if (resourceDirectory_.VirtualAddress == 0)
+    return true;
+
+  ResourceKey key;
+  std::set<size_t> visited;
+  return ReadResourceDirectory(0, 0, &key, table, &visited);
+}
+
+bool PEImage::GetResourceTimestamp(DWORD* timestamp) const {
+  IMAGE_RESOURCE_DIRECTORY root;
+  if (resourceDirectory_.VirtualAddress == 0 || !ReadAt(data_, size_, resourceDirectoryOffset_, &root))
+    return false;
+  *timestamp = root.TimeDateStamp;
+  return true;
+}
+
+bool PEImage::GetChecksumOffset(size_t* offset) const {
+  if (checkSum_ == 0)
+    return false;
+  *offset = optionalHeaderOffset_ + (is64_ ? offsetof(IMAGE_OPTIONAL_HEADER64, CheckSum)
+                                           : offsetof(IMAGE_OPTIONAL_HEADER32, CheckSum));
+  return true;
+}
+
+ULONGLONG PEImage::GetOverlayOffset() const {
+  ULONGLONG end = sizeOfHeaders_;
+  for (const auto& section : sections_) {
+    if (section.SizeOfRawData > 0)
+      end = std::max<ULONGLONG>(end, static_cast<ULONGLONG>(section.PointerToRawData) + section.SizeOfRawData);
+  }
+  return end;
+}
+
+const IMAGE_SECTION_HEADER* PEImage::FindSection(DWORD rva) const {
+  for (const auto& section : sections_) {
+    if (rva >= section.VirtualAddress && rva - section.VirtualAddress < SectionVirtualSize(section))
+      return &section;
+  }
+  return nullptr;
+}
+
+bool PEImage::RvaToOffset(DWORD rva, DWORD size, size_t* offset) const {
+  const IMAGE_SECTION_HEADER* section = FindSection(rva);
+  if (section == nullptr)
+    return false;
+
+  DWORD delta = rva - section->VirtualAddress;
+  if (delta > section->SizeOfRawData || section->SizeOfRawData - delta < size)
+    return false;
+
+  *offset = static_cast<size_t>(section->PointerToRawData) + delta;
+  return *offset <= size_ && size_ - *offset >= size;
+}
+
+bool PEImage::ReadResourceString(DWORD offset, std::wstring* value) const {
+  ByteSpan resources = ByteSpan(data_, size_).Subspan(resourceDirectoryOffset_);
+  if (!resources.Contains(offset, sizeof(WORD)))
+    return false;
+
+  WORD length = LoadLittleEndian<WORD>(resources.data() + offset);
+  return length != 0 && resources.ReadString(offset + sizeof(WORD), length, value);
+}
+
+bool PEImage::ReadResourceDirectory(size_t offset, int level, ResourceKey* key, ResourceTable* table,
+                                    std::set<size_t>* visited) const {
+  // Linkers give every directory its own entry. One reached twice would
+  // have its whole subtree read again for each entry pointing to it, a
+  // crafted section could make that cubic in its size.
+  if (!visited->insert(offset).second)
+    return false;
+
+  ByteSpan resources = ByteSpan(data_, size_).Subspan(resourceDirectoryOffset_);
+  RecordView<ResourceDirectoryLayout> directory(resources.Subspan(offset));
+  if (!directory.valid())
+    return false;
+
+  size_t count = static_cast<size_t>(directory.Get<ResourceDirectoryLayout::NumberOfNamedEntries>()) +
+                 directory.Get<ResourceDirectoryLayout::NumberOfIdEntries>();
+  for (size_t i = 0; i < count; ++i) {
+    RecordView<ResourceDirectoryEntryLayout> entry(
+        directory.tail().Subspan(i * ResourceDirectoryEntryLayout::kSize));
+    if (!entry.valid())
+      return false;
+
+    DWORD name = entry.Get<ResourceDirectoryEntryLayout::Name>();
+    ResourceId id;
+    if (name & IMAGE_RESOURCE_NAME_IS_STRING) {
+      if (level == 2 || !ReadResourceString(name & ~IMAGE_RESOURCE_NAME_IS_STRING, &id.name))
+        return false;
+    } else {
+      id.id = LOWORD(name);
+    }
+
+    DWORD offsetToData = entry.Get<ResourceDirectoryEntryLayout::OffsetToData>();
+    bool isDirectory = (offsetToData & IMAGE_RESOURCE_DATA_IS_DIRECTORY) != 0;
+    DWORD childOffset = offsetToData & ~IMAGE_RESOURCE_DATA_IS_DIRECTORY;
+    if (level < 2) {
+      if (!isDirectory)
+        return false;
+
+      if (level == 0)
+        key->type = id;
+      else
+        key->name = id;
+
+      if (!ReadResourceDirectory(childOffset, level + 1, key, table, visited))
+        return false;
+    } else {
+      RecordView<ResourceDataEntryLayout> dataEntry(resources.Subspan(childOffset));
+      if (isDirectory || !dataEntry.valid())
+        return false;
+
+      DWORD dataSize = dataEntry.Get<ResourceDataEntryLayout::Size>();
+      size_t dataOffset;
+      if (!RvaToOffset(dataEntry.Get<ResourceDataEntryLayout::OffsetToData>(), dataSize, &dataOffset))
+        return false;
+
+      key->langId = id.id;
+      ResourceData& resource = (*table)[*key];
+      resource.data = data_ + dataOffset;
+      resource.size = dataSize;
+      resource.codePage = dataEntry.Get<ResourceDataEntryLayout::CodePage>();
+    }
+  }
+
+  return true;
+}
+
+PEImage::Placement PEImage::PlanResources(const ResourceTable& table, bool allowRelocate,
+                                          const DWORD* timestamp, std::vector<FilePatch>* patches, FileMove* overlay,
+                                          ULONGLONG* newSize) const {
+  ResourceSectionWriter writer(table);
+  if (writer.size() > 0x7fffffff)
+    return Placement::kNone;
+  DWORD sectionSize = static_cast<DWORD>(writer.size());
+
+  ULONGLONG overlayOffset = GetOverlayOffset();
+  bool hasOverlay = overlayOffset < size_;
+
+  DWORD imageEnd = sizeOfHeaders_;
+  for (const auto& section : sections_)
+    imageEnd = std::max(imageEnd, section.VirtualAddress + SectionVirtualSize(section));
+
+  Placement placement = Placement::kNone;
+  size_t sectionIndex = sections_.size();
+  IMAGE_SECTION_HEADER header = { 0 };
+  DWORD oldRawSize = 0;
+
+  const IMAGE_SECTION_HEADER* current = resourceDirectory_.VirtualAddress != 0
+      ? FindSection(resourceDirectory_.VirtualAddress) : nullptr;
+  if (current != nullptr && current->VirtualAddress == resourceDirectory_.VirtualAddress) {
+    // The section may grow up to the next section in memory.
+    ULONGLONG virtualLimit = ~0ULL;
+    for (const auto& section : sections_) {
+      if (section.VirtualAddress > current->VirtualAddress)
+        virtualLimit = std::min<ULONGLONG>(virtualLimit, section.VirtualAddress);
+    }
+    bool lastInImage = virtualLimit == ~0ULL;
+    bool lastInFile = static_cast<ULONGLONG>(current->PointerToRawData) + current->SizeOfRawData == overlayOffset;
+
+    sectionIndex = current - sections_.data();
+    header = *current;
+    oldRawSize = current->SizeOfRawData;
+    if (sectionSize <= current->SizeOfRawData &&
+        static_cast<ULONGLONG>(current->VirtualAddress) + sectionSize <= virtualLimit) {
+      placement = Placement::kInPlace;
+    } else if (lastInImage && lastInFile) {
+      placement = Placement::kGrow;
+      header.SizeOfRawData = Align(sectionSize, fileAlignment_);
+    }
+  }
+
+  if (placement == Placement::kNone && allowRelocate) {
+    // A new section needs a free, zeroed slot at the end of the section table.
+    size_t slot = sectionTableOffset_ + sections_.size() * sizeof(IMAGE_SECTION_HEADER);
+    size_t headersEnd = sizeOfHeaders_;
+    for (const auto& section : sections_) {
+      if (section.SizeOfRawData > 0)
+        headersEnd = std::min<size_t>(headersEnd, section.PointerToRawData);
+    }
+
+    if (slot + sizeof(IMAGE_SECTION_HEADER) <= headersEnd &&
+        std::all_of(data_ + slot, data_ + slot + sizeof(IMAGE_SECTION_HEADER), [](BYTE b) { return b == 0; })) {
+      placement = Placement::kRelocate;
+      sectionIndex = sections_.size();
+      header = IMAGE_SECTION_HEADER();
+      memcpy(header.Name, ".rsrc", 5);
+      header.Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ;
+      header.VirtualAddress = Align(imageEnd, sectionAlignment_);
+      header.PointerToRawData = static_cast<DWORD>(Align(overlayOffset, fileAlignment_));
+      header.SizeOfRawData = Align(sectionSize, fileAlignment_);
+      oldRawSize = 0;
+    }
+  }
+
+  if (placement == Placement::kNone)
+    return placement;
+
+  header.Misc.VirtualSize = sectionSize;
+
+  // A section that grows or moves to the end pushes the overlay back. The
+  // offset moves by a multiple of 8 to keep the certificate table aligned.
+  ULONGLONG sectionEnd = static_cast<ULONGLONG>(header.PointerToRawData) + header.SizeOfRawData;
+  overlay->from = overlayOffset;
+  overlay->to = overlayOffset;
+  overlay->size = hasOverlay ? size_ - overlayOffset : 0;
+  if (placement != Placement::kInPlace)
+    overlay->to = hasOverlay ? overlayOffset + Align(sectionEnd - overlayOffset, 8) : sectionEnd;
+
+  // Every directory keeps the timestamp and version of the old root.
+  IMAGE_RESOURCE_DIRECTORY prototype = { 0 };
+  if (resourceDirectory_.VirtualAddress != 0)
+    ReadAt(data_, size_, resourceDirectoryOffset_, &prototype);
+  prototype.NumberOfNamedEntries = 0;
+  prototype.NumberOfIdEntries = 0;
+  if (timestamp != nullptr)
+    prototype.TimeDateStamp = *timestamp;
+
+  // The section, padded with zeros to its raw size. A relocated section
+  // also carries the padding between the old end of file and itself, and a
+  // section followed by a moved overlay the padding up to the overlay.
+  ULONGLONG sectionStart = placement == Placement::kRelocate ? overlayOffset : header.PointerToRawData;
+  ULONGLONG patchEnd = placement == Placement::kInPlace ? sectionEnd : overlay->to;
+  FilePatch section;
+  section.offset = sectionStart;
+  section.bytes.resize(static_cast<size_t>(patchEnd - sectionStart));
+  writer.Write(header.VirtualAddress, prototype,
+               section.bytes.data() + (header.PointerToRawData - sectionStart));
+
+  // The headers with the new section header and directory.
+  FilePatch headers;
+  headers.offset = 0;
+  headers.bytes.assign(data_, data_ + sizeOfHeaders_);
+  BYTE* p = headers.bytes.data();
+
+  size_t fileHeaderOffset = optionalHeaderOffset_ - sizeof(IMAGE_FILE_HEADER);
+  if (placement == Placement::kRelocate) {
+    WORD numberOfSections = static_cast<WORD>(sections_.size() + 1);
+    WriteAt(p, fileHeaderOffset + offsetof(IMAGE_FILE_HEADER, NumberOfSections), numberOfSections);
+
+    // Rename the abandoned section so tools looking up .rsrc by name find
+    // the new one.
+    if (current != nullptr && memcmp(current->Name, ".rsrc", 6) == 0) {
+      IMAGE_SECTION_HEADER old = *current;
+      memcpy(old.Name, ".oldrsrc", IMAGE_SIZEOF_SHORT_NAME);
+      WriteAt(p, sectionTableOffset_ + (current - sections_.data()) * sizeof(IMAGE_SECTION_HEADER), old);
+    }
+  }
+  WriteAt(p, sectionTableOffset_ + sectionIndex * sizeof(IMAGE_SECTION_HEADER), header);
+
+  size_t sizeOfImageOffset = optionalHeaderOffset_ + (is64_ ? offsetof(IMAGE_OPTIONAL_HEADER64, SizeOfImage)
+                                                            : offsetof(IMAGE_OPTIONAL_HEADER32, SizeOfImage));
+  size_t sizeOfInitializedDataOffset = optionalHeaderOffset_ + (is64_ ? offsetof(IMAGE_OPTIONAL_HEADER64, SizeOfInitializedData)
+                                                                      : offsetof(IMAGE_OPTIONAL_HEADER32, SizeOfInitializedData));
+  size_t resourceDirectoryOffset = optionalHeaderOffset_ +
+      (is64_ ? offsetof(IMAGE_OPTIONAL_HEADER64, DataDirectory) : offsetof(IMAGE_OPTIONAL_HEADER32, DataDirectory)) +
+      IMAGE_DIRECTORY_ENTRY_RESOURCE * sizeof(IMAGE_DATA_DIRECTORY);
+
+  DWORD sizeOfImage;
+  memcpy(&sizeOfImage, p + sizeOfImageOffset, sizeof(sizeOfImage));
+  sizeOfImage = std::max(sizeOfImage, Align(header.VirtualAddress + sectionSize, sectionAlignment_));
+  WriteAt(p, sizeOfImageOffset, sizeOfImage);
+
+  DWORD sizeOfInitializedData;
+  memcpy(&sizeOfInitializedData, p + sizeOfInitializedDataOffset, sizeof(sizeOfInitializedData));
+  sizeOfInitializedData += header.SizeOfRawData - oldRawSize;
+  WriteAt(p, sizeOfInitializedDataOffset, sizeOfInitializedData);
+
+  IMAGE_DATA_DIRECTORY directory = { header.VirtualAddress, sectionSize };
+  WriteAt(p, resourceDirectoryOffset, directory);
+
+  // The certificate table is addressed by file offset, so it follows the
+  // overlay. Changing the resources invalidates the signature anyway, but
+  // the table stays intact for tools that strip or replace it.
+  if (securityDirectory_.VirtualAddress >= overlayOffset && securityDirectory_.Size > 0 &&
+      overlay->to != overlay->from) {
+    ULONGLONG offset = securityDirectory_.VirtualAddress + (overlay->to - overlay->from);
+    if (offset > MAXDWORD)
+      return Placement::kNone;
+    IMAGE_DATA_DIRECTORY security = { static_cast<DWORD>(offset), securityDirectory_.Size };
+    WriteAt(p, resourceDirectoryOffset + (IMAGE_DIRECTORY_ENTRY_SECURITY - IMAGE_DIRECTORY_ENTRY_RESOURCE) *
+               sizeof(IMAGE_DATA_DIRECTORY), security);
+  }
+
+  *newSize = placement == Placement::kInPlace ? size_ : overlay->to + overlay->size;
+
+  patches->clear();
+  patches->push_back(std::move(headers));
+  patches->push_back(std::move(section));
+
+  // Only keep the checksum valid when the image had one.
+  size_t checkSumOffset;
+  if (GetChecksumOffset(&checkSumOffset)) {
+    WriteAt((*patches)[0].bytes.data(), checkSumOffset, static_cast<DWORD>(0));
+    WriteAt((*patches)[0].bytes.data(), checkSumOffset, ComputeChecksum(*patches, *overlay, *newSize));
+  }
+
+  return placement;
+}
+
+DWORD PEImage::ComputeChecksum(const std::vector<FilePatch>& patches, const FileMove& overlay,
+                               ULONGLONG size) const {
+  // |patches| are sorted, do not overlap and end before a moved overlay, the
+  // rest comes from the image.
+  ChecksumAccumulator accumulator;
+  ULONGLONG position = 0;
+  auto addImage = [&](ULONGLONG end) {
+    ULONGLONG imageEnd = std::min<ULONGLONG>(end, size_);
+    if (position < imageEnd) {
+      accumulator.Add(data_ + position, static_cast<size_t>(imageEnd - position));
+      position = imageEnd;
+    }
+    if (position < end) {
+      accumulator.AddZeros(end - position);
+      position = end;
+    }
+  };
+
+  for (const auto& patch : patches) {
+    addImage(patch.offset);
+    accumulator.Add(patch.bytes.data(), patch.bytes.size());
+    position = patch.offset + patch.bytes.size();
+  }
+  if (overlay.to != overlay.from) {
+    addImage(overlay.to);
+    accumulator.Add(data_ + overlay.from, static_cast<size_t>(overlay.size));
+    position = overlay.to + overlay.size;
+  }
+  addImage(size);
+
+  return accumulator.Finish(size);
+}
+
+}  // namespace rescle
@@ -0,0 +1,131 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef PE_IMAGE_H
+#define PE_IMAGE_H
+
+#include <map>
+#include <memory_resource>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+namespace rescle {
+
+// Integer id or string name of a resource type or a resource.
+struct ResourceId {
+  ResourceId() {}
+  ResourceId(LPCWSTR value);
+  ResourceId(WORD value) : id(value) {}
+
+  bool IsId() const { return name.empty(); }
+
+  // The form Win32 resource functions take, valid as long as this id.
+  LPCWSTR Pointer() const { return IsId() ? MAKEINTRESOURCEW(id) : name.c_str(); }
+
+  WORD id = 0;
+  std::wstring name;
+};
+
+// Orders ids the way the resource directory stores them: names first,
+// compared case-insensitively, then integer ids ascending.
+bool operator<(const ResourceId& a, const ResourceId& b);
+bool operator==(const ResourceId& a, const ResourceId& b);
+
+struct ResourceKey {
+  ResourceId type;
+  ResourceId name;
+  LANGID langId;
+};
+
+bool operator<(const ResourceKey& a, const ResourceKey& b);
+
+// A resource payload, borrowed from the image or from the updater.
+struct ResourceData {
+  const BYTE* data = nullptr;
+  size_t size = 0;
+  DWORD codePage = 0;
+};
+
+// A pmr map, so a caller can keep a short-lived table on a scratch arena.
+typedef std::pmr::map<ResourceKey, ResourceData> ResourceTable;
+
+struct FilePatch {
+  ULONGLONG offset;
+  std::vector<BYTE> bytes;
+};
+
+// A range of the file that moves to a later offset before the patches are
+// written. Nothing moves when |from| equals |to|.
+struct FileMove {
+  ULONGLONG from = 0;
+  ULONGLONG to = 0;
+  ULONGLONG size = 0;
+};
+
+// Read-only view of a PE file held in memory, used to read the resource
+// tree and to plan where an updated resource section goes.
+class PEImage {
+ public:
+  enum class Placement {
+    kNone,      // the section cannot be placed without moving other sections
+    kInPlace,   // reuses the slack of the existing section
+    kGrow,      // grows the existing section, which is the last one
+    kRelocate,  // moves the section into a new last section
+  };
+
+  PEImage();
+
+  bool Parse(const BYTE* data, size_t size);
+  bool ReadResources(ResourceTable* table) const;
+
+  // Lays |table| out as a new resource section and returns the writes that
+  // turn the image into the updated one. Payloads are copied into the
+  // patches, so the image and the table may go away afterwards. Data after
+  // the last section, such as an installer payload or the certificate
+  // table, is moved past a section that grows into it. The directories
+  // keep the TimeDateStamp of the old root unless |timestamp| is given.
+  Placement PlanResources(const ResourceTable& table, bool allowRelocate, const DWORD* timestamp,
+                          std::vector<FilePatch>* patches, FileMove* overlay,
+                          ULONGLONG* newSize) const;
+
+  ULONGLONG GetOverlayOffset() const;
+  // The TimeDateStamp of the root resource directory, false without one.
+  bool GetResourceTimestamp(DWORD* timestamp) const;
+  // The file offset of the optional header CheckSum, false when the image
+  // has no checksum, which the planner then leaves at zero.
+  bool GetChecksumOffset(size_t* offset) const;
+
+  // The PE checksum of the image after |patches| and |overlay|, with the
+  // CheckSum field taken as it is in the patches.
+  DWORD ComputeChecksum(const std::vector<FilePatch>& patches, const FileMove& overlay,
+                        ULONGLONG size) const;
+
+ private:
+  const IMAGE_SECTION_HEADER* FindSection(DWORD rva) const;
+  bool RvaToOffset(DWORD rva, DWORD size, size_t* offset) const;
+  bool ReadResourceDirectory(size_t offset, int level, ResourceKey* key, ResourceTable* table,
+                             std::set<size_t>* visited) const;
+  bool ReadResourceString(DWORD offset, std::wstring* value) const;
+
+  const BYTE* data_;
+  size_t size_;
+  size_t optionalHeaderOffset_;
+  size_t sectionTableOffset_;
+  bool is64_;
+  DWORD fileAlignment_;
+  DWORD sectionAlignment_;
+  DWORD sizeOfHeaders_;
+  DWORD checkSum_;
+  IMAGE_DATA_DIRECTORY resourceDirectory_;
+  IMAGE_DATA_DIRECTORY securityDirectory_;
+  size_t resourceDirectoryOffset_;
+  std::vector<IMAGE_SECTION_HEADER> sections_;
+};
+
+}  // namespace rescle
+
+#endif  // PE_IMAGE_H
@@ -0,0 +1,795 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+//
+// Generates synthetic PE32 and PE32+ images with a resource section of a
+// chosen shape, so the resource readers and writers can be round-tripped
+// and benchmarked without a Windows toolchain. Only the standard library is
+// used, and payloads of any size are streamed rather than held in memory.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+const uint16_t kIcon = 3;
+const uint16_t kString = 6;
+const uint16_t kRcData = 10;
+const uint16_t kGroupIcon = 14;
+const uint16_t kVersion = 16;
+const uint16_t kManifest = 24;
+
+const uint32_t kFileAlignment = 0x200;
+const uint32_t kSectionAlignment = 0x1000;
+const uint32_t kPeOffset = 0x80;
+const uint32_t kTextOffset = 0x200;  // headers fit in one file alignment
+const uint32_t kTextRva = 0x1000;
+const uint32_t kResourceOffset = kTextOffset + kFileAlignment;
+const uint32_t kResourceRva = kTextRva + kSectionAlignment;
+const size_t kChunkSize = 1 << 20;
+
+// Primary languages given to the first resources, all with SUBLANG_DEFAULT
+// or the first sublanguage; further languages take the remaining ids.
+const uint16_t kPreferredLanguages[] = {0x09, 0x07, 0x0c, 0x11, 0x04, 0x10, 0x0a, 0x19};
+
+struct Options {
+  const char* output = NULL;
+  bool pe32plus = true;
+  unsigned languages = 1;
+  unsigned version_tables = 1;
+  unsigned string_blocks = 1;
+  unsigned icon_groups = 1;
+  unsigned manifests = 1;
+  unsigned named = 0;
+  std::vector<uint64_t> rcdata;
+  uint64_t overlay = 0;
+  uint64_t certificate = 0;
+  uint64_t seed = 1;
+};
+
+// Integer id or upper-case name of a resource type or a resource.
+struct Id {
+  Id(uint16_t value) : id(value) {}
+  Id(const std::u16string& value) : name(value) {}
+
+  bool operator<(const Id& other) const {
+    if (name.empty() != other.name.empty())
+      return !name.empty();  // names come first
+    return name.empty() ? id < other.id : name < other.name;
+  }
+
+  uint16_t id = 0;
+  std::u16string name;
+};
+
+// A payload held in memory, or |generated| bytes of pseudo-random content
+// written straight to the file.
+struct Payload {
+  Bytes bytes;
+  uint64_t generated = 0;
+
+  uint64_t size() const { return bytes.empty() ? generated : bytes.size(); }
+};
+
+typedef std::map<Id, std::map<Id, std::map<uint16_t, Payload>>> ResourceMap;
+
+bool print_error(const char* message) {
+  fprintf(stderr, "%s\n", message);
+  return true;
+}
+
+void print_help() {
+  fprintf(stdout,
+"Synthetic PE generator for rcedit\n\n"
+"Usage: rcedit-pegen <output> [options...]\n\n"
+"Options:\n"
+"  -h, --help                     Show this help message\n"
+"  --pe32                         Write a PE32 image instead of PE32+\n"
+"  --languages <n>                Languages of the version, string and icon resources\n"
+"  --version-tables <n>           String tables per version resource, 0 for none\n"
+"  --string-blocks <n>            RT_STRING blocks per language\n"
+"  --icon-groups <n>              Icon groups per language, with two icons each\n"
+"  --manifests <n>                RT_MANIFEST resources\n"
+"  --named <n>                    Resources with string names under a named type\n"
+"  --rcdata <size>                Add an RCDATA resource of size bytes, K, M or G\n"
+"  --overlay <size>               Data appended after the last section\n"
+"  --certificate <size>           Certificate table at the end of the file\n"
+"  --seed <n>                     Seed of the generated content\n\n"
+"Sizes take an optional K, M or G suffix. The image is checksummed and every\n"
+"resource besides the manifests, RCDATA and named ones exists per language.\n");
+}
+
+bool parse_count(const char* text, unsigned limit, unsigned* value) {
+  char* end = NULL;
+  unsigned long parsed = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || parsed > limit)
+    return false;
+  *value = static_cast<unsigned>(parsed);
+  return true;
+}
+
+bool parse_size(const char* text, uint64_t* value) {
+  char* end = NULL;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if (end == text)
+    return false;
+  int shift = 0;
+  if (*end == 'K' || *end == 'k')
+    shift = 10;
+  else if (*end == 'M' || *end == 'm')
+    shift = 20;
+  else if (*end == 'G' || *end == 'g')
+    shift = 30;
+  if (shift != 0)
+    ++end;
+  if (*end != '\0' || parsed > (UINT64_MAX >> shift))
+    return false;
+  *value = static_cast<uint64_t>(parsed) << shift;
+  return true;
+}
+
+uint64_t align(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void put16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void put32(uint8_t* p, uint32_t value) {
+  put16(p, static_cast<uint16_t>(value));
+  put16(p + 2, static_cast<uint16_t>(value >> 16));
+}
+
+void put64(uint8_t* p, uint64_t value) {
+  put32(p, static_cast<uint32_t>(value));
+  put32(p + 4, static_cast<uint32_t>(value >> 32));
+}
+
+void append16(Bytes* bytes, uint16_t value) {
+  bytes->resize(bytes->size() + 2);
+  put16(&bytes->back() - 1, value);
+}
+
+void append32(Bytes* bytes, uint32_t value) {
+  bytes->resize(bytes->size() + 4);
+  put32(&bytes->back() - 3, value);
+}
+
+void append_string(Bytes* bytes, const std::u16string& text, bool terminate) {
+  for (char16_t c : text)
+    append16(bytes, c);
+  if (terminate)
+    append16(bytes, 0);
+}
+
+void pad(Bytes* bytes, size_t alignment) {
+  bytes->resize(align(bytes->size(), alignment));
+}
+
+std::u16string utf16(const std::string& text) {
+  return std::u16string(text.begin(), text.end());
+}
+
+std::u16string hex(uint32_t value, int digits) {
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%0*x", digits, value);
+  return utf16(buffer);
+}
+
+// xorshift64*, enough to keep payloads from compressing or deduplicating.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed ? seed : 0x9e3779b97f4a7c15ull) {}
+
+  void Fill(uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i += 8) {
+      state_ ^= state_ >> 12;
+      state_ ^= state_ << 25;
+      state_ ^= state_ >> 27;
+      uint64_t value = state_ * 0x2545f4914f6cdd1dull;
+      for (size_t k = 0; k < 8 && i + k < size; ++k)
+        data[i + k] = static_cast<uint8_t>(value >> (8 * k));
+    }
+  }
+
+  Bytes Generate(size_t size) {
+    Bytes bytes(size);
+    Fill(bytes.data(), size);
+    return bytes;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// A VS_VERSIONINFO node: header, key, value and children, each aligned to
+// four bytes. |valueLength| counts characters for text values.
+Bytes version_node(const std::u16string& key, uint16_t type, const Bytes& value,
+                   uint16_t valueLength, const std::vector<Bytes>& children) {
+  Bytes node(6);
+  append_string(&node, key, true);
+  pad(&node, 4);
+  node.insert(node.end(), value.begin(), value.end());
+  for (const auto& child : children) {
+    pad(&node, 4);
+    node.insert(node.end(), child.begin(), child.end());
+  }
+  put16(&node[0], static_cast<uint16_t>(node.size()));
+  put16(&node[2], valueLength);
+  put16(&node[4], type);
+  return node;
+}
+
+Bytes version_string(const std::string& key, const std::string& value) {
+  Bytes text;
+  append_string(&text, utf16(value), true);
+  return version_node(utf16(key), 1, text, static_cast<uint16_t>(value.length() + 1), {});
+}
+
+uint16_t table_code_page(unsigned table) {
+  const uint16_t kCodePages[] = {1200, 1252, 0, 932, 936, 949, 950};
+  const unsigned count = sizeof(kCodePages) / sizeof(kCodePages[0]);
+  return table < count ? kCodePages[table] : static_cast<uint16_t>(1250 + table - count);
+}
+
+Bytes version_resource(uint16_t language, unsigned tables) {
+  Bytes fixed;
+  const uint32_t kFixed[] = {
+    0xfeef04bd, 0x00010000,  // signature, structure version
+    0x00010000, 0x00000000,  // file version 1.0.0.0
+    0x00010000, 0x00000000,  // product version 1.0.0.0
+    0x3f, 0,                 // flags mask, flags
+    0x00040004, 1, 0,        // VOS_NT_WINDOWS32, VFT_APP, subtype
+    0, 0,                    // date
+  };
+  for (uint32_t value : kFixed)
+    append32(&fixed, value);
+
+  std::vector<Bytes> stringTables;
+  Bytes translations;
+  for (unsigned t = 0; t < tables; ++t) {
+    uint16_t codePage = table_code_page(t);
+    std::vector<Bytes> strings = {
+      version_string("CompanyName", "Synthetic Corporation"),
+      version_string("FileDescription", "Synthetic image " + std::to_string(t)),
+      version_string("FileVersion", "1.0.0.0"),
+      version_string("InternalName", "synthetic"),
+      version_string("LegalCopyright", "Copyright (C) Synthetic Corporation"),
+      version_string("OriginalFilename", "synthetic.exe"),
+      version_string("ProductName", "Synthetic"),
+      version_string("ProductVersion", "1.0.0.0"),
+    };
+    stringTables.push_back(version_node(hex(language, 4) + hex(codePage, 4), 1, Bytes(), 0, strings));
+    append16(&translations, language);
+    append16(&translations, codePage);
+  }
+
+  Bytes translation = version_node(u"Translation", 0, translations,
+                                   static_cast<uint16_t>(translations.size()), {});
+  return version_node(u"VS_VERSION_INFO", 0, fixed, static_cast<uint16_t>(fixed.size()), {
+    version_node(u"StringFileInfo", 1, Bytes(), 0, stringTables),
+    version_node(u"VarFileInfo", 1, Bytes(), 0, {translation}),
+  });
+}
+
+Bytes string_block(unsigned block) {
+  Bytes bytes;
+  for (unsigned k = 0; k < 16; ++k) {
+    std::u16string text = utf16("String " + std::to_string((block - 1) * 16 + k));
+    append16(&bytes, static_cast<uint16_t>(text.length()));
+    append_string(&bytes, text, false);
+  }
+  return bytes;
+}
+
+// A 32-bit DIB icon image of |size| pixels square with an empty mask.
+Bytes icon_image(uint32_t size, uint32_t color) {
+  uint32_t pixels = size * size * 4;
+  uint32_t mask = (size + 31) / 32 * 4 * size;
+  Bytes bytes;
+  append32(&bytes, 40);
+  append32(&bytes, size);
+  append32(&bytes, size * 2);  // image and mask
+  append16(&bytes, 1);
+  append16(&bytes, 32);
+  append32(&bytes, 0);
+  append32(&bytes, pixels + mask);
+  bytes.resize(40);
+  for (uint32_t i = 0; i < size * size; ++i)
+    append32(&bytes, color);
+  bytes.resize(bytes.size() + mask);
+  return bytes;
+}
+
+Bytes manifest(unsigned index) {
+  std::string text =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+      "<assembly xmlns=\"urn:schemas-microsoft-com:asm.v1\" manifestVersion=\"1.0\">\n"
+      "  <assemblyIdentity type=\"win32\" name=\"Synthetic.Image" + std::to_string(index) +
+      "\" version=\"1.0.0.0\"/>\n"
+      "  <trustInfo xmlns=\"urn:schemas-microsoft-com:asm.v3\">\n"
+      "    <security>\n"
+      "      <requestedPrivileges>\n"
+      "        <requestedExecutionLevel level=\"asInvoker\" uiAccess=\"false\"/>\n"
+      "      </requestedPrivileges>\n"
+      "    </security>\n"
+      "  </trustInfo>\n"
+      "</assembly>\n";
+  return Bytes(text.begin(), text.end());
+}
+
+uint16_t language_id(unsigned index) {
+  const unsigned preferred = sizeof(kPreferredLanguages) / sizeof(kPreferredLanguages[0]);
+  uint16_t primary = 0;
+  if (index < preferred) {
+    primary = kPreferredLanguages[index];
+  } else {
+    // The remaining primary languages in order, skipping the preferred ones.
+    unsigned skip = index - preferred;
+    for (primary = 1; ; ++primary) {
+      bool used = false;
+      for (uint16_t language : kPreferredLanguages)
+        used = used || language == primary;
+      if (!used && skip-- == 0)
+        break;
+    }
+  }
+  return static_cast<uint16_t>(1 << 10 | primary);
+}
+
+void build_resources(const Options& options, ResourceMap* resources) {
+  Random random(options.seed);
+  for (unsigned l = 0; l < options.languages; ++l) {
+    uint16_t language = language_id(l);
+    if (options.version_tables > 0)
+      (*resources)[kVersion][1][language].bytes = version_resource(language, options.version_tables);
+    for (unsigned b = 1; b <= options.string_blocks; ++b)
+      (*resources)[kString][static_cast<uint16_t>(b)][language].bytes = string_block(b);
+
+    for (unsigned g = 1; g <= options.icon_groups; ++g) {
+      const uint32_t kSizes[] = {16, 32};
+      Bytes group;
+      append16(&group, 0);
+      append16(&group, 1);  // icons
+      append16(&group, 2);
+      for (unsigned k = 0; k < 2; ++k) {
+        uint16_t icon = static_cast<uint16_t>((g - 1) * 2 + k + 1);
+        Bytes image = icon_image(kSizes[k], 0xff000000 | (g * 0x10204 + l * 0x3f));
+        group.push_back(static_cast<uint8_t>(kSizes[k]));
+        group.push_back(static_cast<uint8_t>(kSizes[k]));
+        group.push_back(0);  // colors
+        group.push_back(0);
+        append16(&group, 1);   // planes
+        append16(&group, 32);  // bits per pixel
+        append32(&group, static_cast<uint32_t>(image.size()));
+        append16(&group, icon);
+        (*resources)[kIcon][icon][language].bytes = std::move(image);
+      }
+      (*resources)[kGroupIcon][static_cast<uint16_t>(g)][language].bytes = std::move(group);
+    }
+  }
+
+  uint16_t language = language_id(0);
+  for (unsigned m = 1; m <= options.manifests; ++m)
+    (*resources)[kManifest][static_cast<uint16_t>(m)][language].bytes = manifest(m);
+  for (unsigned n = 1; n <= options.named; ++n)
+    (*resources)[std::u16string(u"SYNTHETIC")][utf16("ITEM" + std::to_string(n))][language].bytes = random.Generate(256);
+  for (size_t r = 0; r < options.rcdata.size(); ++r)
+    (*resources)[kRcData][static_cast<uint16_t>(r + 1)][language].generated = options.rcdata[r];
+}
+
+// The resource section as linkers lay it out: the three directory levels,
+// the data entries, the name strings, then the payloads aligned to eight
+// bytes. The directory is built in memory and the payloads are placed.
+class ResourceLayout {
+ public:
+  explicit ResourceLayout(const ResourceMap& resources) : resources_(resources) {
+    uint64_t tables = 0;
+    size_t entries = 0;
+    size_t strings = 0;
+    auto addTable = [&](size_t count) { tables += 16 + 8 * count; };
+    auto addName = [&](const Id& id) {
+      if (!id.name.empty())
+        strings += 2 + 2 * id.name.length();
+    };
+
+    addTable(resources.size());
+    for (const auto& type : resources) {
+      addName(type.first);
+      addTable(type.second.size());
+    }
+    for (const auto& type : resources) {
+      for (const auto& name : type.second) {
+        addName(name.first);
+        addTable(name.second.size());
+        entries += name.second.size();
+      }
+    }
+
+    entriesOffset_ = tables;
+    stringsOffset_ = entriesOffset_ + 16 * entries;
+    directorySize_ = align(stringsOffset_ + strings, 8);
+
+    size_ = directorySize_;
+    for (const auto& type : resources) {
+      for (const auto& name : type.second) {
+        for (const auto& language : name.second) {
+          payloads_.push_back(&language.second);
+          offsets_.push_back(size_);
+          size_ = align(size_ + language.second.size(), 8);
+        }
+      }
+    }
+  }
+
+  uint64_t size() const { return size_; }
+  const std::vector<const Payload*>& payloads() const { return payloads_; }
+  const std::vector<uint64_t>& offsets() const { return offsets_; }
+
+  Bytes Directory() const {
+    Bytes bytes(directorySize_);
+    uint64_t nextTable = 0;
+    uint64_t nextString = stringsOffset_;
+    size_t nextEntry = 0;
+
+    // Characteristics, TimeDateStamp and the version of a table stay zero.
+    auto writeTable = [&](size_t count) {
+      uint64_t offset = nextTable;
+      nextTable += 16 + 8 * count;
+      return offset;
+    };
+    auto nameField = [&](const Id& id) -> uint32_t {
+      if (id.name.empty())
+        return id.id;
+      uint64_t offset = nextString;
+      put16(&bytes[offset], static_cast<uint16_t>(id.name.length()));
+      for (size_t i = 0; i < id.name.length(); ++i)
+        put16(&bytes[offset + 2 + 2 * i], id.name[i]);
+      nextString += 2 + 2 * id.name.length();
+      return 0x80000000 | static_cast<uint32_t>(offset);
+    };
+    auto setCounts = [&](uint64_t table, const std::vector<Id>& ids) {
+      uint16_t names = 0;
+      for (const auto& id : ids)
+        names += id.name.empty() ? 0 : 1;
+      put16(&bytes[table + 12], names);
+      put16(&bytes[table + 14], static_cast<uint16_t>(ids.size() - names));
+    };
+
+    // Tables go breadth first, so every subdirectory offset is known once
+    // the level above is written.
+    uint64_t root = writeTable(resources_.size());
+    std::vector<Id> typeIds;
+    std::vector<uint64_t> typeTables;
+    for (const auto& type : resources_) {
+      typeIds.push_back(type.first);
+      typeTables.push_back(writeTable(type.second.size()));
+    }
+    setCounts(root, typeIds);
+
+    std::vector<uint64_t> nameTables;
+    size_t t = 0;
+    for (const auto& type : resources_) {
+      uint64_t entry = root + 16 + 8 * t;
+      put32(&bytes[entry], nameField(type.first));
+      put32(&bytes[entry + 4], 0x80000000 | static_cast<uint32_t>(typeTables[t]));
+
+      std::vector<Id> nameIds;
+      size_t n = 0;
+      for (const auto& name : type.second) {
+        nameIds.push_back(name.first);
+        uint64_t table = writeTable(name.second.size());
+        nameTables.push_back(table);
+        uint64_t nameEntry = typeTables[t] + 16 + 8 * n++;
+        put32(&bytes[nameEntry], nameField(name.first));
+        put32(&bytes[nameEntry + 4], 0x80000000 | static_cast<uint32_t>(table));
+      }
+      setCounts(typeTables[t++], nameIds);
+    }
+
+    size_t n = 0;
+    for (const auto& type : resources_) {
+      for (const auto& name : type.second) {
+        uint64_t table = nameTables[n++];
+        put16(&bytes[table + 14], static_cast<uint16_t>(name.second.size()));
+        size_t l = 0;
+        for (const auto& language : name.second) {
+          uint64_t entry = entriesOffset_ + 16 * nextEntry;
+          put32(&bytes[table + 16 + 8 * l], language.first);
+          put32(&bytes[table + 16 + 8 * l + 4], static_cast<uint32_t>(entry));
+          put32(&bytes[entry], static_cast<uint32_t>(kResourceRva + offsets_[nextEntry]));
+          put32(&bytes[entry + 4], static_cast<uint32_t>(language.second.size()));
+          ++nextEntry;
+          ++l;
+        }
+      }
+    }
+    return bytes;
+  }
+
+ private:
+  const ResourceMap& resources_;
+  uint64_t entriesOffset_;
+  uint64_t stringsOffset_;
+  uint64_t directorySize_;
+  uint64_t size_;
+  std::vector<const Payload*> payloads_;
+  std::vector<uint64_t> offsets_;
+};
+
+// Writes the file in order while summing it the way the PE checksum does,
+// so the CheckSum field can be patched in at the end.
+class Output {
+ public:
+  explicit Output(FILE* file) : file_(file) {}
+
+  bool Write(const uint8_t* data, size_t size) {
+    size_t i = 0;
+    if (odd_ && size > 0) {
+      AddWord(static_cast<uint32_t>(low_) | static_cast<uint32_t>(data[0]) << 8);
+      odd_ = false;
+      i = 1;
+    }
+    for (; i + 1 < size; i += 2)
+      AddWord(static_cast<uint32_t>(data[i]) | static_cast<uint32_t>(data[i + 1]) << 8);
+    if (i < size) {
+      low_ = data[i];
+      odd_ = true;
+    }
+    position_ += size;
+    return fwrite(data, 1, size, file_) == size;
+  }
+
+  bool Write(const Bytes& bytes) { return Write(bytes.data(), bytes.size()); }
+
+  bool WriteRandom(uint64_t size, Random* random) {
+    Bytes chunk(static_cast<size_t>(std::min<uint64_t>(size, kChunkSize)));
+    for (uint64_t done = 0; done < size;) {
+      size_t count = static_cast<size_t>(std::min<uint64_t>(size - done, chunk.size()));
+      random->Fill(chunk.data(), count);
+      if (!Write(chunk.data(), count))
+        return false;
+      done += count;
+    }
+    return true;
+  }
+
+  bool PadTo(uint64_t offset) {
+    Bytes zeros(static_cast<size_t>(std::min<uint64_t>(offset - position_, kChunkSize)));
+    while (position_ < offset) {
+      if (!Write(zeros.data(), static_cast<size_t>(std::min<uint64_t>(offset - position_, zeros.size()))))
+        return false;
+    }
+    return true;
+  }
+
+  uint64_t position() const { return position_; }
+
+  uint32_t Checksum() {
+    if (odd_)
+      AddWord(low_);
+    odd_ = false;
+    sum_ = (sum_ & 0xffff) + (sum_ >> 16);
+    return static_cast<uint32_t>(sum_ + position_);
+  }
+
+ private:
+  void AddWord(uint32_t word) {
+    sum_ += word;
+    sum_ = (sum_ & 0xffff) + (sum_ >> 16);
+  }
+
+  FILE* file_;
+  uint64_t position_ = 0;
+  uint64_t sum_ = 0;
+  uint8_t low_ = 0;
+  bool odd_ = false;
+};
+
+// DOS header, PE headers and the section table of an image with .text and
+// .rsrc sections. The CheckSum is left zero.
+Bytes headers(const Options& options, uint64_t resourceSize, uint64_t certificateOffset,
+              uint64_t certificateSize) {
+  uint32_t resourceRawSize = static_cast<uint32_t>(align(resourceSize, kFileAlignment));
+  uint32_t imageSize = static_cast<uint32_t>(align(kResourceRva + resourceSize, kSectionAlignment));
+  uint16_t optionalSize = options.pe32plus ? 240 : 224;
+
+  Bytes bytes(kTextOffset);
+  bytes[0] = 'M';
+  bytes[1] = 'Z';
+  put32(&bytes[0x3c], kPeOffset);
+
+  uint8_t* pe = &bytes[kPeOffset];
+  memcpy(pe, "PE\0\0", 4);
+  uint8_t* file = pe + 4;
+  put16(file, options.pe32plus ? 0x8664 : 0x014c);
+  put16(file + 2, 2);  // sections
+  put16(file + 16, optionalSize);
+  put16(file + 18, options.pe32plus ? 0x0022 : 0x0102);
+
+  uint8_t* optional = file + 20;
+  put16(optional, options.pe32plus ? 0x020b : 0x010b);
+  optional[2] = 14;  // linker version
+  put32(optional + 4, kFileAlignment);     // SizeOfCode
+  put32(optional + 8, resourceRawSize);    // SizeOfInitializedData
+  put32(optional + 16, kTextRva);          // AddressOfEntryPoint
+  put32(optional + 20, kTextRva);          // BaseOfCode
+  if (options.pe32plus) {
+    put64(optional + 24, 0x140000000ull);
+  } else {
+    put32(optional + 24, kResourceRva);    // BaseOfData
+    put32(optional + 28, 0x400000);
+  }
+  put32(optional + 32, kSectionAlignment);
+  put32(optional + 36, kFileAlignment);
+  put16(optional + 40, 6);                 // operating system version
+  put16(optional + 48, 6);                 // subsystem version
+  put32(optional + 56, imageSize);
+  put32(optional + 60, kTextOffset);       // SizeOfHeaders
+  put16(optional + 68, 3);                 // IMAGE_SUBSYSTEM_WINDOWS_CUI
+  put16(optional + 70, options.pe32plus ? 0x8160 : 0x8140);
+
+  uint8_t* directories;
+  if (options.pe32plus) {
+    put64(optional + 72, 0x100000);
+    put64(optional + 80, 0x1000);
+    put64(optional + 88, 0x100000);
+    put64(optional + 96, 0x1000);
+    put32(optional + 108, 16);
+    directories = optional + 112;
+  } else {
+    put32(optional + 72, 0x100000);
+    put32(optional + 76, 0x1000);
+    put32(optional + 80, 0x100000);
+    put32(optional + 84, 0x1000);
+    put32(optional + 92, 16);
+    directories = optional + 96;
+  }
+  put32(directories + 2 * 8, kResourceRva);
+  put32(directories + 2 * 8 + 4, static_cast<uint32_t>(resourceSize));
+  if (certificateSize != 0) {
+    // The security directory holds a file offset, not an RVA.
+    put32(directories + 4 * 8, static_cast<uint32_t>(certificateOffset));
+    put32(directories + 4 * 8 + 4, static_cast<uint32_t>(certificateSize));
+  }
+
+  uint8_t* section = optional + optionalSize;
+  memcpy(section, ".text", 5);
+  put32(section + 8, 16);                  // VirtualSize
+  put32(section + 12, kTextRva);
+  put32(section + 16, kFileAlignment);
+  put32(section + 20, kTextOffset);
+  put32(section + 36, 0x60000020);         // code, execute, read
+
+  section += 40;
+  memcpy(section, ".rsrc", 5);
+  put32(section + 8, static_cast<uint32_t>(resourceSize));
+  put32(section + 12, kResourceRva);
+  put32(section + 16, resourceRawSize);
+  put32(section + 20, kResourceOffset);
+  put32(section + 36, 0x40000040);         // initialized data, read
+  return bytes;
+}
+
+bool generate(const Options& options) {
+  ResourceMap resources;
+  build_resources(options, &resources);
+  ResourceLayout layout(resources);
+  if (kResourceRva + align(layout.size(), kSectionAlignment) > UINT32_MAX)
+    return print_error("The resources do not fit the 4 GB address space of an image");
+
+  uint64_t overlayOffset = kResourceOffset + align(layout.size(), kFileAlignment);
+  uint64_t certificateOffset = align(overlayOffset + options.overlay, 8);
+  uint64_t certificateSize = options.certificate == 0 ? 0 : 8 + align(options.certificate, 8);
+  if (certificateOffset + certificateSize > UINT32_MAX && certificateSize != 0)
+    return print_error("The certificate table must start and end below 4 GB");
+
+  FILE* file = fopen(options.output, "wb");
+  if (file == NULL)
+    return print_error("Unable to create the output file");
+
+  Random random(options.seed ^ 0x5bd1e995);
+  Output output(file);
+  const uint8_t kCode[] = {0x31, 0xc0, 0xc3};  // xor eax, eax; ret
+  bool written = output.Write(headers(options, layout.size(), certificateOffset, certificateSize)) &&
+                 output.Write(kCode, sizeof(kCode)) && output.PadTo(kResourceOffset) &&
+                 output.Write(layout.Directory());
+  for (size_t i = 0; written && i < layout.payloads().size(); ++i) {
+    const Payload& payload = *layout.payloads()[i];
+    written = output.PadTo(kResourceOffset + layout.offsets()[i]) &&
+              (payload.bytes.empty() ? output.WriteRandom(payload.generated, &random)
+                                     : output.Write(payload.bytes));
+  }
+  written = written && output.PadTo(overlayOffset) && output.WriteRandom(options.overlay, &random);
+  if (written && certificateSize != 0) {
+    Bytes header(8);
+    put32(&header[0], static_cast<uint32_t>(certificateSize));
+    put16(&header[4], 0x0200);  // WIN_CERT_REVISION_2_0
+    put16(&header[6], 0x0002);  // WIN_CERT_TYPE_PKCS_SIGNED_DATA
+    written = output.PadTo(certificateOffset) && output.Write(header) &&
+              output.WriteRandom(certificateSize - 8, &random);
+  }
+
+  if (written) {
+    uint8_t checksum[4];
+    put32(checksum, output.Checksum());
+    written = fseek(file, kPeOffset + 4 + 20 + 64, SEEK_SET) == 0 &&
+              fwrite(checksum, 1, sizeof(checksum), file) == sizeof(checksum);
+  }
+  written = fclose(file) == 0 && written;
+  if (!written) {
+    remove(options.output);
+    return print_error("Unable to write the output file");
+  }
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc == 1 ||
+      (argc == 2 && strcmp(argv[1], "-h") == 0) ||
+      (argc == 2 && strcmp(argv[1], "--help") == 0)) {
+    print_help();
+    return 0;
+  }
+
+  Options options;
+  options.output = argv[1];
+  for (int i = 2; i < argc; ++i) {
+    const char* option = argv[i];
+    if (strcmp(option, "--pe32") == 0) {
+      options.pe32plus = false;
+      continue;
+    }
+    if (argc - i < 2) {
+      fprintf(stderr, "Missing value or unrecognized argument: \"%s\"\n", option);
+      return 1;
+    }
+
+    const char* value = argv[++i];
+    bool parsed = false;
+    if (strcmp(option, "--languages") == 0) {
+      parsed = parse_count(value, 63, &options.languages) && options.languages > 0;
+    } else if (strcmp(option, "--version-tables") == 0) {
+      parsed = parse_count(value, 256, &options.version_tables);
+    } else if (strcmp(option, "--string-blocks") == 0) {
+      parsed = parse_count(value, 4096, &options.string_blocks);
+    } else if (strcmp(option, "--icon-groups") == 0) {
+      parsed = parse_count(value, 0x7fff, &options.icon_groups);
+    } else if (strcmp(option, "--manifests") == 0) {
+      parsed = parse_count(value, 0xffff, &options.manifests);
+    } else if (strcmp(option, "--named") == 0) {
+      parsed = parse_count(value, 0xffff, &options.named);
+    } else if (strcmp(option, "--rcdata") == 0) {
+      uint64_t size = 0;
+      parsed = parse_size(value, &size) && options.rcdata.size() < 0xffff;
+      options.rcdata.push_back(size);
+    } else if (strcmp(option, "--overlay") == 0) {
+      parsed = parse_size(value, &options.overlay);
+    } else if (strcmp(option, "--certificate") == 0) {
+      parsed = parse_size(value, &options.certificate);
+    } else if (strcmp(option, "--seed") == 0) {
+      parsed = parse_size(value, &options.seed);
+    } else {
+      fprintf(stderr, "Unrecognized argument: \"%s\"\n", option);
+      return 1;
+    }
+    if (!parsed) {
+      fprintf(stderr, "Unable to parse %s \"%s\"\n", option, value);
+      return 1;
+    }
+  }
+
+  return generate(options) ? 1 : 0;
+}
@@ -0,0 +1,209 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <windows.h>
+
+namespace rescle {
+
+// Reads and writes little-endian integers a byte at a time. Compilers fold
+// these loops into a single unaligned load or store on x86 and ARM, and they
+// stay correct on big-endian or strict-alignment hosts.
+template<typename T>
+inline T LoadLittleEndian(const BYTE* p) {
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i)
+    value = static_cast<T>(value | static_cast<T>(static_cast<T>(p[i]) << (8 * i)));
+  return value;
+}
+
+template<typename T>
+inline void StoreLittleEndian(BYTE* p, T value) {
+  for (size_t i = 0; i < sizeof(T); ++i)
+    p[i] = static_cast<BYTE>(static_cast<uint64_t>(value) >> (8 * i));
+}
+
+// A little-endian integer of type |T| at |Offset| in a record layout. A
+// layout is a struct naming its fields and giving its size in kSize:
+//
+//   struct FooLayout {
+//     typedef Field<WORD, 0> Length;
+//     typedef Field<DWORD, 2> Value;
+//     static constexpr size_t kSize = 6;
+//   };
+template<typename T, size_t Offset>
+struct Field {
+  typedef T Type;
+  static constexpr size_t kOffset = Offset;
+  static constexpr size_t kEnd = Offset + sizeof(T);
+};
+
+// Bounds-checked window over bytes owned by someone else.
+class ByteSpan {
+ public:
+  ByteSpan() : data_(nullptr), size_(0) {}
+  ByteSpan(const BYTE* data, size_t size) : data_(data), size_(size) {}
+
+  const BYTE* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns an empty span when |offset| is out of range, and clamps
+  // |length| to the end of this span.
+  ByteSpan Subspan(size_t offset, size_t length = SIZE_MAX) const {
+    if (offset > size_)
+      return ByteSpan();
+    return ByteSpan(data_ + offset, length < size_ - offset ? length : size_ - offset);
+  }
+
+  bool Contains(size_t offset, size_t length) const {
+    return offset <= size_ && length <= size_ - offset;
+  }
+
+  // Reads a NUL terminated UTF-16 string at |offset|, and the offset just
+  // past its terminator. Fails when the terminator is missing.
+  bool ReadString(size_t offset, std::wstring* value, size_t* end) const {
+    for (size_t position = offset; Contains(position, sizeof(WORD)); position += sizeof(WORD)) {
+      if (LoadLittleEndian<WORD>(data_ + position) == 0) {
+        *end = position + sizeof(WORD);
+        return ReadString(offset, (position - offset) / sizeof(WORD), value);
+      }
+    }
+    value->clear();
+    return false;
+  }
+
+  // Reads |length| UTF-16 code units at |offset| into any wide string.
+  template<typename String>
+  bool ReadString(size_t offset, size_t length, String* value) const {
+    if (length > SIZE_MAX / sizeof(WORD) || !Contains(offset, length * sizeof(WORD)))
+      return false;
+    value->resize(length);
+    for (size_t i = 0; i < length; ++i)
+      (*value)[i] = static_cast<wchar_t>(LoadLittleEndian<WORD>(data_ + offset + i * sizeof(WORD)));
+    return true;
+  }
+
+ private:
+  const BYTE* data_;
+  size_t size_;
+};
+
+// Read-only view of a record at the start of a span. The view is invalid
+// when the span is too short, and every field read is checked against the
+// layout at compile time.
+template<typename Layout>
+class RecordView {
+ public:
+  explicit RecordView(ByteSpan bytes)
+      : bytes_(bytes.size() >= Layout::kSize ? bytes : ByteSpan()) {}
+
+  bool valid() const { return bytes_.data() != nullptr; }
+
+  template<typename F>
+  typename F::Type Get() const {
+    static_assert(F::kEnd <= Layout::kSize, "field lies outside of the record");
+    return LoadLittleEndian<typename F::Type>(bytes_.data() + F::kOffset);
+  }
+
+  // The bytes following the fixed part of the record.
+  ByteSpan tail() const { return bytes_.Subspan(Layout::kSize); }
+
+ private:
+  ByteSpan bytes_;
+};
+
+// Writes the fields of a record to a buffer of at least Layout::kSize bytes.
+template<typename Layout>
+class RecordWriter {
+ public:
+  explicit RecordWriter(BYTE* out) : out_(out) {}
+
+  template<typename F>
+  void Set(typename F::Type value) {
+    static_assert(F::kEnd <= Layout::kSize, "field lies outside of the record");
+    StoreLittleEndian<typename F::Type>(out_ + F::kOffset, value);
+  }
+
+ private:
+  BYTE* out_;
+};
+
+// Header shared by every node of a VS_VERSIONINFO tree, followed by a NUL
+// terminated key and the DWORD aligned value and children.
+struct VersionHeaderLayout {
+  typedef Field<WORD, 0> Length;
+  typedef Field<WORD, 2> ValueLength;
+  typedef Field<WORD, 4> Type;
+  static constexpr size_t kSize = 6;
+};
+
+// Header of an .ico file and of an RT_GROUP_ICON resource.
+struct IconDirLayout {
+  typedef Field<WORD, 0> Reserved;
+  typedef Field<WORD, 2> Type;
+  typedef Field<WORD, 4> Count;
+  static constexpr size_t kSize = 6;
+};
+
+// Image entry of an .ico file.
+struct IconDirEntryLayout {
+  typedef Field<BYTE, 0> Width;
+  typedef Field<BYTE, 1> Height;
+  typedef Field<BYTE, 2> ColorCount;
+  typedef Field<BYTE, 3> Reserved;
+  typedef Field<WORD, 4> Planes;
+  typedef Field<WORD, 6> BitCount;
+  typedef Field<DWORD, 8> BytesInRes;
+  typedef Field<DWORD, 12> ImageOffset;
+  static constexpr size_t kSize = 16;
+};
+
+// Image entry of an RT_GROUP_ICON resource, which names an RT_ICON by id
+// instead of giving a file offset.
+struct GroupIconDirEntryLayout {
+  typedef Field<BYTE, 0> Width;
+  typedef Field<BYTE, 1> Height;
+  typedef Field<BYTE, 2> ColorCount;
+  typedef Field<BYTE, 3> Reserved;
+  typedef Field<WORD, 4> Planes;
+  typedef Field<WORD, 6> BitCount;
+  typedef Field<DWORD, 8> BytesInRes;
+  typedef Field<WORD, 12> Id;
+  static constexpr size_t kSize = 14;
+};
+
+struct ResourceDirectoryLayout {
+  typedef Field<DWORD, 0> Characteristics;
+  typedef Field<DWORD, 4> TimeDateStamp;
+  typedef Field<WORD, 8> MajorVersion;
+  typedef Field<WORD, 10> MinorVersion;
+  typedef Field<WORD, 12> NumberOfNamedEntries;
+  typedef Field<WORD, 14> NumberOfIdEntries;
+  static constexpr size_t kSize = 16;
+};
+
+struct ResourceDirectoryEntryLayout {
+  typedef Field<DWORD, 0> Name;
+  typedef Field<DWORD, 4> OffsetToData;
+  static constexpr size_t kSize = 8;
+};
+
+struct ResourceDataEntryLayout {
+  typedef Field<DWORD, 0> OffsetToData;
+  typedef Field<DWORD, 4> Size;
+  typedef Field<DWORD, 8> CodePage;
+  typedef Field<DWORD, 12> Reserved;
+  static constexpr size_t kSize = 16;
+};
+
+}  // namespace rescle
+
+#endif  // RECORD_H
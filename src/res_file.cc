@@ -0,0 +1,167 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "res_file.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace rescle {
+
+namespace {
+
+// MOVEABLE | PURE | DISCARDABLE, what rc uses for most resource types.
+const WORD kDefaultMemoryFlags = 0x1030;
+
+#pragma pack(push,1)
+typedef struct _RESOURCEHEADERTAIL {
+  DWORD dataVersion;
+  WORD memoryFlags;
+  WORD languageId;
+  DWORD version;
+  DWORD characteristics;
+} RESOURCEHEADERTAIL;
+#pragma pack(pop)
+
+size_t Align4(size_t value) {
+  return (value + 3) & ~static_cast<size_t>(3);
+}
+
+template<typename T>
+bool ReadAt(const BYTE* data, size_t size, size_t offset, T* value) {
+  if (offset > size || size - offset < sizeof(T))
+    return false;
+  memcpy(value, data + offset, sizeof(T));
+  return true;
+}
+
+// Reads a type or name field, either 0xFFFF followed by an ordinal or a
+// NUL terminated string, and advances |offset| past it.
+bool ReadNameOrOrdinal(const BYTE* data, size_t end, size_t* offset, ResourceId* id) {
+  WORD first = 0;
+  if (!ReadAt(data, end, *offset, &first))
+    return false;
+
+  if (first == 0xFFFF) {
+    WORD ordinal = 0;
+    if (!ReadAt(data, end, *offset + sizeof(WORD), &ordinal))
+      return false;
+    *id = ResourceId(ordinal);
+    *offset += 2 * sizeof(WORD);
+    return true;
+  }
+
+  std::wstring name;
+  for (WORD c = first; c != 0; ) {
+    name += static_cast<wchar_t>(c);
+    *offset += sizeof(WORD);
+    if (!ReadAt(data, end, *offset, &c))
+      return false;
+  }
+  *offset += sizeof(WORD);
+  id->id = 0;
+  id->name = name;
+  return true;
+}
+
+void AppendNameOrOrdinal(const ResourceId& id, std::vector<BYTE>* out) {
+  if (id.IsId()) {
+    WORD ordinal[2] = { 0xFFFF, id.id };
+    out->insert(out->end(), reinterpret_cast<const BYTE*>(ordinal),
+                reinterpret_cast<const BYTE*>(ordinal + 2));
+  } else {
+    for (size_t i = 0; i <= id.name.length(); ++i) {
+      WORD c = static_cast<WORD>(id.name.c_str()[i]);
+      out->insert(out->end(), reinterpret_cast<const BYTE*>(&c),
+                  reinterpret_cast<const BYTE*>(&c + 1));
+    }
+  }
+}
+
+}  // namespace
+
+ResFileReader::ResFileReader(const BYTE* data, size_t size)
+    : data_(data), size_(size), offset_(0), failed_(false) {
+}
+
+bool ResFileReader::Next(ResEntry* entry) {
+  while (!failed_ && offset_ < size_) {
+    DWORD dataSize = 0;
+    DWORD headerSize = 0;
+    if (!ReadAt(data_, size_, offset_, &dataSize) ||
+        !ReadAt(data_, size_, offset_ + sizeof(DWORD), &headerSize) ||
+        headerSize > size_ - offset_ || dataSize > size_ - offset_ - headerSize) {
+      failed_ = true;
+      return false;
+    }
+
+    size_t headerEnd = offset_ + headerSize;
+    size_t offset = offset_ + 2 * sizeof(DWORD);
+    RESOURCEHEADERTAIL tail;
+    if (!ReadNameOrOrdinal(data_, headerEnd, &offset, &entry->key.type) ||
+        !ReadNameOrOrdinal(data_, headerEnd, &offset, &entry->key.name) ||
+        !ReadAt(data_, headerEnd, Align4(offset), &tail)) {
+      failed_ = true;
+      return false;
+    }
+
+    entry->key.langId = tail.languageId;
+    entry->memoryFlags = tail.memoryFlags;
+    entry->data = data_ + headerEnd;
+    entry->size = dataSize;
+    offset_ = std::min(Align4(headerEnd + dataSize), size_);
+
+    // The file starts with an empty entry of type 0.
+    if (entry->key.type.IsId() && entry->key.type.id == 0)
+      continue;
+    return true;
+  }
+  return false;
+}
+
+ResFileWriter::ResFileWriter(HANDLE file) : file_(file) {
+}
+
+bool ResFileWriter::Begin() {
+  return Write({ ResourceId(static_cast<WORD>(0)), ResourceId(static_cast<WORD>(0)), 0 }, nullptr, 0);
+}
+
+bool ResFileWriter::Write(const ResourceKey& key, const BYTE* data, size_t size) {
+  if (size > MAXDWORD)
+    return false;
+
+  std::vector<BYTE> header(2 * sizeof(DWORD));
+  AppendNameOrOrdinal(key.type, &header);
+  AppendNameOrOrdinal(key.name, &header);
+  header.resize(Align4(header.size()));
+
+  RESOURCEHEADERTAIL tail = {};
+  tail.memoryFlags = key.type.IsId() && key.type.id == 0 ? 0 : kDefaultMemoryFlags;
+  tail.languageId = key.langId;
+  const BYTE* p = reinterpret_cast<const BYTE*>(&tail);
+  header.insert(header.end(), p, p + sizeof(tail));
+
+  DWORD sizes[2] = { static_cast<DWORD>(size), static_cast<DWORD>(header.size()) };
+  memcpy(header.data(), sizes, sizeof(sizes));
+
+  static const BYTE kPadding[3] = {};
+  return WriteBytes(header.data(), header.size()) &&
+         WriteBytes(data, size) &&
+         WriteBytes(kPadding, Align4(size) - size);
+}
+
+bool ResFileWriter::WriteBytes(const void* data, size_t size) {
+  const BYTE* p = static_cast<const BYTE*>(data);
+  while (size > 0) {
+    DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1 << 30));
+    DWORD written = 0;
+    if (!WriteFile(file_, p, chunk, &written, NULL) || written != chunk)
+      return false;
+    p += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+}  // namespace rescle
@@ -0,0 +1,60 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef RES_FILE_H
+#define RES_FILE_H
+
+#include <vector>
+
+#include <windows.h>
+
+#include "pe_image.h"
+
+namespace rescle {
+
+// An entry of a 32-bit .res file, as produced by rc, windres and llvm-rc.
+// |data| points into the buffer given to the reader.
+struct ResEntry {
+  ResourceKey key;
+  WORD memoryFlags = 0;
+  const BYTE* data = nullptr;
+  size_t size = 0;
+};
+
+// Walks the entries of a .res file held in memory without copying them.
+class ResFileReader {
+ public:
+  ResFileReader(const BYTE* data, size_t size);
+
+  // Returns false at the end of the file or on a malformed entry, which
+  // failed() tells apart. The empty entry leading the file is skipped.
+  bool Next(ResEntry* entry);
+  bool failed() const { return failed_; }
+
+ private:
+  const BYTE* data_;
+  size_t size_;
+  size_t offset_;
+  bool failed_;
+};
+
+// Writes a .res file sequentially, copying each payload straight from the
+// caller's buffer to the file.
+class ResFileWriter {
+ public:
+  explicit ResFileWriter(HANDLE file);
+
+  // Writes the empty entry that identifies a 32-bit .res file.
+  bool Begin();
+  bool Write(const ResourceKey& key, const BYTE* data, size_t size);
+
+ private:
+  bool WriteBytes(const void* data, size_t size);
+
+  HANDLE file_;
+};
+
+}  // namespace rescle
+
+#endif  // RES_FILE_H
@@ -8,101 +8,435 @@
 #include "rescle.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <atlstr.h>
 #include <sstream> // wstringstream
 #include <iomanip> // setw, setfill
-#include <fstream>
-#include <codecvt>
 #include <algorithm>
+#include <functional>
+
+#include "edit_plan.h"
+#include "inflate.h"
+#include "journal.h"
+#include "parallel.h"
+#include "pe_image.h"
+#include "res_file.h"
+#include "resource_tree.h"
+#include "scoped_file.h"
+#include "string_list.h"
 
 namespace rescle {
 
-namespace {
+// A resource waiting to be submitted by Commit. The payload is either
+// serialized into |buffer| or borrowed from the updater through |data|.
+struct PendingResource {
+  LPCWSTR type;
+  LPCWSTR name;
+  LANGID langId;
+  std::vector<BYTE> buffer;
+  const BYTE* data = nullptr;
+  size_t size = 0;
+
+  // Returns NULL for a resource that is to be deleted.
+  const BYTE* Data() const {
+    return data ? data : (buffer.empty() ? nullptr : buffer.data());
+  }
+  size_t Size() const { return data ? size : buffer.size(); }
+};
 
-#pragma pack(push,2)
-typedef struct _GRPICONENTRY {
-  BYTE width;
-  BYTE height;
-  BYTE colourCount;
-  BYTE reserved;
-  BYTE planes;
-  BYTE bitCount;
-  WORD bytesInRes;
-  WORD bytesInRes2;
-  WORD reserved2;
-  WORD id;
-} GRPICONENTRY;
-#pragma pack(pop)
-
-#pragma pack(push,2)
-typedef struct _GRPICONHEADER {
-  WORD reserved;
-  WORD type;
-  WORD count;
-  GRPICONENTRY entries[1];
-} GRPICONHEADER;
-#pragma pack(pop)
-
-#pragma pack(push,1)
-typedef struct _VS_VERSION_HEADER {
-  WORD wLength;
-  WORD wValueLength;
-  WORD wType;
-} VS_VERSION_HEADER;
-#pragma pack(pop)
-
-#pragma pack(push,1)
-typedef struct _VS_VERSION_STRING {
-  VS_VERSION_HEADER Header;
-  WCHAR szKey[1];
-} VS_VERSION_STRING;
-#pragma pack(pop)
-
-#pragma pack(push,1)
-typedef struct _VS_VERSION_ROOT_INFO {
-  WCHAR szKey[16];
-  WORD  Padding1[1];
-  VS_FIXEDFILEINFO Info;
-} VS_VERSION_ROOT_INFO;
-#pragma pack(pop)
-
-#pragma pack(push,1)
-typedef struct _VS_VERSION_ROOT {
-  VS_VERSION_HEADER Header;
-  VS_VERSION_ROOT_INFO Info;
-} VS_VERSION_ROOT;
-#pragma pack(pop)
+namespace {
 
 // The default en-us LANGID.
 LANGID kLangEnUs = 1033;
 LANGID kCodePageEnUs = 1200;
 UINT   kDefaultIconBundle = 0;
 
+// String ids are WORDs, 16 to a block.
+const UINT kStringsPerBlock = 16;
+const UINT kStringBlockCount = 0x10000 / kStringsPerBlock;
+
 template<typename T>
 inline T round(T value, int modula = 4) {
   return value + ((value % modula > 0) ? (modula - value % modula) : 0);
 }
 
-std::wstring ReadFileToString(const wchar_t* filename) {
-  std::wifstream wif(filename);
-  wif.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
-  std::wstringstream wss;
-  wss << wif.rdbuf();
-  return wss.str();
+// Decodes UTF-8 text, or UTF-16 text when it starts with a byte order mark.
+// The OS converters handle surrogate pairs and are vectorized, and WCHAR is
+// UTF-16 so the UTF-16 case is a plain copy.
+std::wstring DecodeText(const BYTE* data, size_t size) {
+  if (size >= 2 && data[0] == 0xFF && data[1] == 0xFE) {
+    std::wstring text((size - 2) / sizeof(WCHAR), L'\0');
+    memcpy(&text[0], data + 2, text.length() * sizeof(WCHAR));
+    return text;
+  }
+
+  if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF) {
+    data += 3;
+    size -= 3;
+  }
+  if (size == 0 || size > INT_MAX) {
+    return std::wstring();
+  }
+
+  const char* utf8 = reinterpret_cast<const char*>(data);
+  int length = MultiByteToWideChar(CP_UTF8, 0, utf8, static_cast<int>(size), NULL, 0);
+  std::wstring text(length, L'\0');
+  if (length > 0) {
+    MultiByteToWideChar(CP_UTF8, 0, utf8, static_cast<int>(size), &text[0], length);
+  }
+  return text;
+}
+
+std::string EncodeUtf8(const std::wstring& text) {
+  if (text.empty() || text.length() > INT_MAX) {
+    return std::string();
+  }
+
+  int length = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()),
+                                   NULL, 0, NULL, NULL);
+  std::string utf8(length, '\0');
+  if (length > 0) {
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()),
+                        &utf8[0], length, NULL, NULL);
+  }
+  return utf8;
 }
 
-class ScopedFile {
+// The bytes of the loaded image: the image the updater was loaded from in
+// memory, or a read-only mapping of the loaded file.
+class SourceImage {
  public:
-  ScopedFile(const WCHAR* path)
-    : file_(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) {}
-  ~ScopedFile() { CloseHandle(file_); }
+  SourceImage(const std::wstring& filename, const std::shared_ptr<const std::vector<BYTE>>& image)
+      : data_(image && !image->empty() ? image->data() : NULL), size_(image ? image->size() : 0) {
+    if (filename.empty())
+      return;
+
+    file_.reset(new ScopedFile(filename.c_str()));
+    mapping_.reset(new ScopedFileMapping(*file_));
+    data_ = mapping_->data();
+    size_ = mapping_->size();
+  }
 
-  operator HANDLE() { return file_; }
+  const BYTE* data() const { return data_; }
+  size_t size() const { return size_; }
 
  private:
-  HANDLE file_;
+  std::unique_ptr<ScopedFile> file_;
+  std::unique_ptr<ScopedFileMapping> mapping_;
+  const BYTE* data_;
+  size_t size_;
+};
+
+bool ReadFileToBuffer(const WCHAR* path, std::vector<BYTE>* buffer) {
+  wchar_t abspath[MAX_PATH] = { 0 };
+  const auto filePath = _wfullpath(abspath, path, MAX_PATH) ? abspath : path;
+  ScopedFile file(filePath);
+  if (file == INVALID_HANDLE_VALUE) {
+    fprintf(stderr, "Cannot open new data file '%ws'\n", filePath);
+    return false;
+  }
+
+  const auto dwFileSize = GetFileSize(file, NULL);
+  if (dwFileSize == INVALID_FILE_SIZE) {
+    fprintf(stderr, "Cannot get file size for '%ws'\n", filePath);
+    return false;
+  }
+
+  buffer->clear();
+  buffer->resize(dwFileSize);
+
+  DWORD dwBytesRead{ 0 };
+  if (!ReadFile(file, buffer->data(), dwFileSize, &dwBytesRead, NULL)) {
+    fprintf(stderr, "Cannot read file '%ws'\n", filePath);
+    return false;
+  }
+
+  return true;
+}
+
+// Splits an RT_STRING block, a list of length prefixed strings. The strings
+// missing from a truncated block are left empty.
+void DecodeStringBlock(ByteSpan block, ResourceUpdater::StringValues* values) {
+  values->clear();
+  values->resize(kStringsPerBlock);
+  size_t offset = 0;
+  for (UINT k = 0; k < kStringsPerBlock && block.Contains(offset, sizeof(WORD)); ++k) {
+    WORD length = LoadLittleEndian<WORD>(block.data() + offset);
+    offset += sizeof(WORD);
+    length = static_cast<WORD>(std::min<size_t>(length, (block.size() - offset) / sizeof(WCHAR)));
+    block.ReadString(offset, length, &(*values)[k]);
+    offset += length * sizeof(WCHAR);
+  }
+}
+
+// Replaces the entries of |table| with |resources|, borrowing their payloads.
+void ApplyResources(const std::vector<PendingResource>& resources, ResourceTable* table) {
+  for (const auto& resource : resources) {
+    ResourceKey key = { resource.type, resource.name, resource.langId };
+    if (resource.Data() == nullptr) {
+      table->erase(key);
+      continue;
+    }
+
+    ResourceData& entry = (*table)[key];
+    entry.data = resource.Data();
+    entry.size = resource.Size();
+  }
+}
+
+// An RT_ICON by id, in |langId| when the image has it there.
+const ResourceData* FindIconImage(const ResourceTable& table, WORD id, LANGID langId) {
+  ResourceKey key = { RT_ICON, id, langId };
+  auto exact = table.find(key);
+  if (exact != table.end())
+    return &exact->second;
+
+  key.langId = 0;
+  auto any = table.lower_bound(key);
+  if (any != table.end() && any->first.type == key.type && any->first.name == key.name)
+    return &any->second;
+  return NULL;
+}
+
+// Rebuilds an .ico file from an RT_GROUP_ICON and the RT_ICON images it
+// names.
+bool WriteIconFile(HANDLE file, const ResourceTable& table, const ResourceKey& key, ByteSpan group) {
+  RecordView<IconDirLayout> dir(group);
+  if (!dir.valid())
+    return false;
+
+  WORD count = dir.Get<IconDirLayout::Count>();
+  std::vector<BYTE> header(IconDirLayout::kSize + count * IconDirEntryLayout::kSize);
+  RecordWriter<IconDirLayout> headerWriter(header.data());
+  headerWriter.Set<IconDirLayout::Reserved>(0);
+  headerWriter.Set<IconDirLayout::Type>(1);
+  headerWriter.Set<IconDirLayout::Count>(count);
+
+  std::vector<const ResourceData*> images;
+  size_t offset = header.size();
+  for (WORD i = 0; i < count; ++i) {
+    RecordView<GroupIconDirEntryLayout> entry(
+        group.Subspan(IconDirLayout::kSize + i * GroupIconDirEntryLayout::kSize));
+    if (!entry.valid())
+      return false;
+    const ResourceData* image = FindIconImage(table, entry.Get<GroupIconDirEntryLayout::Id>(), key.langId);
+    if (image == NULL || offset > MAXDWORD)
+      return false;
+
+    RecordWriter<IconDirEntryLayout> out(header.data() + IconDirLayout::kSize + i * IconDirEntryLayout::kSize);
+    out.Set<IconDirEntryLayout::Width>(entry.Get<GroupIconDirEntryLayout::Width>());
+    out.Set<IconDirEntryLayout::Height>(entry.Get<GroupIconDirEntryLayout::Height>());
+    out.Set<IconDirEntryLayout::ColorCount>(entry.Get<GroupIconDirEntryLayout::ColorCount>());
+    out.Set<IconDirEntryLayout::Reserved>(0);
+    out.Set<IconDirEntryLayout::Planes>(entry.Get<GroupIconDirEntryLayout::Planes>());
+    out.Set<IconDirEntryLayout::BitCount>(entry.Get<GroupIconDirEntryLayout::BitCount>());
+    out.Set<IconDirEntryLayout::BytesInRes>(static_cast<DWORD>(image->size));
+    out.Set<IconDirEntryLayout::ImageOffset>(static_cast<DWORD>(offset));
+    offset += image->size;
+    images.push_back(image);
+  }
+
+  if (!WriteAll(file, header.data(), header.size()))
+    return false;
+  for (const ResourceData* image : images) {
+    if (!WriteAll(file, image->data, image->size))
+      return false;
+  }
+  return true;
+}
+
+// Writes one resource to |path| straight from the image or the pending
+// buffers. Group icons are written as .ico files.
+bool ExtractTo(const ResourceTable& table, const ResourceKey& key, const ResourceData& data,
+               const std::wstring& path) {
+  ScopedFile out(path.c_str(), true, CREATE_ALWAYS);
+  if (out == INVALID_HANDLE_VALUE) {
+    fprintf(stderr, "Unable to create file: \"%ls\"\n", path.c_str());
+    return false;
+  }
+
+  if (key.type == ResourceId(RT_GROUP_ICON))
+    return WriteIconFile(out, table, key, ByteSpan(data.data, data.size));
+  return WriteAll(out, data.data, data.size);
+}
+
+// A file name for --extract-all, <type>_<name>_<lang> with the extension
+// of the content.
+std::wstring ExtractedFileName(const ResourceKey& key) {
+  std::wstring name;
+  for (const ResourceId* id : { &key.type, &key.name }) {
+    if (id->IsId()) {
+      name += std::to_wstring(id->id);
+    } else {
+      for (wchar_t c : id->name)
+        name += wcschr(L"\\/:*?\"<>|", c) != NULL || c < 0x20 ? L'_' : c;
+    }
+    name += L'_';
+  }
+  name += std::to_wstring(key.langId);
+
+  if (key.type == ResourceId(RT_GROUP_ICON))
+    return name + L".ico";
+  if (key.type == ResourceId(RT_MANIFEST))
+    return name + L".manifest";
+  return name + L".bin";
+}
+
+// How Commit places the resource section, and what it records first.
+struct LayoutOptions {
+  bool allowRelocate = false;
+  const DWORD* timestamp = NULL;  // NULL keeps the one of the image
+  const WCHAR* journalPath = NULL;
+  const WCHAR* planPath = NULL;
+  const std::map<std::wstring, DWORD>* planSlots = NULL;
+  IoBackend ioBackend = IoBackend::kSynchronous;
 };
 
+// Saves the plan for |options.planPath|, if any.
+bool RecordLayoutPlan(const LayoutOptions& options, const PEImage& image, const BYTE* data, size_t size,
+                      const std::vector<FilePatch>& patches, const FileMove& overlay, ULONGLONG newSize) {
+  if (options.planPath == NULL)
+    return true;
+
+  EditPlan plan;
+  return BuildPlan(image, data, size, patches, overlay, newSize, *options.planSlots, &plan) &&
+         WritePlan(options.planPath, plan);
+}
+
+// Writes |resources| over the resource section of |filename| with the
+// layout planner. |handled| is false when the image does not allow it and
+// the caller has to fall back to EndUpdateResourceW.
+bool WriteResourceLayout(const WCHAR* filename, const std::vector<PendingResource>& resources,
+                         const LayoutOptions& options, bool* handled) {
+  *handled = false;
+
+  std::vector<FilePatch> patches;
+  FileMove overlay;
+  ULONGLONG newSize = 0;
+  {
+    ScopedFile file(filename);
+    if (file == INVALID_HANDLE_VALUE)
+      return true;
+
+    ScopedFileMapping mapping(file);
+    if (mapping.data() == NULL)
+      return true;
+
+    PEImage image;
+    ResourceTable table;
+    if (!image.Parse(mapping.data(), mapping.size()) || !image.ReadResources(&table))
+      return true;
+
+    ApplyResources(resources, &table);
+    if (image.PlanResources(table, options.allowRelocate, options.timestamp, &patches, &overlay, &newSize) ==
+        PEImage::Placement::kNone)
+      return true;
+
+    // The journal is complete before the first byte of the file changes.
+    *handled = true;
+    if (options.journalPath != NULL) {
+      RevertJournal journal;
+      BuildJournal(mapping.data(), mapping.size(), patches, overlay, newSize, &journal);
+      if (!WriteJournal(options.journalPath, journal))
+        return false;
+    }
+    if (!RecordLayoutPlan(options, image, mapping.data(), mapping.size(), patches, overlay, newSize))
+      return false;
+  }
+
+  return WritePatches(filename, patches, overlay, newSize, options.ioBackend);
+}
+
+// Journals a file rewritten by EndUpdateResourceW, which may move anything,
+// as a whole.
+bool WriteFullJournal(const WCHAR* journalPath, const WCHAR* filename, std::vector<BYTE> original) {
+  ScopedFile file(filename);
+  ScopedFileMapping mapping(file);
+  if (mapping.data() == NULL)
+    return false;
+
+  RevertJournal journal;
+  JournalRange range;
+  journal.originalSize = original.size();
+  journal.committedSize = mapping.size();
+  journal.committedCrc = Crc32(mapping.data(), mapping.size());
+  range.length = mapping.size();
+  range.original = std::move(original);
+  journal.ranges.push_back(std::move(range));
+  return WriteJournal(journalPath, journal);
+}
+
+// Sends the bytes of |data| in [offset, end) to |sink|, padded with zeros
+// past the end of |data|.
+bool EmitImageRange(const BYTE* data, size_t size, ULONGLONG offset, ULONGLONG end,
+                    const ResourceUpdater::ByteSink& sink) {
+  static const BYTE kZeros[4096] = { 0 };
+  if (offset < size && offset < end) {
+    size_t length = static_cast<size_t>(std::min<ULONGLONG>(end, size) - offset);
+    if (!sink(data + offset, length))
+      return false;
+    offset += length;
+  }
+  while (offset < end) {
+    size_t length = static_cast<size_t>(std::min<ULONGLONG>(end - offset, sizeof(kZeros)));
+    if (!sink(kZeros, length))
+      return false;
+    offset += length;
+  }
+  return true;
+}
+
+// Sends the image updated by a layout plan to |sink| in file order, without
+// building it in memory first.
+bool EmitResourceLayout(const BYTE* data, size_t size, const std::vector<FilePatch>& patches,
+                        const FileMove& overlay, ULONGLONG newSize, const ResourceUpdater::ByteSink& sink) {
+  ULONGLONG position = 0;
+  for (const auto& patch : patches) {
+    if (!EmitImageRange(data, size, position, patch.offset, sink) ||
+        !sink(patch.bytes.data(), patch.bytes.size()))
+      return false;
+    position = patch.offset + patch.bytes.size();
+  }
+  if (overlay.to != overlay.from && overlay.size > 0) {
+    if (!EmitImageRange(data, size, position, overlay.to, sink) ||
+        !sink(data + overlay.from, static_cast<size_t>(overlay.size)))
+      return false;
+    position = overlay.to + overlay.size;
+  }
+  return EmitImageRange(data, size, position, newSize, sink);
+}
+
+// Counts the resources whose payload differs from the one in the image,
+// and tells whether the directories lack |timestamp|. Returns false when
+// the image cannot be read, in which case every resource has to be
+// assumed changed.
+bool CountChangedResources(const BYTE* data, size_t size, const std::vector<PendingResource>& resources,
+                           const DWORD* timestamp, size_t* changed, bool* restamp) {
+  PEImage image;
+  ResourceTable table;
+  if (data == NULL || !image.Parse(data, size) || !image.ReadResources(&table))
+    return false;
+
+  *changed = 0;
+  for (const auto& resource : resources) {
+    auto original = table.find({ resource.type, resource.name, resource.langId });
+    if (resource.Data() == nullptr) {
+      if (original != table.end())
+        ++*changed;
+    } else if (original == table.end() || original->second.size != resource.Size() ||
+               memcmp(original->second.data, resource.Data(), resource.Size()) != 0) {
+      ++*changed;
+    }
+  }
+
+  // A file with the wrong directory timestamp is written even when its
+  // resources are all the same.
+  DWORD current;
+  *restamp = timestamp != NULL && image.GetResourceTimestamp(&current) && current != *timestamp;
+  return true;
+}
+
 struct VersionStampValue {
   WORD valueLength = 0; // stringfileinfo, stringtable: 0; string: Value size in WORD; var: Value size in bytes
   WORD type = 0; // 0: binary data; 1: text data
@@ -116,11 +450,21 @@ struct VersionStampValue {
 
 }  // namespace
 
-VersionInfo::VersionInfo() {
+std::wstring ReadFileToString(const wchar_t* filename) {
+  std::vector<BYTE> buffer;
+  if (!ReadFileToBuffer(filename, &buffer)) {
+    return std::wstring();
+  }
+  return DecodeText(buffer.data(), buffer.size());
+}
+
+VersionInfo::VersionInfo(const allocator_type& alloc)
+    : stringTables(alloc), supportedTranslations(alloc) {
   FillDefaultData();
 }
 
-VersionInfo::VersionInfo(HMODULE hModule, WORD languageId) {
+VersionInfo::VersionInfo(HMODULE hModule, WORD languageId, const allocator_type& alloc)
+    : stringTables(alloc), supportedTranslations(alloc) {
   HRSRC hRsrc = FindResourceExW(hModule, RT_VERSION, MAKEINTRESOURCEW(1), languageId);
 
   if (hRsrc == NULL) {
@@ -146,6 +490,12 @@ VersionInfo::VersionInfo(HMODULE hModule, WORD languageId) {
   FillDefaultData();
 }
 
+VersionInfo::VersionInfo(const BYTE* data, size_t size, const allocator_type& alloc)
+    : stringTables(alloc), supportedTranslations(alloc) {
+  DeserializeVersionInfo(data, size);
+  FillDefaultData();
+}
+
 bool VersionInfo::HasFixedFileInfo() const {
   return fixedFileInfo_.dwSignature == 0xFEEF04BD;
 }
@@ -258,7 +608,7 @@ std::vector<BYTE> VersionInfo::Serialize() const {
 void VersionInfo::FillDefaultData() {
   if (stringTables.empty()) {
     Translate enUsTranslate = {kLangEnUs, kCodePageEnUs};
-    stringTables.push_back({enUsTranslate});
+    stringTables.emplace_back(enUsTranslate);
     supportedTranslations.push_back(enUsTranslate);
   }
   if (!HasFixedFileInfo()) {
@@ -269,69 +619,83 @@ void VersionInfo::FillDefaultData() {
 }
 
 void VersionInfo::DeserializeVersionInfo(const BYTE* pData, size_t size) {
-  auto pVersionInfo = reinterpret_cast<const VS_VERSION_ROOT*>(pData);
-  WORD fixedFileInfoSize = pVersionInfo->Header.wValueLength;
-
-  if (fixedFileInfoSize > 0)
-    SetFixedFileInfo(pVersionInfo->Info.Info);
+  VersionNode root;
+  if (!GetChildrenData(ByteSpan(pData, size), &root))
+    return;
+
+  // The value of the root is the VS_FIXEDFILEINFO, all DWORDs.
+  static_assert(sizeof(VS_FIXEDFILEINFO) % sizeof(DWORD) == 0, "VS_FIXEDFILEINFO is not DWORDs");
+  WORD fixedFileInfoSize = root.valueLength;
+  if (fixedFileInfoSize >= sizeof(VS_FIXEDFILEINFO) &&
+      root.children.Contains(0, sizeof(VS_FIXEDFILEINFO))) {
+    const size_t kFields = sizeof(VS_FIXEDFILEINFO) / sizeof(DWORD);
+    DWORD fields[kFields];
+    for (size_t i = 0; i < kFields; ++i)
+      fields[i] = LoadLittleEndian<DWORD>(root.children.data() + i * sizeof(DWORD));
+
+    VS_FIXEDFILEINFO info;
+    memcpy(&info, fields, sizeof(info));
+    SetFixedFileInfo(info);
+  }
 
-  const BYTE* fixedFileInfoEndOffset = reinterpret_cast<const BYTE*>(&pVersionInfo->Info.szKey) + (wcslen(pVersionInfo->Info.szKey) + 1) * sizeof(WCHAR) + fixedFileInfoSize;
-  const BYTE* pVersionInfoChildren = reinterpret_cast<const BYTE*>(round(reinterpret_cast<ptrdiff_t>(fixedFileInfoEndOffset)));
-  size_t versionInfoChildrenOffset = pVersionInfoChildren - pData;
-  size_t versionInfoChildrenSize = pVersionInfo->Header.wLength - versionInfoChildrenOffset;
+  ByteSpan children = root.children.Subspan(round<size_t>(fixedFileInfoSize));
+  for (size_t offset = 0; offset < children.size();) {
+    VersionNode child;
+    if (!GetChildrenData(children.Subspan(offset), &child))
+      break;
 
-  const auto childrenEndOffset = pVersionInfoChildren + versionInfoChildrenSize;
-  const auto resourceEndOffset = pData + size;
-  for (auto p = pVersionInfoChildren; p < childrenEndOffset && p < resourceEndOffset;) {
-    auto pKey = reinterpret_cast<const VS_VERSION_STRING*>(p)->szKey;
-    auto versionInfoChildData = GetChildrenData(p);
-    if (wcscmp(pKey, L"StringFileInfo") == 0) {
-      DeserializeVersionStringFileInfo(versionInfoChildData.first, versionInfoChildData.second, stringTables);
-    } else if (wcscmp(pKey, L"VarFileInfo") == 0) {
-      DeserializeVarFileInfo(versionInfoChildData.first, supportedTranslations);
+    if (child.key == L"StringFileInfo") {
+      DeserializeVersionStringFileInfo(child.children, stringTables);
+    } else if (child.key == L"VarFileInfo") {
+      DeserializeVarFileInfo(child.children, supportedTranslations);
     }
 
-    p += round(reinterpret_cast<const VS_VERSION_STRING*>(p)->Header.wLength);
+    offset += child.length;
   }
 }
 
-VersionStringTable VersionInfo::DeserializeVersionStringTable(const BYTE* tableData) {
-  auto strings = GetChildrenData(tableData);
-  auto stringTable = reinterpret_cast<const VS_VERSION_STRING*>(tableData);
-  auto end_ptr = const_cast<WCHAR*>(stringTable->szKey + (8 * sizeof(WCHAR)));
-  auto langIdCodePagePair = static_cast<DWORD>(wcstol(stringTable->szKey, &end_ptr, 16));
+void VersionInfo::DeserializeVersionStringTable(const VersionNode& table, VersionStringTable* tableEntry) {
+  // unicode string of 8 hex digits
+  auto langIdCodePagePair = static_cast<DWORD>(wcstoul(table.key.c_str(), NULL, 16));
 
-  VersionStringTable tableEntry;
+  tableEntry->encoding.wLanguage = langIdCodePagePair >> 16;
+  tableEntry->encoding.wCodePage = langIdCodePagePair;
 
-  // unicode string of 8 hex digits
-  tableEntry.encoding.wLanguage = langIdCodePagePair >> 16;
-  tableEntry.encoding.wCodePage = langIdCodePagePair;
+  for (size_t posStrings = 0; posStrings < table.children.size();) {
+    VersionNode stringEntry;
+    if (!GetChildrenData(table.children.Subspan(posStrings), &stringEntry))
+      break;
 
-  for (auto posStrings = 0U; posStrings < strings.second;) {
-    const auto stringEntry = reinterpret_cast<const VS_VERSION_STRING* const>(strings.first + posStrings);
-    const auto stringData = GetChildrenData(strings.first + posStrings);
-    tableEntry.strings.push_back(std::pair<std::wstring, std::wstring>(stringEntry->szKey, std::wstring(reinterpret_cast<const WCHAR* const>(stringData.first), stringEntry->Header.wValueLength)));
+    // wValueLength counts the terminator, which is not part of the value.
+    tableEntry->strings.emplace_back(stringEntry.key, L"");
+    std::pmr::wstring& value = tableEntry->strings.back().second;
+    stringEntry.children.ReadString(0, std::min<size_t>(stringEntry.valueLength, stringEntry.children.size() / sizeof(WCHAR)), &value);
+    value.resize(wcsnlen(value.c_str(), value.length()));
 
-    posStrings += round(stringEntry->Header.wLength);
+    posStrings += stringEntry.length;
   }
-
-  return tableEntry;
 }
 
-void VersionInfo::DeserializeVersionStringFileInfo(const BYTE* offset, size_t length, std::vector<VersionStringTable>& stringTables) {
-  for (auto posStringTables = 0U; posStringTables < length;) {
-    auto stringTableEntry = DeserializeVersionStringTable(offset + posStringTables);
-    stringTables.push_back(stringTableEntry);
-    posStringTables += round(reinterpret_cast<const VS_VERSION_STRING*>(offset + posStringTables)->Header.wLength);
+void VersionInfo::DeserializeVersionStringFileInfo(ByteSpan children, std::pmr::vector<VersionStringTable>& stringTables) {
+  for (size_t posStringTables = 0; posStringTables < children.size();) {
+    VersionNode stringTable;
+    if (!GetChildrenData(children.Subspan(posStringTables), &stringTable))
+      break;
+
+    stringTables.emplace_back();
+    DeserializeVersionStringTable(stringTable, &stringTables.back());
+    posStringTables += stringTable.length;
   }
 }
 
-void VersionInfo::DeserializeVarFileInfo(const unsigned char* offset, std::vector<Translate>& translations) {
-  const auto translatePairs = GetChildrenData(offset);
+void VersionInfo::DeserializeVarFileInfo(ByteSpan children, std::pmr::vector<Translate>& translations) {
+  VersionNode translation;
+  if (!GetChildrenData(children, &translation))
+    return;
 
-  const auto top = reinterpret_cast<const DWORD* const>(translatePairs.first);
-  for (auto pTranslatePair = top; pTranslatePair < top + translatePairs.second; pTranslatePair += sizeof(DWORD)) {
-    auto codePageLangIdPair = *pTranslatePair;
+  ByteSpan translatePairs = translation.children.Subspan(0, translation.valueLength);
+  for (size_t offset = 0; translatePairs.Contains(offset, sizeof(DWORD)); offset += sizeof(DWORD)) {
+    auto codePageLangIdPair = LoadLittleEndian<DWORD>(translatePairs.data() + offset);
     Translate translate;
     translate.wLanguage = codePageLangIdPair;
     translate.wCodePage = codePageLangIdPair >> 16;
@@ -339,20 +703,28 @@ void VersionInfo::DeserializeVarFileInfo(const unsigned char* offset, std::vecto
   }
 }
 
-OffsetLengthPair VersionInfo::GetChildrenData(const BYTE* entryData) {
-  auto entry = reinterpret_cast<const VS_VERSION_STRING*>(entryData);
-  auto headerOffset = entryData;
-  auto headerSize = sizeof(VS_VERSION_HEADER);
-  auto keySize = (wcslen(entry->szKey) + 1) * sizeof(WCHAR);
-  auto childrenOffset = round(headerSize + keySize);
+bool VersionInfo::GetChildrenData(ByteSpan entryData, VersionNode* node) {
+  RecordView<VersionHeaderLayout> header(entryData);
+  if (!header.valid())
+    return false;
+
+  WORD length = header.Get<VersionHeaderLayout::Length>();
+  if (length < VersionHeaderLayout::kSize || length > entryData.size())
+    return false;
+
+  ByteSpan entry = entryData.Subspan(0, length);
+  size_t keyEnd = 0;
+  if (!entry.ReadString(VersionHeaderLayout::kSize, &node->key, &keyEnd))
+    return false;
 
-  auto pChildren = headerOffset + childrenOffset;
-  auto childrenSize = entry->Header.wLength - childrenOffset;
-  return OffsetLengthPair(pChildren, childrenSize);
+  node->valueLength = header.Get<VersionHeaderLayout::ValueLength>();
+  node->children = entry.Subspan(round(keyEnd));
+  node->length = round<size_t>(length);
+  return true;
 }
 
 size_t VersionStampValue::GetLength() const {
-  size_t bytes = sizeof(VS_VERSION_HEADER);
+  size_t bytes = VersionHeaderLayout::kSize;
   bytes += static_cast<size_t>(key.length() + 1) * sizeof(WCHAR);
   if (!value.empty())
     bytes = round(bytes) + value.size();
@@ -366,9 +738,11 @@ std::vector<BYTE> VersionStampValue::Serialize() const {
 
   size_t offset = 0;
 
-  VS_VERSION_HEADER header = { static_cast<WORD>(data.size()), valueLength, type };
-  memcpy(&data[offset], &header, sizeof(header));
-  offset += sizeof(header);
+  RecordWriter<VersionHeaderLayout> header(&data[offset]);
+  header.Set<VersionHeaderLayout::Length>(static_cast<WORD>(data.size()));
+  header.Set<VersionHeaderLayout::ValueLength>(valueLength);
+  header.Set<VersionHeaderLayout::Type>(type);
+  offset += VersionHeaderLayout::kSize;
 
   auto keySize = static_cast<size_t>(key.length() + 1) * sizeof(WCHAR);
   memcpy(&data[offset], key.c_str(), keySize);
@@ -391,7 +765,15 @@ std::vector<BYTE> VersionStampValue::Serialize() const {
   return std::move(data);
 }
 
-ResourceUpdater::ResourceUpdater() : module_(NULL) {
+ResourceUpdater::ResourceUpdater()
+    : module_(NULL), versionStampMap_(&arena_), stringTableMap_(&arena_), iconBundleMap_(&arena_),
+      tree_(&arena_) {
+  using namespace std::placeholders;
+  SetDecoder(RT_VERSION, std::bind(&ResourceUpdater::DecodeVersion, this, _1, _2, _3));
+  SetDecoder(RT_STRING, std::bind(&ResourceUpdater::DecodeStringTable, this, _1, _2, _3));
+  SetDecoder(RT_ICON, std::bind(&ResourceUpdater::DecodeIcon, this, _1, _2, _3));
+  SetDecoder(RT_GROUP_ICON, std::bind(&ResourceUpdater::DecodeIconGroup, this, _1, _2, _3));
+  SetDecoder(RT_MANIFEST, std::bind(&ResourceUpdater::DecodeManifest, this, _1, _2, _3));
 }
 
 ResourceUpdater::~ResourceUpdater() {
@@ -413,216 +795,626 @@ bool ResourceUpdater::Load(const WCHAR* filename) {
   }
 
   this->filename_ = filename;
+  image_.reset();
 
-  EnumResourceNamesW(module_, RT_STRING, OnEnumResourceName, reinterpret_cast<LONG_PTR>(this));
-  EnumResourceNamesW(module_, RT_VERSION, OnEnumResourceName, reinterpret_cast<LONG_PTR>(this));
-  EnumResourceNamesW(module_, RT_GROUP_ICON, OnEnumResourceName, reinterpret_cast<LONG_PTR>(this));
-  EnumResourceNamesW(module_, RT_ICON, OnEnumResourceName, reinterpret_cast<LONG_PTR>(this));
-  EnumResourceNamesW(module_, RT_MANIFEST, OnEnumResourceManifest, reinterpret_cast<LONG_PTR>(this));
-  EnumResourceNamesW(module_, RT_RCDATA, OnEnumResourceName, reinterpret_cast<LONG_PTR>(this));
+  SourceImage source(filename_, image_);
+  return LoadResources(source.data(), source.size());
+}
 
-  return true;
+bool ResourceUpdater::LoadFromMemory(const BYTE* data, size_t size) {
+  return LoadFromMemory(std::vector<BYTE>(data, data + size));
 }
 
-bool ResourceUpdater::SetExecutionLevel(const WCHAR* value) {
-  executionLevel_ = value;
-  return true;
+bool ResourceUpdater::LoadFromMemory(std::vector<BYTE> image) {
+  return LoadFromMemory(std::make_shared<const std::vector<BYTE>>(std::move(image)));
 }
 
-bool ResourceUpdater::IsExecutionLevelSet() {
-  return !executionLevel_.empty();
+bool ResourceUpdater::LoadFromMemory(std::shared_ptr<const std::vector<BYTE>> image) {
+  filename_.clear();
+  image_ = std::move(image);
+  return LoadResources(image_->data(), image_->size());
 }
 
-bool ResourceUpdater::SetApplicationManifest(const WCHAR* value) {
-  applicationManifestPath_ = value;
+bool ResourceUpdater::LoadResources(const BYTE* data, size_t size) {
+  // Read every resource into the tree, then let the typed models decode
+  // the types they know. The table is only needed while loading.
+  std::pmr::monotonic_buffer_resource scratch;
+  PEImage image;
+  ResourceTable table(&scratch);
+  if (data == NULL || !image.Parse(data, size) || !image.ReadResources(&table)) {
+    return false;
+  }
+
+  for (const auto& i : table) {
+    AddLoadedResource(i.first, i.second.data, i.second.size);
+  }
+
   return true;
 }
 
-bool ResourceUpdater::IsApplicationManifestSet() {
-  return !applicationManifestPath_.empty();
+void ResourceUpdater::AddLoadedResource(const ResourceKey& key, const BYTE* data, size_t size) {
+  // An image loaded from memory lives as long as the updater and may be
+  // shared with others, so the tree refers to it; a mapped file is
+  // unmapped once loading is done.
+  if (image_)
+    tree_.Borrow(key, data, size);
+  else
+    tree_.Insert(key, data, size);
+  Decode(key, data, size);
 }
 
-bool ResourceUpdater::SetVersionString(WORD languageId, const WCHAR* name, const WCHAR* value) {
-  std::wstring nameStr(name);
-  std::wstring valueStr(value);
+bool ResourceUpdater::ReloadTypes(const std::set<ResourceId>& types) {
+  // The icon model spans the groups and the images they refer to.
+  std::set<ResourceId> reload = types;
+  if (reload.count(RT_ICON) != 0 || reload.count(RT_GROUP_ICON) != 0) {
+    reload.insert(RT_ICON);
+    reload.insert(RT_GROUP_ICON);
+  }
 
-  auto& stringTables = versionStampMap_[languageId].stringTables;
-  for (auto j = stringTables.begin(); j != stringTables.end(); ++j) {
-    auto& stringPairs = j->strings;
-    for (auto k = stringPairs.begin(); k != stringPairs.end(); ++k) {
-      if (k->first == nameStr) {
-        k->second = valueStr;
-        return true;
-      }
+  SourceImage source(filename_, image_);
+  std::pmr::monotonic_buffer_resource scratch;
+  PEImage image;
+  ResourceTable table(&scratch);
+  if (source.data() == NULL || !image.Parse(source.data(), source.size()) ||
+      !image.ReadResources(&table)) {
+    return false;
+  }
+
+  for (const auto& type : reload) {
+    tree_.Reset(type);
+    if (type == ResourceId(RT_VERSION)) {
+      versionStampMap_.clear();
+    } else if (type == ResourceId(RT_STRING)) {
+      stringTableMap_.clear();
+    } else if (type == ResourceId(RT_GROUP_ICON)) {
+      iconBundleMap_.clear();
+    } else if (type == ResourceId(RT_MANIFEST)) {
+      executionLevel_.clear();
+      originalExecutionLevel_.clear();
+      applicationManifestPath_.clear();
+      manifestString_.clear();
     }
+  }
 
-    // Not found, append one for all tables.
-    stringPairs.push_back(VersionString(nameStr, valueStr));
+  for (const auto& i : table) {
+    if (reload.count(i.first.type) != 0)
+      AddLoadedResource(i.first, i.second.data, i.second.size);
   }
 
   return true;
 }
 
-bool ResourceUpdater::SetVersionString(const WCHAR* name, const WCHAR* value) {
-  LANGID langId = versionStampMap_.empty() ? kLangEnUs
-                                           : versionStampMap_.begin()->first;
-  return SetVersionString(langId, name, value);
+void ResourceUpdater::SelectDefaultLanguage() {
+  languageSelection_ = LanguageSelection::kDefault;
 }
 
-const WCHAR* ResourceUpdater::GetVersionString(WORD languageId, const WCHAR* name) {
-  std::wstring nameStr(name);
+void ResourceUpdater::SelectLanguage(LANGID languageId) {
+  languageSelection_ = LanguageSelection::kSingle;
+  selectedLanguage_ = languageId;
+}
 
-  const auto& stringTables = versionStampMap_[languageId].stringTables;
-  for (const auto& j : stringTables) {
-    const auto& stringPairs = j.strings;
-    for (const auto& k : stringPairs) {
-      if (k.first == nameStr) {
-        return k.second.c_str();
-      }
-    }
-  }
+void ResourceUpdater::SelectAllLanguages() {
+  languageSelection_ = LanguageSelection::kAll;
+}
 
-  return NULL;
+bool ResourceUpdater::IsDefaultLanguageSelected() const {
+  return languageSelection_ == LanguageSelection::kDefault;
 }
 
-const WCHAR* ResourceUpdater::GetVersionString(const WCHAR* name) {
-  if (versionStampMap_.empty()) {
-    return NULL;
-  } else {
-    return GetVersionString(versionStampMap_.begin()->first, name);
+template<typename Map>
+std::vector<LANGID> ResourceUpdater::SelectedLanguages(const Map& map) const {
+  std::vector<LANGID> languages;
+  switch (languageSelection_) {
+    case LanguageSelection::kSingle:
+      languages.push_back(selectedLanguage_);
+      break;
+    case LanguageSelection::kAll:
+      for (const auto& i : map)
+        languages.push_back(i.first);
+      break;
+    case LanguageSelection::kDefault:
+      break;
   }
+
+  // Fall back to the first language, or en-us for a resource type that
+  // does not exist yet.
+  if (languages.empty())
+    languages.push_back(map.empty() ? kLangEnUs : map.begin()->first);
+  return languages;
 }
 
-bool ResourceUpdater::SetProductVersion(WORD languageId, UINT id, unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
-  VersionInfo& versionInfo = versionStampMap_[languageId];
-  if (!versionInfo.HasFixedFileInfo()) {
-    return false;
-  }
+std::vector<LANGID> ResourceUpdater::GetVersionLanguages() const {
+  return SelectedLanguages(versionStampMap_);
+}
 
-  VS_FIXEDFILEINFO& root = versionInfo.GetFixedFileInfo();
+std::vector<LANGID> ResourceUpdater::GetStringTableLanguages() const {
+  return SelectedLanguages(stringTableMap_);
+}
 
-  root.dwProductVersionMS = v1 << 16 | v2;
-  root.dwProductVersionLS = v3 << 16 | v4;
+bool ResourceUpdater::SetExecutionLevel(const WCHAR* value) {
+  executionLevel_ = value;
+  return true;
+}
+
+const WCHAR* ResourceUpdater::GetExecutionLevel() {
+  if (!executionLevel_.empty())
+    return executionLevel_.c_str();
+  if (!originalExecutionLevel_.empty())
+    return originalExecutionLevel_.c_str();
+  return NULL;
+}
+
+bool ResourceUpdater::IsExecutionLevelSet() {
+  return !executionLevel_.empty();
+}
 
+bool ResourceUpdater::SetApplicationManifest(const WCHAR* value) {
+  applicationManifestPath_ = value;
   return true;
 }
 
-bool ResourceUpdater::SetProductVersion(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
-  LANGID langId = versionStampMap_.empty() ? kLangEnUs
-                                           : versionStampMap_.begin()->first;
-  return SetProductVersion(langId, 1, v1, v2, v3, v4);
+bool ResourceUpdater::IsApplicationManifestSet() {
+  return !applicationManifestPath_.empty();
 }
 
-bool ResourceUpdater::SetFileVersion(WORD languageId, UINT id, unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
-  VersionInfo& versionInfo = versionStampMap_[languageId];
-  if (!versionInfo.HasFixedFileInfo()) {
+bool ResourceUpdater::ImportRes(const WCHAR* path) {
+  ScopedFile file(path);
+  if (file == INVALID_HANDLE_VALUE) {
     return false;
   }
 
-  VS_FIXEDFILEINFO& root = versionInfo.GetFixedFileInfo();
+  ScopedFileMapping mapping(file);
+  if (mapping.data() == NULL) {
+    return false;
+  }
 
-  root.dwFileVersionMS = v1 << 16 | v2;
-  root.dwFileVersionLS = v3 << 16 | v4;
-  return true;
+  ResFileReader reader(mapping.data(), mapping.size());
+  ResEntry entry;
+  while (reader.Next(&entry)) {
+    tree_.Set(entry.key, entry.data, entry.size);
+    Decode(entry.key, entry.data, entry.size);
+  }
+  return !reader.failed();
 }
 
-bool ResourceUpdater::SetFileVersion(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
-  LANGID langId = versionStampMap_.empty() ? kLangEnUs
-                                           : versionStampMap_.begin()->first;
-  return SetFileVersion(langId, 1, v1, v2, v3, v4);
-}
+bool ResourceUpdater::ExportRes(const WCHAR* path) {
+  std::vector<PendingResource> resources;
+  SourceImage source(filename_, image_);
+  ResourceTable table;
+  if (!ReadCommittedResources(source.data(), source.size(), &resources, &table)) {
+    return false;
+  }
 
-bool ResourceUpdater::ChangeString(WORD languageId, UINT id, const WCHAR* value) {
-  StringTable& table = stringTableMap_[languageId];
+  // The payloads are written straight from the image and the pending
+  // buffers.
+  ScopedFile out(path, true, CREATE_ALWAYS);
+  if (out == INVALID_HANDLE_VALUE) {
+    return false;
+  }
 
-  UINT blockId = id / 16;
-  if (table.find(blockId) == table.end()) {
-    // Fill the table until we reach the block.
-    for (size_t i = table.size(); i <= blockId; ++i) {
-      table[i] = std::vector<std::wstring>(16);
+  ResFileWriter writer(out);
+  if (!writer.Begin()) {
+    return false;
+  }
+  for (const auto& i : table) {
+    if (!writer.Write(i.first, i.second.data, i.second.size)) {
+      return false;
     }
   }
-
-  assert(table[blockId].size() == 16);
-  UINT blockIndex = id % 16;
-  table[blockId][blockIndex] = value;
-
   return true;
 }
 
-bool ResourceUpdater::ChangeString(UINT id, const WCHAR* value) {
-  LANGID langId = stringTableMap_.empty() ? kLangEnUs
-                                          : stringTableMap_.begin()->first;
-  return ChangeString(langId, id, value);
-}
+bool ResourceUpdater::ExtractResource(const ResourceId& type, const ResourceId& name, WORD languageId,
+                                      const WCHAR* path) {
+  std::vector<PendingResource> resources;
+  SourceImage source(filename_, image_);
+  ResourceTable table;
+  if (!ReadCommittedResources(source.data(), source.size(), &resources, &table)) {
+    return false;
+  }
 
-bool ResourceUpdater::ChangeRcData(UINT id, const WCHAR* pathToResource) {
-  auto rcDataLngPairIt = std::find_if(rcDataLngMap_.begin(), rcDataLngMap_.end(), [=](const auto& rcDataLngPair) {
-    return rcDataLngPair.second.find(id) != rcDataLngPair.second.end();
-  });
+  ResourceKey key = { type, name, languageId };
+  auto i = table.find(key);
+  if (i == table.end()) {
+    return false;
+  }
+  return ExtractTo(table, i->first, i->second, path);
+}
 
-  if (rcDataLngPairIt == rcDataLngMap_.end()) {
-    fprintf(stderr, "Cannot find RCDATA with id '%u'\n", id);
+bool ResourceUpdater::ExtractResource(const ResourceId& type, const ResourceId& name, const WCHAR* path) {
+  std::vector<PendingResource> resources;
+  SourceImage source(filename_, image_);
+  ResourceTable table;
+  if (!ReadCommittedResources(source.data(), source.size(), &resources, &table)) {
     return false;
   }
 
-  wchar_t abspath[MAX_PATH] = { 0 };
-  const auto filePath = _wfullpath(abspath, pathToResource, MAX_PATH) ? abspath : pathToResource;
-  ScopedFile newRcDataFile(filePath);
-  if (newRcDataFile == INVALID_HANDLE_VALUE) {
-    fprintf(stderr, "Cannot open new data file '%ws'\n", filePath);
+  // The first language the resource has.
+  ResourceKey key = { type, name, 0 };
+  auto i = table.lower_bound(key);
+  if (i == table.end() || !(i->first.type == type) || !(i->first.name == name)) {
     return false;
   }
+  return ExtractTo(table, i->first, i->second, path);
+}
 
-  const auto dwFileSize = GetFileSize(newRcDataFile, NULL);
-  if (dwFileSize == INVALID_FILE_SIZE) {
-    fprintf(stderr, "Cannot get file size for '%ws'\n", filePath);
+bool ResourceUpdater::ExtractAllResources(const WCHAR* directory) {
+  std::vector<PendingResource> resources;
+  SourceImage source(filename_, image_);
+  ResourceTable table;
+  if (!ReadCommittedResources(source.data(), source.size(), &resources, &table)) {
     return false;
   }
 
-  auto& rcData = rcDataLngPairIt->second[id];
-  rcData.clear();
-  rcData.resize(dwFileSize);
-
-  DWORD dwBytesRead{ 0 };
-  if (!ReadFile(newRcDataFile, rcData.data(), dwFileSize, &dwBytesRead, NULL)) {
-    fprintf(stderr, "Cannot read file '%ws'\n", filePath);
-    return false;
+  if (!CreateDirectoryW(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+    return false;
   }
 
-  return true;
+  // Every job writes its own file from the shared, read-only table.
+  std::vector<std::function<bool()>> jobs;
+  for (const auto& i : table) {
+    std::wstring path = std::wstring(directory) + L"\\" + ExtractedFileName(i.first);
+    const ResourceTable* resourceTable = &table;
+    const auto* entry = &i;
+    jobs.push_back([resourceTable, entry, path]() {
+      return ExtractTo(*resourceTable, entry->first, entry->second, path);
+    });
+  }
+  return RunParallel(jobs);
 }
 
-const WCHAR* ResourceUpdater::GetString(WORD languageId, UINT id) {
-  StringTable& table = stringTableMap_[languageId];
+bool ResourceUpdater::ReadCommittedResources(const BYTE* data, size_t size,
+                                             std::vector<PendingResource>* resources,
+                                             ResourceTable* table) {
+  if (!SerializeResources(resources)) {
+    return false;
+  }
 
-  UINT blockId = id / 16;
-  if (table.find(blockId) == table.end()) {
-    // Fill the table until we reach the block.
-    for (size_t i = table.size(); i <= blockId; ++i) {
-      table[i] = std::vector<std::wstring>(16);
-    }
+  PEImage image;
+  if (data == NULL || !image.Parse(data, size) || !image.ReadResources(table)) {
+    return false;
   }
+  ApplyResources(*resources, table);
+  return true;
+}
 
-  assert(table[blockId].size() == 16);
-  UINT blockIndex = id % 16;
+void ResourceUpdater::SetLayoutStrategy(LayoutStrategy strategy) {
+  layoutStrategy_ = strategy;
+}
 
-  return table[blockId][blockIndex].c_str();
+void ResourceUpdater::SetJournal(const WCHAR* path) {
+  journalPath_ = path;
 }
 
-const WCHAR* ResourceUpdater::GetString(UINT id) {
-  LANGID langId = stringTableMap_.empty() ? kLangEnUs
-    : stringTableMap_.begin()->first;
-  return GetString(langId, id);
+void ResourceUpdater::SetIoBackend(IoBackend backend) {
+  ioBackend_ = backend;
 }
 
-bool ResourceUpdater::SetIcon(const WCHAR* path, const LANGID& langId,
-                              UINT iconBundle) {
-  std::unique_ptr<IconsValue>& pIcon = iconBundleMap_[langId].iconBundles[iconBundle];
-  if (!pIcon)
-    pIcon = std::make_unique<IconsValue>();
+void ResourceUpdater::SetResourceTimestamp(DWORD timestamp) {
+  hasResourceTimestamp_ = true;
+  resourceTimestamp_ = timestamp;
+}
 
-  auto& icon = *pIcon;
+void ResourceUpdater::SetDeterministic() {
+  deterministic_ = true;
+}
+
+void ResourceUpdater::RecordPlan(const WCHAR* path) {
+  planPath_ = path;
+}
+
+void ResourceUpdater::AddPlanSlot(const WCHAR* key, DWORD capacity) {
+  planSlots_[key] = capacity;
+}
+
+bool ResourceUpdater::ReservePlanSlots() {
+  if (planPath_.empty()) {
+    return true;
+  }
+
+  // Every string table gets the key, padded with zeros so a replayed value
+  // of up to |capacity| characters lands on the same bytes.
+  for (const auto& slot : planSlots_) {
+    if (versionStampMap_.empty()) {
+      versionStampMap_[kLangEnUs];
+    }
+    for (auto& i : versionStampMap_) {
+      i.second.dirty = true;
+      for (auto& table : i.second.info.stringTables) {
+        auto entry = std::find_if(table.strings.begin(), table.strings.end(),
+                                  [&](const VersionString& string) { return string.first == slot.first.c_str(); });
+        if (entry == table.strings.end()) {
+          table.strings.emplace_back(slot.first, L"");
+          entry = table.strings.end() - 1;
+        }
+
+        std::pmr::wstring& value = entry->second;
+        value.resize(wcsnlen(value.c_str(), value.length()));
+        if (value.length() > slot.second) {
+          fprintf(stderr, "The value of \"%ls\" is longer than the %lu characters of its slot\n",
+                  slot.first.c_str(), static_cast<unsigned long>(slot.second));
+          return false;
+        }
+        value.resize(slot.second, L'\0');
+      }
+    }
+  }
+
+  // Lengths in a version resource are WORDs, so the padded resources still
+  // have to fit in 64 KB.
+  for (const auto& i : versionStampMap_) {
+    if (i.second.info.Serialize().size() > 0xffff) {
+      fprintf(stderr, "The plan slots make the version resource larger than 64 KB\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+const DWORD* ResourceUpdater::ResourceTimestamp() const {
+  static const DWORD kZero = 0;
+  if (hasResourceTimestamp_) {
+    return &resourceTimestamp_;
+  }
+  return deterministic_ ? &kZero : NULL;
+}
+
+bool ResourceUpdater::SetVersionString(WORD languageId, const WCHAR* name, const WCHAR* value) {
+  VersionStamp& stamp = versionStampMap_[languageId];
+  stamp.dirty = true;
+  auto& stringTables = stamp.info.stringTables;
+  for (auto j = stringTables.begin(); j != stringTables.end(); ++j) {
+    auto& stringPairs = j->strings;
+    for (auto k = stringPairs.begin(); k != stringPairs.end(); ++k) {
+      if (k->first == name) {
+        k->second = value;
+        return true;
+      }
+    }
+
+    // Not found, append one for all tables.
+    stringPairs.emplace_back(name, value);
+  }
+
+  return true;
+}
+
+bool ResourceUpdater::SetVersionString(const WCHAR* name, const WCHAR* value) {
+  for (LANGID langId : SelectedLanguages(versionStampMap_)) {
+    if (!SetVersionString(langId, name, value))
+      return false;
+  }
+  return true;
+}
+
+const WCHAR* ResourceUpdater::GetVersionString(WORD languageId, const WCHAR* name) {
+  auto iVersionInfo = versionStampMap_.find(languageId);
+  if (iVersionInfo == versionStampMap_.end()) {
+    return NULL;
+  }
+
+  const auto& stringTables = iVersionInfo->second.info.stringTables;
+  for (const auto& j : stringTables) {
+    const auto& stringPairs = j.strings;
+    for (const auto& k : stringPairs) {
+      if (k.first == name) {
+        return k.second.c_str();
+      }
+    }
+  }
+
+  return NULL;
+}
+
+const WCHAR* ResourceUpdater::GetVersionString(const WCHAR* name) {
+  if (versionStampMap_.empty()) {
+    return NULL;
+  } else {
+    return GetVersionString(SelectedLanguages(versionStampMap_).front(), name);
+  }
+}
+
+bool ResourceUpdater::GetProductVersion(WORD languageId, unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4) {
+  auto iVersionInfo = versionStampMap_.find(languageId);
+  if (iVersionInfo == versionStampMap_.end() || !iVersionInfo->second.info.HasFixedFileInfo()) {
+    return false;
+  }
+
+  const VS_FIXEDFILEINFO& root = iVersionInfo->second.info.GetFixedFileInfo();
+
+  *v1 = HIWORD(root.dwProductVersionMS);
+  *v2 = LOWORD(root.dwProductVersionMS);
+  *v3 = HIWORD(root.dwProductVersionLS);
+  *v4 = LOWORD(root.dwProductVersionLS);
+  return true;
+}
+
+bool ResourceUpdater::GetProductVersion(unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4) {
+  if (versionStampMap_.empty()) {
+    return false;
+  } else {
+    return GetProductVersion(SelectedLanguages(versionStampMap_).front(), v1, v2, v3, v4);
+  }
+}
+
+bool ResourceUpdater::GetFileVersion(WORD languageId, unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4) {
+  auto iVersionInfo = versionStampMap_.find(languageId);
+  if (iVersionInfo == versionStampMap_.end() || !iVersionInfo->second.info.HasFixedFileInfo()) {
+    return false;
+  }
+
+  const VS_FIXEDFILEINFO& root = iVersionInfo->second.info.GetFixedFileInfo();
+
+  *v1 = HIWORD(root.dwFileVersionMS);
+  *v2 = LOWORD(root.dwFileVersionMS);
+  *v3 = HIWORD(root.dwFileVersionLS);
+  *v4 = LOWORD(root.dwFileVersionLS);
+  return true;
+}
+
+bool ResourceUpdater::GetFileVersion(unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4) {
+  if (versionStampMap_.empty()) {
+    return false;
+  } else {
+    return GetFileVersion(SelectedLanguages(versionStampMap_).front(), v1, v2, v3, v4);
+  }
+}
+
+bool ResourceUpdater::SetProductVersion(WORD languageId, UINT id, unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
+  VersionStamp& stamp = versionStampMap_[languageId];
+  VersionInfo& versionInfo = stamp.info;
+  if (!versionInfo.HasFixedFileInfo()) {
+    return false;
+  }
+  stamp.dirty = true;
+
+  VS_FIXEDFILEINFO& root = versionInfo.GetFixedFileInfo();
+
+  root.dwProductVersionMS = v1 << 16 | v2;
+  root.dwProductVersionLS = v3 << 16 | v4;
+
+  return true;
+}
+
+bool ResourceUpdater::SetProductVersion(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
+  for (LANGID langId : SelectedLanguages(versionStampMap_)) {
+    if (!SetProductVersion(langId, 1, v1, v2, v3, v4))
+      return false;
+  }
+  return true;
+}
+
+bool ResourceUpdater::SetFileVersion(WORD languageId, UINT id, unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
+  VersionStamp& stamp = versionStampMap_[languageId];
+  VersionInfo& versionInfo = stamp.info;
+  if (!versionInfo.HasFixedFileInfo()) {
+    return false;
+  }
+  stamp.dirty = true;
+
+  VS_FIXEDFILEINFO& root = versionInfo.GetFixedFileInfo();
+
+  root.dwFileVersionMS = v1 << 16 | v2;
+  root.dwFileVersionLS = v3 << 16 | v4;
+  return true;
+}
+
+bool ResourceUpdater::SetFileVersion(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4) {
+  for (LANGID langId : SelectedLanguages(versionStampMap_)) {
+    if (!SetFileVersion(langId, 1, v1, v2, v3, v4))
+      return false;
+  }
+  return true;
+}
+
+bool ResourceUpdater::ChangeString(WORD languageId, UINT id, const WCHAR* value) {
+  if (id / kStringsPerBlock >= kStringBlockCount || wcslen(value) > 0xffff)
+    return false;
+
+  StringBlock* block = FindStringBlock(languageId, id / kStringsPerBlock, true);
+  block->values[id % kStringsPerBlock] = value;
+  block->dirty = true;
+  return true;
+}
+
+bool ResourceUpdater::ChangeString(UINT id, const WCHAR* value) {
+  for (LANGID langId : SelectedLanguages(stringTableMap_)) {
+    if (!ChangeString(langId, id, value))
+      return false;
+  }
+  return true;
+}
+
+bool ResourceUpdater::ChangeStrings(const WCHAR* pathToStringList) {
+  std::vector<BYTE> data;
+  std::vector<StringEntry> entries;
+  if (!ReadFileToBuffer(pathToStringList, &data) ||
+      !ParseStringList(DecodeText(data.data(), data.size()), &entries)) {
+    return false;
+  }
+
+  // Resolve the selection once, so the languages named by the list do not
+  // change the default language halfway through.
+  std::vector<LANGID> selected = SelectedLanguages(stringTableMap_);
+  for (const auto& entry : entries) {
+    if (entry.hasLangId) {
+      if (!ChangeString(entry.langId, entry.id, entry.value.c_str()))
+        return false;
+      continue;
+    }
+    for (LANGID langId : selected) {
+      if (!ChangeString(langId, entry.id, entry.value.c_str()))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool ResourceUpdater::ChangeRcData(UINT id, const WCHAR* pathToResource) {
+  return ChangeRcData(ResourceId(static_cast<WORD>(id)), pathToResource);
+}
+
+bool ResourceUpdater::ChangeRcData(const ResourceId& id, const WCHAR* pathToResource) {
+  if (tree_.Find(RT_RCDATA, id) == NULL) {
+    if (id.IsId())
+      fprintf(stderr, "Cannot find RCDATA with id '%u'\n", id.id);
+    else
+      fprintf(stderr, "Cannot find RCDATA with name '%ws'\n", id.name.c_str());
+    return false;
+  }
+
+  return SetResource(RT_RCDATA, id, pathToResource);
+}
+
+bool ResourceUpdater::SetResource(const ResourceId& type, const ResourceId& name, WORD languageId,
+                                  const BYTE* data, size_t size) {
+  tree_.Set({ type, name, languageId }, data, size);
+  return true;
+}
+
+bool ResourceUpdater::SetResource(const ResourceId& type, const ResourceId& name, const WCHAR* pathToResource) {
+  std::vector<BYTE> data;
+  if (!ReadFileToBuffer(pathToResource, &data)) {
+    return false;
+  }
+
+  const ResourceLanguages* languages = tree_.Find(type, name);
+  for (LANGID langId : SelectedLanguages(languages ? *languages : ResourceLanguages())) {
+    if (!SetResource(type, name, langId, data.data(), data.size()))
+      return false;
+  }
+  return true;
+}
+
+const ByteSpan* ResourceUpdater::GetResource(const ResourceId& type, const ResourceId& name,
+                                                      WORD languageId) const {
+  return tree_.Find({ type, name, languageId });
+}
+
+bool ResourceUpdater::DeleteResource(const ResourceId& type, const ResourceId& name, WORD languageId) {
+  return tree_.Erase({ type, name, languageId });
+}
+
+void ResourceUpdater::SetDecoder(const ResourceId& type, ResourceDecoder decoder) {
+  decoders_[type] = decoder;
+}
+
+const WCHAR* ResourceUpdater::GetString(WORD languageId, UINT id) {
+  StringBlock* block = FindStringBlock(languageId, id / kStringsPerBlock, false);
+  if (block == NULL)
+    return NULL;
+
+  return block->values[id % kStringsPerBlock].c_str();
+}
+
+const WCHAR* ResourceUpdater::GetString(UINT id) {
+  return GetString(SelectedLanguages(stringTableMap_).front(), id);
+}
+
+bool ResourceUpdater::SetIcon(const WCHAR* path, const LANGID& langId,
+                              UINT iconBundle) {
+  IconsValue& icon = iconBundleMap_[langId].iconBundles[iconBundle];
+  icon.replaced = true;
   DWORD bytes;
 
   ScopedFile file(path);
@@ -632,22 +1424,42 @@ bool ResourceUpdater::SetIcon(const WCHAR* path, const LANGID& langId,
   }
 
   IconsValue::ICONHEADER& header = icon.header;
-  if (!ReadFile(file, &header, 3 * sizeof(WORD), &bytes, NULL)) {
+  BYTE headerData[IconDirLayout::kSize];
+  if (!ReadFile(file, headerData, sizeof(headerData), &bytes, NULL) || bytes != sizeof(headerData)) {
     fwprintf(stderr, L"Cannot read icon header for '%ls'\n", path);
     return false;
   }
 
+  RecordView<IconDirLayout> iconDir(ByteSpan(headerData, sizeof(headerData)));
+  header.reserved = iconDir.Get<IconDirLayout::Reserved>();
+  header.type = iconDir.Get<IconDirLayout::Type>();
+  header.count = iconDir.Get<IconDirLayout::Count>();
   if (header.reserved != 0 || header.type != 1) {
     fwprintf(stderr, L"Reserved header is not 0 or image type is not icon for '%ls'\n", path);
     return false;
   }
 
-  header.entries.resize(header.count);
-  if (!ReadFile(file, header.entries.data(), header.count * sizeof(IconsValue::ICONENTRY), &bytes, NULL)) {
+  std::vector<BYTE> entryData(header.count * IconDirEntryLayout::kSize);
+  if (!ReadFile(file, entryData.data(), static_cast<DWORD>(entryData.size()), &bytes, NULL) ||
+      bytes != entryData.size()) {
     fwprintf(stderr, L"Cannot read icon metadata for '%ls'\n", path);
     return false;
   }
 
+  header.entries.resize(header.count);
+  for (size_t i = 0; i < header.count; ++i) {
+    RecordView<IconDirEntryLayout> entry(ByteSpan(entryData.data(), entryData.size()).Subspan(i * IconDirEntryLayout::kSize));
+    IconsValue::ICONENTRY& iconEntry = header.entries[i];
+    iconEntry.width       = entry.Get<IconDirEntryLayout::Width>();
+    iconEntry.height      = entry.Get<IconDirEntryLayout::Height>();
+    iconEntry.colorCount  = entry.Get<IconDirEntryLayout::ColorCount>();
+    iconEntry.reserved    = entry.Get<IconDirEntryLayout::Reserved>();
+    iconEntry.planes      = entry.Get<IconDirEntryLayout::Planes>();
+    iconEntry.bitCount    = entry.Get<IconDirEntryLayout::BitCount>();
+    iconEntry.bytesInRes  = entry.Get<IconDirEntryLayout::BytesInRes>();
+    iconEntry.imageOffset = entry.Get<IconDirEntryLayout::ImageOffset>();
+  }
+
   icon.images.resize(header.count);
   for (size_t i = 0; i < header.count; ++i) {
     icon.images[i].resize(header.entries[i].bytesInRes);
@@ -658,23 +1470,22 @@ bool ResourceUpdater::SetIcon(const WCHAR* path, const LANGID& langId,
     }
   }
 
-  icon.grpHeader.resize(3 * sizeof(WORD) + header.count * sizeof(GRPICONENTRY));
-  GRPICONHEADER* pGrpHeader = reinterpret_cast<GRPICONHEADER*>(icon.grpHeader.data());
-  pGrpHeader->reserved = 0;
-  pGrpHeader->type = 1;
-  pGrpHeader->count = header.count;
+  icon.grpHeader.resize(IconDirLayout::kSize + header.count * GroupIconDirEntryLayout::kSize);
+  RecordWriter<IconDirLayout> grpHeader(icon.grpHeader.data());
+  grpHeader.Set<IconDirLayout::Reserved>(0);
+  grpHeader.Set<IconDirLayout::Type>(1);
+  grpHeader.Set<IconDirLayout::Count>(header.count);
   for (size_t i = 0; i < header.count; ++i) {
-    GRPICONENTRY* entry = pGrpHeader->entries + i;
-    entry->bitCount    = 0;
-    entry->bytesInRes  = header.entries[i].bitCount;
-    entry->bytesInRes2 = header.entries[i].bytesInRes;
-    entry->colourCount = header.entries[i].colorCount;
-    entry->height      = header.entries[i].height;
-    entry->id          = i + 1;
-    entry->planes      = header.entries[i].planes;
-    entry->reserved    = header.entries[i].reserved;
-    entry->width       = header.entries[i].width;
-    entry->reserved2   = 0;
+    RecordWriter<GroupIconDirEntryLayout> entry(
+        icon.grpHeader.data() + IconDirLayout::kSize + i * GroupIconDirEntryLayout::kSize);
+    entry.Set<GroupIconDirEntryLayout::Width>(header.entries[i].width);
+    entry.Set<GroupIconDirEntryLayout::Height>(header.entries[i].height);
+    entry.Set<GroupIconDirEntryLayout::ColorCount>(header.entries[i].colorCount);
+    entry.Set<GroupIconDirEntryLayout::Reserved>(header.entries[i].reserved);
+    entry.Set<GroupIconDirEntryLayout::Planes>(header.entries[i].planes);
+    entry.Set<GroupIconDirEntryLayout::BitCount>(header.entries[i].bitCount);
+    entry.Set<GroupIconDirEntryLayout::BytesInRes>(header.entries[i].bytesInRes);
+    entry.Set<GroupIconDirEntryLayout::Id>(static_cast<WORD>(i + 1));
   }
 
   return true;
@@ -689,9 +1500,38 @@ bool ResourceUpdater::SetIcon(const WCHAR* path, const LANGID& langId) {
 }
 
 bool ResourceUpdater::SetIcon(const WCHAR* path) {
-  LANGID langId = iconBundleMap_.empty() ? kLangEnUs
-                                         : iconBundleMap_.begin()->first;
-  return SetIcon(path, langId);
+  for (LANGID langId : SelectedLanguages(iconBundleMap_)) {
+    if (!SetIcon(path, langId))
+      return false;
+  }
+  return true;
+}
+
+std::vector<IconGroupSummary> ResourceUpdater::GetIconGroups() {
+  std::vector<IconGroupSummary> groups;
+  for (LANGID langId : SelectedLanguages(iconBundleMap_)) {
+    auto iLangIconInfoPair = iconBundleMap_.find(langId);
+    if (iLangIconInfoPair == iconBundleMap_.end())
+      continue;
+    for (const auto& iNameBundlePair : iLangIconInfoPair->second.iconBundles) {
+      IconGroupSummary summary = { langId, iNameBundlePair.first, 0 };
+      const IconsValue& icon = iNameBundlePair.second;
+      if (icon.replaced) {
+        // Replaced by SetIcon, report the new bundle.
+        summary.count = icon.header.count;
+      } else {
+        // Untouched bundle, read the count from the loaded group header.
+        const ByteSpan* header = tree_.Find({ RT_GROUP_ICON, static_cast<WORD>(summary.bundleId),
+                                                summary.langId });
+        RecordView<IconDirLayout> iconDir(header ? *header : ByteSpan());
+        if (iconDir.valid()) {
+          summary.count = iconDir.Get<IconDirLayout::Count>();
+        }
+      }
+      groups.push_back(summary);
+    }
+  }
+  return groups;
 }
 
 bool ResourceUpdater::Commit() {
@@ -701,22 +1541,248 @@ bool ResourceUpdater::Commit() {
   FreeLibrary(module_);
   module_ = NULL;
 
-  ScopedResourceUpdater ru(filename_.c_str(), false);
-  if (ru.Get() == NULL) {
+  std::vector<PendingResource> resources;
+  if (!ReservePlanSlots() || !SerializeResources(&resources)) {
     return false;
   }
 
-  // update version info.
-  for (const auto& i : versionStampMap_) {
-    LANGID langId = i.first;
-    std::vector<BYTE> out = i.second.Serialize();
+  // Leave the file alone, including its signature and timestamps, when the
+  // edits reproduce what is already there.
+  const DWORD* timestamp = ResourceTimestamp();
+  commitStats_ = CommitStats();
+  commitStats_.resources = resources.size();
+  bool restamp = false;
+  {
+    SourceImage source(filename_, image_);
+    if (!CountChangedResources(source.data(), source.size(), resources, timestamp,
+                               &commitStats_.changed, &restamp)) {
+      commitStats_.changed = resources.size();
+    }
+
+    // An untouched file still gets a journal, one that reverts nothing.
+    if (commitStats_.changed == 0 && !restamp && !journalPath_.empty()) {
+      RevertJournal journal;
+      BuildJournal(source.data(), source.size(), std::vector<FilePatch>(), FileMove(), source.size(), &journal);
+      if (!WriteJournal(journalPath_.c_str(), journal)) {
+        return false;
+      }
+    }
+  }
+  // A recorded plan has to hold the writes, even if they change nothing.
+  if (commitStats_.changed == 0 && !restamp && planPath_.empty()) {
+    return true;
+  }
+  commitStats_.written = true;
+
+  // EndUpdateResourceW neither zeroes what it writes nor takes a timestamp,
+  // and what it does cannot be recorded.
+  bool plannerOnly = timestamp != NULL || !planPath_.empty();
+  if (plannerOnly && layoutStrategy_ == LayoutStrategy::kSystem) {
+    fprintf(stderr, "The system layout cannot be deterministic, restamped or recorded\n");
+    return false;
+  }
+
+  const WCHAR* journalPath = journalPath_.empty() ? NULL : journalPath_.c_str();
+  if (layoutStrategy_ != LayoutStrategy::kSystem) {
+    LayoutOptions options;
+    options.allowRelocate = layoutStrategy_ == LayoutStrategy::kRelocate || deterministic_;
+    options.timestamp = timestamp;
+    options.journalPath = journalPath;
+    options.planPath = planPath_.empty() ? NULL : planPath_.c_str();
+    options.planSlots = &planSlots_;
+    options.ioBackend = ioBackend_;
+
+    bool handled = false;
+    if (!WriteResourceLayout(filename_.c_str(), resources, options, &handled)) {
+      return false;
+    }
+    if (handled) {
+      return true;
+    }
+    if (plannerOnly) {
+      fprintf(stderr, "No room for the updated resource section\n");
+      return false;
+    }
+  }
+
+  std::vector<BYTE> original;
+  if (journalPath != NULL && !ReadFileToBuffer(filename_.c_str(), &original)) {
+    return false;
+  }
+
+  {
+    ScopedResourceUpdater ru(filename_.c_str(), false);
+    if (ru.Get() == NULL) {
+      return false;
+    }
 
-    if (!UpdateResourceW(ru.Get(), RT_VERSION, MAKEINTRESOURCEW(1), langId,
-                         &out[0], static_cast<DWORD>(out.size()))) {
+    for (const auto& resource : resources) {
+      if (!UpdateResourceW(ru.Get(), resource.type, resource.name, resource.langId,
+                           const_cast<BYTE*>(resource.Data()), static_cast<DWORD>(resource.Size()))) {
+        return false;
+      }
+    }
+
+    if (!ru.Commit()) {
       return false;
     }
   }
 
+  return journalPath == NULL || WriteFullJournal(journalPath, filename_.c_str(), std::move(original));
+}
+
+bool ResourceUpdater::CommitToBuffer(std::vector<BYTE>* out) {
+  out->clear();
+  return CommitTo([out](const BYTE* data, size_t size) {
+    out->insert(out->end(), data, data + size);
+    return true;
+  });
+}
+
+bool ResourceUpdater::CommitToStream(HANDLE file) {
+  return CommitTo([file](const BYTE* data, size_t size) {
+    return WriteAll(file, data, size);
+  });
+}
+
+bool ResourceUpdater::CommitTo(const ByteSink& sink) {
+  std::vector<PendingResource> resources;
+  if (!ReservePlanSlots() || !SerializeResources(&resources)) {
+    return false;
+  }
+
+  SourceImage source(filename_, image_);
+  if (source.data() == NULL) {
+    return false;
+  }
+
+  const DWORD* timestamp = ResourceTimestamp();
+  commitStats_ = CommitStats();
+  commitStats_.resources = resources.size();
+  bool restamp = false;
+  if (!CountChangedResources(source.data(), source.size(), resources, timestamp,
+                             &commitStats_.changed, &restamp)) {
+    commitStats_.changed = resources.size();
+  }
+  if (commitStats_.changed == 0 && !restamp && planPath_.empty()) {
+    return sink(source.data(), source.size());
+  }
+  commitStats_.written = true;
+
+  // There is no file for EndUpdateResourceW to rebuild, so the section is
+  // always placed by the planner, and moved to the end when it has to.
+  PEImage image;
+  ResourceTable table;
+  if (!image.Parse(source.data(), source.size()) || !image.ReadResources(&table)) {
+    return false;
+  }
+  ApplyResources(resources, &table);
+
+  std::vector<FilePatch> patches;
+  FileMove overlay;
+  ULONGLONG newSize = 0;
+  if (image.PlanResources(table, true, timestamp, &patches, &overlay, &newSize) == PEImage::Placement::kNone) {
+    fprintf(stderr, "No room for the updated resource section\n");
+    return false;
+  }
+
+  LayoutOptions options;
+  options.planPath = planPath_.empty() ? NULL : planPath_.c_str();
+  options.planSlots = &planSlots_;
+  if (!RecordLayoutPlan(options, image, source.data(), source.size(), patches, overlay, newSize)) {
+    return false;
+  }
+  return EmitResourceLayout(source.data(), source.size(), patches, overlay, newSize, sink);
+}
+
+bool ResourceUpdater::SerializeResources(std::vector<PendingResource>* resources) {
+  // Every resource is serialized into its own buffer first, the buffers are
+  // then submitted in a fixed order so the output matches a serial run.
+  std::vector<std::function<bool()>> jobs;
+
+  // generic edits go first, so the typed models below override them.
+  for (const auto& key : tree_.GetChanges()) {
+    const ByteSpan* data = tree_.Find(key);
+    resources->push_back({ key.type.Pointer(), key.name.Pointer(), key.langId, {},
+                           data ? data->data() : nullptr, data ? data->size() : 0 });
+  }
+
+  // update the edited version info, the others stay as they are.
+  for (const auto& i : versionStampMap_) {
+    if (!i.second.dirty)
+      continue;
+
+    resources->push_back({ RT_VERSION, MAKEINTRESOURCEW(1), i.first });
+    size_t index = resources->size() - 1;
+    const VersionInfo* versionInfo = &i.second.info;
+    jobs.push_back([resources, index, versionInfo]() {
+      (*resources)[index].buffer = versionInfo->Serialize();
+      return true;
+    });
+  }
+
+  // update the execution level or replace the manifest.
+  if (!applicationManifestPath_.empty() || !executionLevel_.empty()) {
+    resources->push_back({ RT_MANIFEST, MAKEINTRESOURCEW(1),
+                           kLangEnUs });  // this is hardcoded at 1033, ie, en-us, as that is what RT_MANIFEST default uses
+    size_t index = resources->size() - 1;
+    jobs.push_back([this, resources, index]() {
+      return SerializeManifest(&(*resources)[index].buffer);
+    });
+  }
+
+  // update the edited string blocks.
+  for (const auto& i : stringTableMap_) {
+    for (UINT blockId = 0; blockId < i.second.size(); ++blockId) {
+      if (!i.second[blockId].dirty)
+        continue;
+
+      resources->push_back({ RT_STRING, MAKEINTRESOURCEW(blockId + 1), i.first });
+      size_t index = resources->size() - 1;
+      const StringValues* values = &i.second[blockId].values;
+      jobs.push_back([this, resources, index, values, blockId]() {
+        return SerializeStringTable(*values, blockId, &(*resources)[index].buffer);
+      });
+    }
+  }
+
+  for (const auto& iLangIconInfoPair : iconBundleMap_) {
+    auto langId = iLangIconInfoPair.first;
+    auto maxIconId = iLangIconInfoPair.second.maxIconId;
+    for (const auto& iNameBundlePair : iLangIconInfoPair.second.iconBundles) {
+      UINT bundleId = iNameBundlePair.first;
+      const IconsValue& icon = iNameBundlePair.second;
+      if (!icon.replaced)
+        continue;
+
+      // update icon.
+      if (icon.grpHeader.size() > 0) {
+        resources->push_back({ RT_GROUP_ICON, MAKEINTRESOURCEW(bundleId), langId, {},
+                               icon.grpHeader.data(), icon.grpHeader.size() });
+
+        for (size_t i = 0; i < icon.header.count; ++i) {
+          resources->push_back({ RT_ICON, MAKEINTRESOURCEW(i + 1), langId, {},
+                                 icon.images[i].data(), icon.images[i].size() });
+        }
+
+        // remove the icons of the old bundle that are no longer used.
+        for (size_t i = icon.header.count; i < maxIconId; ++i) {
+          resources->push_back({ RT_ICON, MAKEINTRESOURCEW(i + 1), langId });
+        }
+      }
+    }
+  }
+
+  return RunParallel(jobs);
+}
+
+const CommitStats& ResourceUpdater::GetCommitStats() const {
+  return commitStats_;
+}
+
+bool ResourceUpdater::SerializeManifest(std::vector<BYTE>* out) {
+  std::wstring stringSectionW;
+
   // update the execution level
   if (applicationManifestPath_.empty() && !executionLevel_.empty()) {
     // string replace with requested executionLevel
@@ -742,16 +1808,7 @@ bool ResourceUpdater::Commit() {
       }
     }
 
-    // convert the wchar back into char, so that it encodes correctly for Windows to read the XML.
-    std::wstring stringSectionW = trimmedStr + padding;
-    std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    std::string stringSection = converter.to_bytes(stringSectionW);
-
-    if (!UpdateResourceW(ru.Get(), RT_MANIFEST, MAKEINTRESOURCEW(1),
-                         kLangEnUs, // this is hardcoded at 1033, ie, en-us, as that is what RT_MANIFEST default uses
-                         &stringSection.at(0), sizeof(char) * stringSection.size())) {
-      return false;
-    }
+    stringSectionW = trimmedStr + padding;
   }
 
   // load file contents and replace the manifest
@@ -774,81 +1831,45 @@ bool ResourceUpdater::Commit() {
       }
     }
 
-    // convert the wchar back into char, so that it encodes correctly for Windows to read the XML.
-    std::wstring stringSectionW = fileContents + padding;
-    std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    std::string stringSection = converter.to_bytes(stringSectionW);
+    stringSectionW = fileContents + padding;
+  }
 
-    if (!UpdateResourceW(ru.Get(), RT_MANIFEST, MAKEINTRESOURCEW(1),
-                         kLangEnUs, // this is hardcoded at 1033, ie, en-us, as that is what RT_MANIFEST default uses
-                         &stringSection.at(0), sizeof(char) * stringSection.size())) {
-      return false;
-    }
+  // convert the wchar back into char, so that it encodes correctly for Windows to read the XML.
+  std::string stringSection = EncodeUtf8(stringSectionW);
+  if (stringSection.empty()) {
+    return false;
   }
 
-  // update string table.
-  for (const auto& i : stringTableMap_) {
-    for (const auto& j : i.second) {
-      std::vector<char> stringTableBuffer;
-      if (!SerializeStringTable(j.second, j.first, &stringTableBuffer)) {
-        return false;
-      }
+  out->assign(stringSection.begin(), stringSection.end());
+  return true;
+}
 
-      if (!UpdateResourceW(ru.Get(), RT_STRING, MAKEINTRESOURCEW(j.first + 1), i.first,
-                           &stringTableBuffer[0], static_cast<DWORD>(stringTableBuffer.size()))) {
-        return false;
-      }
-    }
+ResourceUpdater::StringBlock* ResourceUpdater::FindStringBlock(WORD languageId, UINT blockId, bool create) {
+  auto table = stringTableMap_.find(languageId);
+  if (table == stringTableMap_.end()) {
+    if (!create)
+      return NULL;
+    table = stringTableMap_.try_emplace(languageId).first;
   }
 
-  for (const auto& rcDataLangPair : rcDataLngMap_) {
-    for (const auto&rcDataMap : rcDataLangPair.second) {
-      if (!UpdateResourceW(ru.Get(), RT_RCDATA, reinterpret_cast<LPWSTR>(rcDataMap.first),
-                           rcDataLangPair.first, (LPVOID)rcDataMap.second.data(), rcDataMap.second.size())) {
-        return false;
-      }
-    }
+  StringTable& blocks = table->second;
+  if (blockId >= blocks.size()) {
+    if (!create)
+      return NULL;
+    blocks.resize(blockId + 1);
   }
 
-  for (const auto& iLangIconInfoPair : iconBundleMap_) {
-    auto langId = iLangIconInfoPair.first;
-    auto maxIconId = iLangIconInfoPair.second.maxIconId;
-    for (const auto& iNameBundlePair : iLangIconInfoPair.second.iconBundles) {
-      UINT bundleId = iNameBundlePair.first;
-      const std::unique_ptr<IconsValue>& pIcon = iNameBundlePair.second;
-      if (!pIcon)
-        continue;
-
-      auto& icon = *pIcon;
-      // update icon.
-      if (icon.grpHeader.size() > 0) {
-        if (!UpdateResourceW(ru.Get(), RT_GROUP_ICON, MAKEINTRESOURCEW(bundleId),
-                             langId, icon.grpHeader.data(), icon.grpHeader.size())) {
-          return false;
-        }
-
-        for (size_t i = 0; i < icon.header.count; ++i) {
-          if (!UpdateResourceW(ru.Get(), RT_ICON, MAKEINTRESOURCEW(i + 1),
-                               langId, icon.images[i].data(), icon.images[i].size())) {
-
-            return false;
-          }
-        }
-
-        for (size_t i = icon.header.count; i < maxIconId; ++i) {
-          if (!UpdateResourceW(ru.Get(), RT_ICON, MAKEINTRESOURCEW(i + 1),
-                               langId , nullptr , 0)) {
-            return false;
-          }
-        }
-      }
-    }
-  }
+  StringBlock& block = blocks[blockId];
+  if (!block.present && !create)
+    return NULL;
 
-  return ru.Commit();
+  block.present = true;
+  if (block.values.empty())
+    DecodeStringBlock(block.raw, &block.values);
+  return &block;
 }
 
-bool ResourceUpdater::SerializeStringTable(const StringValues& values, UINT blockId, std::vector<char>* out) {
+bool ResourceUpdater::SerializeStringTable(const StringValues& values, UINT blockId, std::vector<BYTE>* out) const {
   // calc total size.
   // string table is pascal string list.
   size_t size = 0;
@@ -860,14 +1881,14 @@ bool ResourceUpdater::SerializeStringTable(const StringValues& values, UINT bloc
   out->resize(size);
 
   // write.
-  char* pDst = &(*out)[0];
+  BYTE* pDst = &(*out)[0];
   for (size_t i = 0; i < 16; i++) {
     WORD length = static_cast<WORD>(values[i].length());
     memcpy(pDst, &length, sizeof(length));
     pDst += sizeof(WORD);
 
     if (length > 0) {
-      WORD bytes = length * sizeof(WCHAR);
+      size_t bytes = length * sizeof(WCHAR);
       memcpy(pDst, values[ i ].c_str(), bytes);
       pDst += bytes;
     }
@@ -876,87 +1897,64 @@ bool ResourceUpdater::SerializeStringTable(const StringValues& values, UINT bloc
   return true;
 }
 
-// static
-BOOL CALLBACK ResourceUpdater::OnEnumResourceLanguage(HANDLE hModule, LPCWSTR lpszType, LPCWSTR lpszName, WORD wIDLanguage, LONG_PTR lParam) {
-  ResourceUpdater* instance = reinterpret_cast<ResourceUpdater*>(lParam);
-  if (IS_INTRESOURCE(lpszName) && IS_INTRESOURCE(lpszType)) {
-    switch (reinterpret_cast<ptrdiff_t>(lpszType)) {
-      case reinterpret_cast<ptrdiff_t>(RT_VERSION): {
-        try {
-          instance->versionStampMap_[wIDLanguage] = VersionInfo(instance->module_, wIDLanguage);
-        } catch (const std::system_error& e) {
-          return false;
-        }
-        break;
-      }
-      case reinterpret_cast<ptrdiff_t>(RT_STRING): {
-        UINT id = reinterpret_cast<ptrdiff_t>(lpszName) - 1;
-        auto& vector = instance->stringTableMap_[wIDLanguage][id];
-        for (size_t k = 0; k < 16; k++) {
-          CStringW buf;
-
-          buf.LoadStringW(instance->module_, id * 16 + k, wIDLanguage);
-          vector.push_back(buf.GetBuffer());
-        }
-        break;
-      }
-      case reinterpret_cast<ptrdiff_t>(RT_ICON): {
-        UINT iconId = reinterpret_cast<ptrdiff_t>(lpszName);
-        UINT maxIconId = instance->iconBundleMap_[wIDLanguage].maxIconId;
-        if (iconId > maxIconId)
-          maxIconId = iconId;
-        break;
-      }
-      case reinterpret_cast<ptrdiff_t>(RT_GROUP_ICON): {
-        UINT iconId = reinterpret_cast<ptrdiff_t>(lpszName);
-        instance->iconBundleMap_[wIDLanguage].iconBundles[iconId] = nullptr;
-        break;
-      }
-      case reinterpret_cast<ptrdiff_t>(RT_RCDATA): {
-        const auto moduleHandle = HMODULE(hModule);
-        HRSRC hResInfo = FindResource(moduleHandle, lpszName, lpszType);
-        DWORD cbResource = SizeofResource(moduleHandle, hResInfo);
-        HGLOBAL hResData = LoadResource(moduleHandle, hResInfo);
-
-        const auto *pResource = (const BYTE *)LockResource(hResData);
-        const auto resId = reinterpret_cast<ptrdiff_t>(lpszName);
-        instance->rcDataLngMap_[wIDLanguage][resId] = std::vector<BYTE>(pResource, pResource + cbResource);
-
-        UnlockResource(hResData);
-        FreeResource(hResData);
-      }
-      default:
-        break;
-    }
-  }
-  return TRUE;
+void ResourceUpdater::Decode(const ResourceKey& key, const BYTE* data, size_t size) {
+  auto decoder = decoders_.find(key.type);
+  if (decoder != decoders_.end())
+    decoder->second(key, data, size);
 }
 
-// static
-BOOL CALLBACK ResourceUpdater::OnEnumResourceName(HMODULE hModule, LPCWSTR lpszType, LPWSTR lpszName, LONG_PTR lParam) {
-  EnumResourceLanguagesW(hModule, lpszType, lpszName, (ENUMRESLANGPROCW) OnEnumResourceLanguage, lParam);
-  return TRUE;
+void ResourceUpdater::DecodeVersion(const ResourceKey& key, const BYTE* data, size_t size) {
+  if (!(key.name == ResourceId(1)))
+    return;
+
+  // Build the tree in place rather than copying a temporary.
+  versionStampMap_.erase(key.langId);
+  versionStampMap_.try_emplace(key.langId, data, size);
 }
 
-// static
-// courtesy of http://stackoverflow.com/questions/420852/reading-an-applications-manifest-file
-BOOL CALLBACK ResourceUpdater::OnEnumResourceManifest(HMODULE hModule, LPCTSTR lpType, LPWSTR lpName, LONG_PTR lParam) {
-  ResourceUpdater* instance = reinterpret_cast<ResourceUpdater*>(lParam);
-  HRSRC hResInfo = FindResource(hModule, lpName, lpType);
-  DWORD cbResource = SizeofResource(hModule, hResInfo);
+void ResourceUpdater::DecodeStringTable(const ResourceKey& key, const BYTE* data, size_t size) {
+  if (!key.name.IsId() || key.name.id == 0)
+    return;
+
+  UINT blockId = key.name.id - 1;
+  const ByteSpan* raw = tree_.Find(key);
+  if (blockId >= kStringBlockCount || raw == NULL)
+    return;
+
+  // |data| may be unmapped once loading is done, so the block refers to the
+  // copy held by the tree and is only split when first accessed.
+  StringTable& blocks = stringTableMap_[key.langId];
+  if (blockId >= blocks.size())
+    blocks.resize(blockId + 1);
+
+  StringBlock& block = blocks[blockId];
+  block.raw = *raw;
+  block.present = true;
+  block.dirty = false;
+  block.values.clear();
+}
 
-  HGLOBAL hResData = LoadResource(hModule, hResInfo);
-  const BYTE *pResource = (const BYTE *)LockResource(hResData);
+void ResourceUpdater::DecodeIcon(const ResourceKey& key, const BYTE* data, size_t size) {
+  if (!key.name.IsId())
+    return;
 
-  // FIXME(zcbenz): Do a real UTF string convertion.
-  int len = strlen(reinterpret_cast<const char*>(pResource));
-  std::wstring manifestStringLocal(pResource, pResource + len);
+  UINT& maxIconId = iconBundleMap_[key.langId].maxIconId;
+  if (key.name.id > maxIconId)
+    maxIconId = key.name.id;
+}
 
-  // FIXME(zcbenz): Strip the BOM instead of doing string search.
-  size_t start = manifestStringLocal.find(L"<?xml");
-  if (start > 0) {
-    manifestStringLocal = manifestStringLocal.substr(start);
+void ResourceUpdater::DecodeIconGroup(const ResourceKey& key, const BYTE* data, size_t size) {
+  if (key.name.IsId()) {
+    IconTable& bundles = iconBundleMap_[key.langId].iconBundles;
+    bundles.erase(key.name.id);
+    bundles.try_emplace(key.name.id);
   }
+}
+
+// courtesy of http://stackoverflow.com/questions/420852/reading-an-applications-manifest-file
+void ResourceUpdater::DecodeManifest(const ResourceKey& key, const BYTE* data, size_t size) {
+  std::wstring manifestStringLocal = DecodeText(data, size);
+  manifestStringLocal.resize(wcsnlen(manifestStringLocal.c_str(), manifestStringLocal.length()));
 
   // Support alternative formatting, such as using " vs ' and level="..." on another line
   size_t found = manifestStringLocal.find(L"requestedExecutionLevel");
@@ -968,15 +1966,10 @@ BOOL CALLBACK ResourceUpdater::OnEnumResourceManifest(HMODULE hModule, LPCTSTR l
 	  end = manifestStringLocal.find(L"\'", level + 7);
   }
 
-  instance->originalExecutionLevel_ = manifestStringLocal.substr(level + 7, end - level - 7);
+  originalExecutionLevel_ = manifestStringLocal.substr(level + 7, end - level - 7);
 
   // also store original manifestString
-  instance->manifestString_ = manifestStringLocal;
-
-  UnlockResource(hResData);
-  FreeResource(hResData);
-
-  return TRUE;   // Keep going
+  manifestString_ = manifestStringLocal;
 }
 
 ScopedResourceUpdater::ScopedResourceUpdater(const WCHAR* filename, bool deleteOld)
@@ -19,9 +19,16 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory_resource>
+#include <set>
 
 #include <windows.h>
 #include <memory> // unique_ptr
+#include <functional>
+
+#include "io_engine.h"
+#include "record.h"
+#include "resource_tree.h"
 
 #define RU_VS_COMMENTS          L"Comments"
 #define RU_VS_COMPANY_NAME      L"CompanyName"
@@ -38,7 +45,13 @@
 
 namespace rescle {
 
+// The typed models below take the allocator of the container holding them,
+// so the maps of an updater build them in its arena.
+typedef std::pmr::polymorphic_allocator<char> ModelAllocator;
+
 struct IconsValue {
+  typedef ModelAllocator allocator_type;
+
   typedef struct _ICONENTRY {
     BYTE width;
     BYTE height;
@@ -54,12 +67,16 @@ struct IconsValue {
     WORD reserved;
     WORD type;
     WORD count;
-    std::vector<ICONENTRY> entries;
+    std::pmr::vector<ICONENTRY> entries;
   } ICONHEADER;
 
+  explicit IconsValue(const allocator_type& alloc = allocator_type())
+      : header{ 0, 0, 0, std::pmr::vector<ICONENTRY>(alloc) }, images(alloc), grpHeader(alloc) {}
+
   ICONHEADER header;
-  std::vector<std::vector<BYTE>> images;
-  std::vector<BYTE> grpHeader;
+  std::pmr::vector<std::pmr::vector<BYTE>> images;
+  std::pmr::vector<BYTE> grpHeader;
+  bool replaced = false;  // by SetIcon, otherwise the loaded group stays
 };
 
 struct Translate {
@@ -67,18 +84,57 @@ struct Translate {
   WORD wCodePage;
 };
 
-typedef std::pair<std::wstring, std::wstring> VersionString;
-typedef std::pair<const BYTE* const, const size_t> OffsetLengthPair;
+typedef std::pair<std::pmr::wstring, std::pmr::wstring> VersionString;
+
+// A node of a VS_VERSIONINFO tree as read by VersionInfo.
+struct VersionNode {
+  std::wstring key;
+  WORD valueLength = 0;
+  ByteSpan children;  // the value and children, after the aligned key
+  size_t length = 0;  // offset of the next sibling
+};
+
+struct IconGroupSummary {
+  LANGID langId;
+  UINT bundleId;
+  WORD count;
+};
+
+struct PendingResource;
+
+// Outcome of the last Commit.
+struct CommitStats {
+  size_t resources = 0;  // resources submitted
+  size_t changed = 0;    // resources whose payload differs from the file
+  bool written = false;  // false when the file was left untouched
+};
 
 struct VersionStringTable {
+  typedef ModelAllocator allocator_type;
+
+  explicit VersionStringTable(const allocator_type& alloc = allocator_type()) : strings(alloc) {}
+  VersionStringTable(const Translate& encoding, const allocator_type& alloc = allocator_type())
+      : encoding(encoding), strings(alloc) {}
+  VersionStringTable(const VersionStringTable& other, const allocator_type& alloc)
+      : encoding(other.encoding), strings(other.strings, alloc) {}
+  VersionStringTable(VersionStringTable&& other, const allocator_type& alloc)
+      : encoding(other.encoding), strings(std::move(other.strings), alloc) {}
+  VersionStringTable(const VersionStringTable&) = default;
+  VersionStringTable(VersionStringTable&&) = default;
+  VersionStringTable& operator=(const VersionStringTable&) = default;
+  VersionStringTable& operator=(VersionStringTable&&) = default;
+
   Translate encoding;
-  std::vector<VersionString> strings;
+  std::pmr::vector<VersionString> strings;
 };
 
 class VersionInfo {
  public:
-  VersionInfo();
-  VersionInfo(HMODULE hModule, WORD languageId);
+  typedef ModelAllocator allocator_type;
+
+  explicit VersionInfo(const allocator_type& alloc = allocator_type());
+  VersionInfo(HMODULE hModule, WORD languageId, const allocator_type& alloc = allocator_type());
+  VersionInfo(const BYTE* data, size_t size, const allocator_type& alloc = allocator_type());
 
   std::vector<BYTE> Serialize() const;
 
@@ -87,8 +143,8 @@ class VersionInfo {
   const VS_FIXEDFILEINFO& GetFixedFileInfo() const;
   void SetFixedFileInfo(const VS_FIXEDFILEINFO& value);
 
-  std::vector<VersionStringTable> stringTables;
-  std::vector<Translate> supportedTranslations;
+  std::pmr::vector<VersionStringTable> stringTables;
+  std::pmr::vector<Translate> supportedTranslations;
 
  private:
   VS_FIXEDFILEINFO fixedFileInfo_;
@@ -96,73 +152,232 @@ class VersionInfo {
   void FillDefaultData();
   void DeserializeVersionInfo(const BYTE* pData, size_t size);
 
-  VersionStringTable DeserializeVersionStringTable(const BYTE* tableData);
-  void DeserializeVersionStringFileInfo(const BYTE* offset, size_t length, std::vector<VersionStringTable>& stringTables);
-  void DeserializeVarFileInfo(const unsigned char* offset, std::vector<Translate>& translations);
-  OffsetLengthPair GetChildrenData(const BYTE* entryData);
+  void DeserializeVersionStringTable(const VersionNode& table, VersionStringTable* tableEntry);
+  void DeserializeVersionStringFileInfo(ByteSpan children, std::pmr::vector<VersionStringTable>& stringTables);
+  void DeserializeVarFileInfo(ByteSpan children, std::pmr::vector<Translate>& translations);
+  bool GetChildrenData(ByteSpan entryData, VersionNode* node);
 };
 
 class ResourceUpdater {
  public:
-  typedef std::vector<std::wstring> StringValues;
-  typedef std::map<UINT, StringValues> StringTable;
-  typedef std::map<WORD, StringTable> StringTableMap;
-  typedef std::map<LANGID, VersionInfo> VersionStampMap;
-  typedef std::map<UINT, std::unique_ptr<IconsValue>> IconTable;
-  typedef std::vector<BYTE> RcDataValue;
-  typedef std::map<ptrdiff_t, RcDataValue> RcDataMap;
-  typedef std::map<LANGID, RcDataMap> RcDataLangMap;
+  typedef std::pmr::vector<std::pmr::wstring> StringValues;
+
+  // An RT_STRING block of 16 strings. A loaded block keeps pointing at its
+  // payload in the resource tree until it is first accessed, and only the
+  // dirty blocks are written back.
+  struct StringBlock {
+    typedef ModelAllocator allocator_type;
+
+    explicit StringBlock(const allocator_type& alloc = allocator_type()) : values(alloc) {}
+    StringBlock(const StringBlock& other, const allocator_type& alloc)
+        : raw(other.raw), present(other.present), dirty(other.dirty), values(other.values, alloc) {}
+    StringBlock(StringBlock&& other, const allocator_type& alloc)
+        : raw(other.raw), present(other.present), dirty(other.dirty), values(std::move(other.values), alloc) {}
+    StringBlock(const StringBlock&) = default;
+    StringBlock(StringBlock&&) = default;
+    StringBlock& operator=(const StringBlock&) = default;
+    StringBlock& operator=(StringBlock&&) = default;
+
+    ByteSpan raw;
+    bool present = false;
+    bool dirty = false;
+    StringValues values;  // empty until decoded
+  };
+
+  // The blocks of one language indexed by block id, the resource id minus
+  // one.
+  typedef std::pmr::vector<StringBlock> StringTable;
+  typedef std::pmr::map<WORD, StringTable> StringTableMap;
+  // A loaded VS_VERSIONINFO, written back only once an edit marks it dirty.
+  struct VersionStamp {
+    typedef ModelAllocator allocator_type;
+
+    explicit VersionStamp(const allocator_type& alloc = allocator_type()) : info(alloc) {}
+    VersionStamp(const BYTE* data, size_t size, const allocator_type& alloc = allocator_type())
+        : info(data, size, alloc) {}
+
+    VersionInfo info;
+    bool dirty = false;
+  };
+
+  typedef std::pmr::map<LANGID, VersionStamp> VersionStampMap;
+  typedef std::pmr::map<UINT, IconsValue> IconTable;
+
+  // Decodes a loaded or imported resource into a typed model. Resources of
+  // a type without a decoder are only kept in the generic tree.
+  typedef std::function<void(const ResourceKey& key, const BYTE* data, size_t size)> ResourceDecoder;
+
+  // Receives the updated image in file order.
+  typedef std::function<bool(const BYTE* data, size_t size)> ByteSink;
 
   struct IconResInfo {
+    typedef ModelAllocator allocator_type;
+
+    explicit IconResInfo(const allocator_type& alloc = allocator_type()) : iconBundles(alloc) {}
+
     UINT maxIconId = 0;
     IconTable iconBundles;
   };
 
-  typedef std::map<LANGID, IconResInfo> IconTableMap;
+  typedef std::pmr::map<LANGID, IconResInfo> IconTableMap;
+
+  // Languages targeted by the overloads that take no languageId.
+  enum class LanguageSelection {
+    kDefault,  // the first language of each resource type
+    kSingle,   // one explicit language
+    kAll,      // every language present for each resource type
+  };
+
+  // Where Commit places the updated resource section.
+  enum class LayoutStrategy {
+    kSystem,    // let EndUpdateResourceW rebuild the image
+    kInPlace,   // reuse the slack of .rsrc or grow it when it is the last
+                // section, falling back to kSystem otherwise
+    kRelocate,  // like kInPlace, but move .rsrc into a new last section
+                // instead of falling back, so later growth only appends
+  };
 
   ResourceUpdater();
   ~ResourceUpdater();
 
   bool Load(const WCHAR* filename);
+  // Loads a copy of an image held in memory. Only CommitToBuffer and
+  // CommitToStream can write the result.
+  bool LoadFromMemory(const BYTE* data, size_t size);
+  bool LoadFromMemory(std::vector<BYTE> image);
+  // Shares an image with other updaters instead of copying it. The image
+  // is only read, also by the commits, and the loaded resources refer to
+  // it until they are edited.
+  bool LoadFromMemory(std::shared_ptr<const std::vector<BYTE>> image);
+  // Drops the edits to the resources of |types| and reads them again from
+  // the loaded image, so they can be edited anew while the other types keep
+  // theirs. Icon groups and icons are reloaded together. The dropped values
+  // are only reclaimed with the updater.
+  bool ReloadTypes(const std::set<ResourceId>& types);
+  void SelectDefaultLanguage();
+  void SelectLanguage(LANGID languageId);
+  void SelectAllLanguages();
+  bool IsDefaultLanguageSelected() const;
+  std::vector<LANGID> GetVersionLanguages() const;
+  std::vector<LANGID> GetStringTableLanguages() const;
   bool SetVersionString(WORD languageId, const WCHAR* name, const WCHAR* value);
   bool SetVersionString(const WCHAR* name, const WCHAR* value);
   const WCHAR* GetVersionString(WORD languageId, const WCHAR* name);
   const WCHAR* GetVersionString(const WCHAR* name);
+  bool GetProductVersion(WORD languageId, unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4);
+  bool GetProductVersion(unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4);
+  bool GetFileVersion(WORD languageId, unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4);
+  bool GetFileVersion(unsigned short* v1, unsigned short* v2, unsigned short* v3, unsigned short* v4);
   bool SetProductVersion(WORD languageId, UINT id, unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4);
   bool SetProductVersion(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4);
   bool SetFileVersion(WORD languageId, UINT id, unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4);
   bool SetFileVersion(unsigned short v1, unsigned short v2, unsigned short v3, unsigned short v4);
   bool ChangeString(WORD languageId, UINT id, const WCHAR* value);
   bool ChangeString(UINT id, const WCHAR* value);
+  bool ChangeStrings(const WCHAR* pathToStringList);
   bool ChangeRcData(UINT id, const WCHAR* pathToResource);
+  bool ChangeRcData(const ResourceId& id, const WCHAR* pathToResource);
+  bool SetResource(const ResourceId& type, const ResourceId& name, WORD languageId, const BYTE* data, size_t size);
+  bool SetResource(const ResourceId& type, const ResourceId& name, const WCHAR* pathToResource);
+  const ByteSpan* GetResource(const ResourceId& type, const ResourceId& name, WORD languageId) const;
+  bool DeleteResource(const ResourceId& type, const ResourceId& name, WORD languageId);
+  void SetDecoder(const ResourceId& type, ResourceDecoder decoder);
   const WCHAR* GetString(WORD languageId, UINT id);
   const WCHAR* GetString(UINT id);
   bool SetIcon(const WCHAR* path, const LANGID& langId, UINT iconBundle);
   bool SetIcon(const WCHAR* path, const LANGID& langId);
   bool SetIcon(const WCHAR* path);
+  // Icon groups of the selected languages.
+  std::vector<IconGroupSummary> GetIconGroups();
   bool SetExecutionLevel(const WCHAR* value);
+  const WCHAR* GetExecutionLevel();
   bool IsExecutionLevelSet();
   bool SetApplicationManifest(const WCHAR* value);
   bool IsApplicationManifestSet();
+  bool ImportRes(const WCHAR* path);
+  bool ExportRes(const WCHAR* path);
+  // Write resources as Commit would, straight from the loaded image. Group
+  // icons are written as .ico files with their images. Without a
+  // languageId, the first language of the resource is taken.
+  bool ExtractResource(const ResourceId& type, const ResourceId& name, WORD languageId, const WCHAR* path);
+  bool ExtractResource(const ResourceId& type, const ResourceId& name, const WCHAR* path);
+  bool ExtractAllResources(const WCHAR* directory);
+  void SetLayoutStrategy(LayoutStrategy strategy);
+  // Commit first writes what it is about to overwrite to |path|, for
+  // RevertFile.
+  void SetJournal(const WCHAR* path);
+  // How Commit writes the resource section and moves appended data.
+  void SetIoBackend(IoBackend backend);
+  // The TimeDateStamp of the written resource directories. By default they
+  // keep the one of the loaded file.
+  void SetResourceTimestamp(DWORD timestamp);
+  // Commit gives the same bytes for the same input and edits: the section
+  // is always placed by the layout planner, moved to the end when it does
+  // not fit, and stamped with zero unless a timestamp is set.
+  void SetDeterministic();
+  // Commit saves its writes to |path| for ApplyPlan, with the version
+  // strings added by AddPlanSlot padded to a fixed width so replays can
+  // fill them in.
+  void RecordPlan(const WCHAR* path);
+  void AddPlanSlot(const WCHAR* key, DWORD capacity);
   bool Commit();
+  // Write the updated image somewhere else, leaving the loaded file alone.
+  // The resource section is placed as with LayoutStrategy::kRelocate.
+  bool CommitToBuffer(std::vector<BYTE>* out);
+  bool CommitToStream(HANDLE file);
+  const CommitStats& GetCommitStats() const;
 
  private:
-  bool SerializeStringTable(const StringValues& values, UINT blockId, std::vector<char>* out);
-
-  static BOOL CALLBACK OnEnumResourceName(HMODULE hModule, LPCWSTR lpszType, LPWSTR lpszName, LONG_PTR lParam);
-  static BOOL CALLBACK OnEnumResourceManifest(HMODULE hModule, LPCWSTR lpszType, LPWSTR lpszName, LONG_PTR lParam);
-  static BOOL CALLBACK OnEnumResourceLanguage(HANDLE hModule, LPCWSTR lpszType, LPCWSTR lpszName, WORD wIDLanguage, LONG_PTR lParam);
+  StringBlock* FindStringBlock(WORD languageId, UINT blockId, bool create);
+  bool SerializeStringTable(const StringValues& values, UINT blockId, std::vector<BYTE>* out) const;
+  bool SerializeManifest(std::vector<BYTE>* out);
+  bool LoadResources(const BYTE* data, size_t size);
+  void AddLoadedResource(const ResourceKey& key, const BYTE* data, size_t size);
+  bool CommitTo(const ByteSink& sink);
+  bool ReservePlanSlots();
+  // NULL when the directories keep the timestamp of the loaded file.
+  const DWORD* ResourceTimestamp() const;
+  bool SerializeResources(std::vector<PendingResource>* resources);
+  // The resources as Commit would write them, borrowing from |data| and
+  // |resources|.
+  bool ReadCommittedResources(const BYTE* data, size_t size, std::vector<PendingResource>* resources,
+                              ResourceTable* table);
+  void Decode(const ResourceKey& key, const BYTE* data, size_t size);
+  void DecodeVersion(const ResourceKey& key, const BYTE* data, size_t size);
+  void DecodeStringTable(const ResourceKey& key, const BYTE* data, size_t size);
+  void DecodeIcon(const ResourceKey& key, const BYTE* data, size_t size);
+  void DecodeIconGroup(const ResourceKey& key, const BYTE* data, size_t size);
+  void DecodeManifest(const ResourceKey& key, const BYTE* data, size_t size);
+
+  template<typename Map>
+  std::vector<LANGID> SelectedLanguages(const Map& map) const;
 
   HMODULE module_;
+  LanguageSelection languageSelection_ = LanguageSelection::kDefault;
+  LANGID selectedLanguage_ = 0;
+  LayoutStrategy layoutStrategy_ = LayoutStrategy::kInPlace;
+  IoBackend ioBackend_ = IoBackend::kSynchronous;
+  bool deterministic_ = false;
+  bool hasResourceTimestamp_ = false;
+  DWORD resourceTimestamp_ = 0;
+  std::wstring planPath_;
+  std::map<std::wstring, DWORD> planSlots_;
+  CommitStats commitStats_;
   std::wstring filename_;
+  std::shared_ptr<const std::vector<BYTE>> image_;  // only when loaded from memory
+  std::wstring journalPath_;
   std::wstring executionLevel_;
   std::wstring originalExecutionLevel_;
   std::wstring applicationManifestPath_;
   std::wstring manifestString_;
+  // The typed models and the resource tree draw from one monotonic arena,
+  // released with the updater. A replaced value is only reclaimed then.
+  std::pmr::monotonic_buffer_resource arena_;
   VersionStampMap versionStampMap_;
   StringTableMap stringTableMap_;
   IconTableMap iconBundleMap_;
-  RcDataLangMap rcDataLngMap_;
+  ResourceTree tree_;
+  std::map<ResourceId, ResourceDecoder> decoders_;
 };
 
 class ScopedResourceUpdater {
@@ -180,6 +395,9 @@ class ScopedResourceUpdater {
   bool commited_ = false;
 };
 
+// Reads a UTF-8 or UTF-16 text file, empty when it cannot be read.
+std::wstring ReadFileToString(const wchar_t* filename);
+
 }  // namespace rescle
 
 #endif // VERSION_INFO_UPDATER
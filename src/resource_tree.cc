@@ -0,0 +1,92 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "resource_tree.h"
+
+#include <string.h>
+#include <functional>
+#include <string>
+
+namespace rescle {
+
+namespace {
+
+size_t HashResourceId(const ResourceId& id) {
+  return id.IsId() ? std::hash<WORD>()(id.id) : std::hash<std::wstring>()(id.name);
+}
+
+}  // namespace
+
+bool operator==(const ResourceName& a, const ResourceName& b) {
+  return a.type == b.type && a.name == b.name;
+}
+
+size_t ResourceNameHash::operator()(const ResourceName& value) const {
+  return HashResourceId(value.type) * 31 + HashResourceId(value.name);
+}
+
+ResourceTree::ResourceTree(std::pmr::memory_resource* arena)
+    : arena_(arena), entries_(arena), changes_(arena) {
+}
+
+void ResourceTree::Insert(const ResourceKey& key, const BYTE* data, size_t size) {
+  entries_[{ key.type, key.name }][key.langId] = Copy(data, size);
+}
+
+void ResourceTree::Borrow(const ResourceKey& key, const BYTE* data, size_t size) {
+  entries_[{ key.type, key.name }][key.langId] = ByteSpan(data, size);
+}
+
+void ResourceTree::Set(const ResourceKey& key, const BYTE* data, size_t size) {
+  Insert(key, data, size);
+  changes_.insert(key);
+}
+
+bool ResourceTree::Erase(const ResourceKey& key) {
+  auto entry = entries_.find({ key.type, key.name });
+  if (entry == entries_.end() || entry->second.erase(key.langId) == 0)
+    return false;
+
+  if (entry->second.empty())
+    entries_.erase(entry);
+  changes_.insert(key);
+  return true;
+}
+
+void ResourceTree::Reset(const ResourceId& type) {
+  for (auto entry = entries_.begin(); entry != entries_.end();) {
+    if (entry->first.type == type)
+      entry = entries_.erase(entry);
+    else
+      ++entry;
+  }
+  for (auto change = changes_.begin(); change != changes_.end();) {
+    if (change->type == type)
+      change = changes_.erase(change);
+    else
+      ++change;
+  }
+}
+
+const ResourceLanguages* ResourceTree::Find(const ResourceId& type, const ResourceId& name) const {
+  auto entry = entries_.find({ type, name });
+  return entry == entries_.end() ? NULL : &entry->second;
+}
+
+const ByteSpan* ResourceTree::Find(const ResourceKey& key) const {
+  const ResourceLanguages* languages = Find(key.type, key.name);
+  if (languages == NULL)
+    return NULL;
+
+  auto data = languages->find(key.langId);
+  return data == languages->end() ? NULL : &data->second;
+}
+
+ByteSpan ResourceTree::Copy(const BYTE* data, size_t size) {
+  BYTE* copy = static_cast<BYTE*>(arena_->allocate(size > 0 ? size : 1, 1));
+  memcpy(copy, data, size);
+  return ByteSpan(copy, size);
+}
+
+}  // namespace rescle
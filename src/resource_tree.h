@@ -0,0 +1,73 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef RESOURCE_TREE_H
+#define RESOURCE_TREE_H
+
+#include <map>
+#include <memory_resource>
+#include <set>
+#include <unordered_map>
+
+#include <windows.h>
+
+#include "pe_image.h"
+#include "record.h"
+
+namespace rescle {
+
+// The (type, name) part of a ResourceKey, which the tree hashes.
+struct ResourceName {
+  ResourceId type;
+  ResourceId name;
+};
+
+bool operator==(const ResourceName& a, const ResourceName& b);
+
+struct ResourceNameHash {
+  size_t operator()(const ResourceName& value) const;
+};
+
+// Payloads of one resource by language.
+typedef std::pmr::map<LANGID, ByteSpan> ResourceLanguages;
+
+// Every resource of a file, of any type and with integer or string names,
+// along with the edits made since it was loaded. The nodes and the copied
+// payloads live in |arena|, a monotonic arena of the owner that outlives the
+// tree; a replaced payload is only reclaimed with the arena.
+class ResourceTree {
+ public:
+  explicit ResourceTree(std::pmr::memory_resource* arena);
+  ResourceTree(const ResourceTree&) = delete;
+  ResourceTree& operator=(const ResourceTree&) = delete;
+
+  // Adds a resource as read from the file, without recording a change.
+  void Insert(const ResourceKey& key, const BYTE* data, size_t size);
+  // Like Insert, but refers to |data| instead of copying it, for an image
+  // that outlives the tree.
+  void Borrow(const ResourceKey& key, const BYTE* data, size_t size);
+  void Set(const ResourceKey& key, const BYTE* data, size_t size);
+  bool Erase(const ResourceKey& key);
+  // Drops the resources of |type| and their changes, so Insert can load
+  // them again.
+  void Reset(const ResourceId& type);
+
+  const ResourceLanguages* Find(const ResourceId& type, const ResourceId& name) const;
+  const ByteSpan* Find(const ResourceKey& key) const;
+
+  // Keys set or erased since loading, in resource directory order. Find
+  // returns NULL for the erased ones.
+  const std::pmr::set<ResourceKey>& GetChanges() const { return changes_; }
+
+ private:
+  ByteSpan Copy(const BYTE* data, size_t size);
+
+  std::pmr::memory_resource* arena_;
+  std::pmr::unordered_map<ResourceName, ResourceLanguages, ResourceNameHash> entries_;
+  std::pmr::set<ResourceKey> changes_;
+};
+
+}  // namespace rescle
+
+#endif  // RESOURCE_TREE_H
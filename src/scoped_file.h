@@ -0,0 +1,94 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef SCOPED_FILE_H
+#define SCOPED_FILE_H
+
+#include <stdint.h>
+#include <algorithm>
+
+#include <windows.h>
+
+namespace rescle {
+
+// A file handle closed when it goes out of scope. Writers get exclusive
+// access.
+class ScopedFile {
+ public:
+  ScopedFile(const WCHAR* path, bool write = false, DWORD disposition = OPEN_EXISTING,
+             DWORD flags = FILE_ATTRIBUTE_NORMAL)
+    : file_(CreateFileW(path, write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                        write ? 0 : FILE_SHARE_READ, NULL, disposition, flags, NULL)) {}
+  ~ScopedFile() { CloseHandle(file_); }
+
+  operator HANDLE() { return file_; }
+
+ private:
+  HANDLE file_;
+};
+
+// A read-only view of a whole file. data() is NULL when the file is empty
+// or cannot be mapped.
+class ScopedFileMapping {
+ public:
+  ScopedFileMapping(HANDLE file) : mapping_(NULL), view_(NULL), size_(0) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+        static_cast<ULONGLONG>(size.QuadPart) > SIZE_MAX)
+      return;
+
+    mapping_ = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_ == NULL)
+      return;
+
+    view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (view_ != NULL)
+      size_ = static_cast<size_t>(size.QuadPart);
+  }
+  ~ScopedFileMapping() {
+    if (view_ != NULL)
+      UnmapViewOfFile(view_);
+    if (mapping_ != NULL)
+      CloseHandle(mapping_);
+  }
+
+  const BYTE* data() const { return static_cast<const BYTE*>(view_); }
+  size_t size() const { return size_; }
+
+ private:
+  HANDLE mapping_;
+  LPVOID view_;
+  size_t size_;
+};
+
+// Writes at the current position, which also works for pipes.
+inline bool WriteAll(HANDLE file, const BYTE* data, size_t size) {
+  while (size > 0) {
+    DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1 << 30));
+    DWORD written = 0;
+    if (!WriteFile(file, data, chunk, &written, NULL) || written != chunk)
+      return false;
+    data += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+inline bool WriteFileAt(HANDLE file, ULONGLONG offset, const BYTE* data, size_t size) {
+  LARGE_INTEGER position;
+  position.QuadPart = static_cast<LONGLONG>(offset);
+  return SetFilePointerEx(file, position, NULL, FILE_BEGIN) && WriteAll(file, data, size);
+}
+
+inline bool ReadFileAt(HANDLE file, ULONGLONG offset, BYTE* data, DWORD size) {
+  LARGE_INTEGER position;
+  position.QuadPart = static_cast<LONGLONG>(offset);
+  DWORD read = 0;
+  return SetFilePointerEx(file, position, NULL, FILE_BEGIN) &&
+         ReadFile(file, data, size, &read, NULL) && read == size;
+}
+
+}  // namespace rescle
+
+#endif  // SCOPED_FILE_H
@@ -0,0 +1,296 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#include "string_list.h"
+
+#include <stdio.h>
+
+namespace rescle {
+
+namespace {
+
+// Parses a decimal number no larger than 0xffff.
+bool ParseWord(const std::wstring& text, WORD* value) {
+  if (text.empty() || text.length() > 5)
+    return false;
+
+  UINT result = 0;
+  for (wchar_t c : text) {
+    if (c < L'0' || c > L'9')
+      return false;
+    result = result * 10 + (c - L'0');
+  }
+  if (result > 0xffff)
+    return false;
+
+  *value = static_cast<WORD>(result);
+  return true;
+}
+
+bool IsSpace(wchar_t c) {
+  return c == L' ' || c == L'\t' || c == L'\r' || c == L'\n';
+}
+
+class JsonParser {
+ public:
+  explicit JsonParser(const std::wstring& text) : text_(text), position_(0), line_(1) {}
+
+  bool Parse(std::vector<StringEntry>* entries) {
+    SkipSpace();
+    if (!Consume(L'{') || !ParseMembers(entries, NULL))
+      return Fail();
+    SkipSpace();
+    return position_ == text_.length() || Fail();
+  }
+
+ private:
+  // Parses the members of an object whose '{' was consumed. Nested objects
+  // are only allowed at the top level, where |langId| is NULL.
+  bool ParseMembers(std::vector<StringEntry>* entries, const WORD* langId) {
+    SkipSpace();
+    if (Consume(L'}'))
+      return true;
+
+    while (true) {
+      std::wstring key;
+      WORD number = 0;
+      SkipSpace();
+      if (!ParseString(&key) || !ParseWord(key, &number))
+        return false;
+
+      SkipSpace();
+      if (!Consume(L':'))
+        return false;
+
+      SkipSpace();
+      if (langId == NULL && Consume(L'{')) {
+        if (!ParseMembers(entries, &number))
+          return false;
+      } else {
+        StringEntry entry;
+        entry.hasLangId = langId != NULL;
+        entry.langId = langId != NULL ? *langId : 0;
+        entry.id = number;
+        if (!ParseString(&entry.value))
+          return false;
+        entries->push_back(std::move(entry));
+      }
+
+      SkipSpace();
+      if (Consume(L'}'))
+        return true;
+      if (!Consume(L','))
+        return false;
+    }
+  }
+
+  bool ParseString(std::wstring* value) {
+    if (!Consume(L'"'))
+      return false;
+
+    value->clear();
+    while (position_ < text_.length()) {
+      wchar_t c = text_[position_++];
+      if (c == L'"')
+        return true;
+      if (c == L'\n')
+        ++line_;
+      if (c != L'\\') {
+        value->push_back(c);
+        continue;
+      }
+
+      if (position_ == text_.length())
+        return false;
+      switch (text_[position_++]) {
+        case L'"':  value->push_back(L'"'); break;
+        case L'\\': value->push_back(L'\\'); break;
+        case L'/':  value->push_back(L'/'); break;
+        case L'b':  value->push_back(L'\b'); break;
+        case L'f':  value->push_back(L'\f'); break;
+        case L'n':  value->push_back(L'\n'); break;
+        case L'r':  value->push_back(L'\r'); break;
+        case L't':  value->push_back(L'\t'); break;
+        case L'u': {
+          // Surrogate pairs arrive as two escapes, which is UTF-16 already.
+          if (text_.length() - position_ < 4)
+            return false;
+          wchar_t unit = 0;
+          for (int i = 0; i < 4; ++i) {
+            wchar_t digit = text_[position_++];
+            unit <<= 4;
+            if (digit >= L'0' && digit <= L'9')
+              unit |= digit - L'0';
+            else if (digit >= L'a' && digit <= L'f')
+              unit |= digit - L'a' + 10;
+            else if (digit >= L'A' && digit <= L'F')
+              unit |= digit - L'A' + 10;
+            else
+              return false;
+          }
+          value->push_back(unit);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  void SkipSpace() {
+    for (; position_ < text_.length() && IsSpace(text_[position_]); ++position_) {
+      if (text_[position_] == L'\n')
+        ++line_;
+    }
+  }
+
+  bool Consume(wchar_t c) {
+    if (position_ == text_.length() || text_[position_] != c)
+      return false;
+    ++position_;
+    return true;
+  }
+
+  bool Fail() {
+    fprintf(stderr, "Malformed JSON string list at line %zu\n", line_);
+    return false;
+  }
+
+  const std::wstring& text_;
+  size_t position_;
+  size_t line_;
+};
+
+class CsvParser {
+ public:
+  explicit CsvParser(const std::wstring& text) : text_(text), position_(0), line_(1) {}
+
+  bool ParseRows(std::vector<std::vector<std::wstring>>* rows) {
+    std::vector<std::wstring> fields;
+    while (position_ < text_.length()) {
+      size_t line = line_;
+      if (!ParseRecord(&fields))
+        return Fail(line);
+      if (fields.size() == 1 && fields[0].empty())
+        continue;  // blank line
+      rows->push_back(std::move(fields));
+    }
+    return true;
+  }
+
+  bool Parse(std::vector<StringEntry>* entries) {
+    std::vector<std::wstring> fields;
+    bool first = true;
+    while (position_ < text_.length()) {
+      size_t line = line_;
+      if (!ParseRecord(&fields))
+        return Fail(line);
+      if (fields.size() == 1 && fields[0].empty())
+        continue;  // blank line
+
+      bool header = first;
+      first = false;
+      StringEntry entry;
+      WORD id = 0;
+      if (!ParseWord(fields[0], &id)) {
+        if (header)
+          continue;
+        return Fail(line);
+      }
+      entry.id = id;
+
+      if (fields.size() == 3) {
+        entry.hasLangId = true;
+        if (!ParseWord(fields[1], &entry.langId))
+          return Fail(line);
+      } else if (fields.size() != 2) {
+        return Fail(line);
+      }
+      entry.value = std::move(fields.back());
+      entries->push_back(std::move(entry));
+    }
+    return true;
+  }
+
+ private:
+  bool ParseRecord(std::vector<std::wstring>* fields) {
+    fields->clear();
+    while (true) {
+      fields->emplace_back();
+      if (!ParseField(&fields->back()))
+        return false;
+
+      if (position_ == text_.length())
+        return true;
+      wchar_t c = text_[position_++];
+      if (c == L'\n') {
+        ++line_;
+        return true;
+      }
+      if (c != L',')
+        return false;
+    }
+  }
+
+  // Leaves the position at the separator that ends the field.
+  bool ParseField(std::wstring* value) {
+    if (position_ < text_.length() && text_[position_] == L'"') {
+      ++position_;
+      while (true) {
+        if (position_ == text_.length())
+          return false;
+        wchar_t c = text_[position_++];
+        if (c == L'"') {
+          if (position_ == text_.length() || text_[position_] != L'"')
+            break;
+          ++position_;  // doubled quote
+        } else if (c == L'\n') {
+          ++line_;
+        }
+        value->push_back(c);
+      }
+      if (position_ < text_.length() && text_[position_] == L'\r')
+        ++position_;
+      return position_ == text_.length() || text_[position_] == L',' || text_[position_] == L'\n';
+    }
+
+    for (; position_ < text_.length(); ++position_) {
+      wchar_t c = text_[position_];
+      if (c == L',' || c == L'\n')
+        break;
+      value->push_back(c);
+    }
+    if (!value->empty() && value->back() == L'\r')
+      value->pop_back();
+    return true;
+  }
+
+  bool Fail(size_t line) {
+    fprintf(stderr, "Malformed CSV at line %zu\n", line);
+    return false;
+  }
+
+  const std::wstring& text_;
+  size_t position_;
+  size_t line_;
+};
+
+}  // namespace
+
+bool ParseStringList(const std::wstring& text, std::vector<StringEntry>* entries) {
+  size_t start = 0;
+  while (start < text.length() && IsSpace(text[start]))
+    ++start;
+
+  if (start < text.length() && text[start] == L'{')
+    return JsonParser(text).Parse(entries);
+  return CsvParser(text).Parse(entries);
+}
+
+bool ParseCsvRows(const std::wstring& text, std::vector<std::vector<std::wstring>>* rows) {
+  return CsvParser(text).ParseRows(rows);
+}
+
+}  // namespace rescle
@@ -0,0 +1,39 @@
+// Copyright (c) 2013 GitHub, Inc. All rights reserved.
+// Use of this source code is governed by MIT license that can be found in the
+// LICENSE file.
+
+#ifndef STRING_LIST_H
+#define STRING_LIST_H
+
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+namespace rescle {
+
+// A string table entry of a bulk import. Without |hasLangId| it applies to
+// the selected languages.
+struct StringEntry {
+  bool hasLangId = false;
+  LANGID langId = 0;
+  UINT id = 0;
+  std::wstring value;
+};
+
+// Parses id to string pairs given either as a JSON object, where a nested
+// object holds the strings of one LANGID:
+//
+//   {"101": "Hello", "1031": {"101": "Hallo"}}
+//
+// or as CSV rows of "id,value" or "id,langid,value", quoted as in RFC 4180.
+// A first CSV row whose id is not a number is taken as a header. Ids and
+// LANGIDs are decimal.
+bool ParseStringList(const std::wstring& text, std::vector<StringEntry>* entries);
+
+// Parses CSV rows quoted as in RFC 4180, skipping blank lines.
+bool ParseCsvRows(const std::wstring& text, std::vector<std::vector<std::wstring>>* rows);
+
+}  // namespace rescle
+
+#endif  // STRING_LIST_H